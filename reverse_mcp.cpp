@@ -25,6 +25,7 @@
  * - "list databases" or "list db" - Calls sqlite to list all databases (START HERE to discover what's available)
  * - "list tables" - Calls sqlite to list tables in :memory: database
  * - "list tables in <database>" - Calls sqlite to list tables in specific database (e.g., "list tables in test.db")
+ * - "parallel" - Issues two sqlite calls at once with call_mcp_tool_async() and when_all()
  * - Any other message - Simple echo response
  * 
  * BUILD/RUN INSTRUCTIONS:
@@ -36,9 +37,28 @@
  *     (Linux/macOS)
  *   
  *   Run:
- *     ./reverse_mcp_cpp [--background]
+ *     ./reverse_mcp_cpp [--background] [--http-pool-size N] [--workers N]
+ *     ./reverse_mcp_cpp --bench-mock [--bench-calls N] [--bench-concurrency N]   (JSON on stdout)
+ *     ./reverse_mcp_cpp --metrics-port 9464 --log-level debug
  *     ./reverse_mcp_cpp --help
  *   
+ *   Benchmarking:
+ *     --bench drives concurrent echo calls through the full path against the live server;
+ *     --bench-mock does the same against an in-process loopback mock server.
+ *     Add -DREVERSE_MCP_COUNT_ALLOCS when compiling to report allocations per call.
+ *     --record FILE appends every SSE event received and message sent, timestamped, to FILE
+ *     (JSON Lines); --replay FILE [--replay-speed X|max] re-sends the recorded reverse calls
+ *     from the mock server through the dispatcher and handlers and reports their latency.
+ *   
+ *   Coroutines (optional):
+ *     g++ -std=c++20 -DREVERSE_MCP_COROUTINES ... enables co_await on call_mcp_tool_async(),
+ *     when_all_async() and the DetachedTask handler type. Without it the same calls are
+ *     available as futures (get/when_all) and callbacks (then).
+ *   
+ *   Compression (optional):
+ *     g++ -std=c++17 -DREVERSE_MCP_ZLIB -DREVERSE_MCP_ZSTD ... -lz -lzstd lets large request
+ *     bodies go out gzip- or zstd-encoded when the server advertises it (see --compress).
+ *   
  *   Requirements:
  *     - C++17 compiler (g++ 7.0+)
  *     - Windows: WinHTTP library (included with Windows SDK)
@@ -100,17 +120,22 @@
  * INTEGRATION STEPS:
  * ------------------
  * 1. Copy this file to your project
- * 2. Modify the tool registration section (search for "demo_tool_cpp"):
- *    - Change tool_name to your tool's unique identifier
+ * 2. Modify the tool registration section (search for "add_demo_tools"):
+ *    - Change the ToolSpec name to your tool's unique identifier
  *    - Update description and readme to explain your tool's purpose
  *    - Define your tool's parameters schema
- *    - Set a unique callback_endpoint and TOOL_API_KEY
+ *    - Set a unique callback_endpoint and api_key (sent as TOOL_API_KEY)
+ *    - Add one ToolSpec and handler per tool - a single process can provide many tools
  * 
  * 3. Replace the handleEchoRequest() function with your tool's actual logic:
  *    - Extract parameters from the input_data
  *    - Perform your tool's operations (file I/O, API calls, computations, etc.)
  *    - OPTIONALLY: Call other MCP tools using conn->call_mcp_tool() method
  *    - Return a result string with "content" array and "isError" boolean
+ *    - Allocate temporaries from call.arena (pmr::string s(call.arena)); it is reset in one step
+ *      after each call, so a handler written this way never touches the global heap
+ *    - For free-text commands, register keywords with a CommandRouter once and call match():
+ *      one case-insensitive pass picks the command and yields arguments as string_views
  * 
  * 4. (Optional) Use call_mcp_tool() to orchestrate other MCP tools:
  *    - Your handler receives SSEConnection* pointer parameter
@@ -134,29 +159,100 @@
  *   "isError": false  // or true if an error occurred
  * }
  * 
+ * For large results (screenshots, renders, files) build the reply with StreamingReply instead:
+ * items reference your data, images are base64-encoded chunk by chunk (SSSE3 when available)
+ * while the POST is being sent, and an image can come from a callback so it never has to be
+ * fully in memory. See the demo's "image" operation.
+ * 
  * THREADING MODEL:
  * ----------------
- * - Main thread: Handles tool registration and processes reverse calls from the queue
+ * - Main thread: Handles tool registration, then supervises the registered connection,
+ *   sleeping on an eventfd/event object that Ctrl+C and a closing SSE stream signal. Any bytes
+ *   on the stream count as a heartbeat; after --heartbeat-interval of quiet it sends a ping,
+ *   and when --heartbeat-timeout passes without an answer it drops the connection and reconnects
+ * - Dispatcher worker threads (--workers): pull reverse calls from the queue, run handlers,
+ *   and send tools/reply independently; per-tool concurrency limits protect non-thread-safe code.
+ *   Each worker owns a monotonic arena for its current call, and finished message buffers go
+ *   back to the SSE reader, so the dispatch path does not allocate in steady state (--bench
+ *   reports dispatch_allocs_per_call when built with -DREVERSE_MCP_COUNT_ALLOCS)
  * - SSE reader thread: Continuously reads the SSE stream and routes messages to queues
- * - Each JSON-RPC request gets its own response queue for thread-safe blocking waits
+ *   (reverse calls go through bounded lock-free MPMC queues; idle workers park on a futex)
+ * - Priority lanes: each call is sorted by tool/operation (ToolSpec::lane, operation_lanes)
+ *   into a reserved, interactive, normal or batch queue. Workers take reserved calls first,
+ *   then follow --lane-scheduling (weighted by --lane-weights, or strict); --reserved-workers
+ *   threads serve only the reserved lane (the demo's "stats"), so it never waits behind work
+ * - Admission control: --queue-capacity and --max-in-flight bound the calls waiting or running.
+ *   Past them, --overload-policy block pauses the stream, reject answers the new call with an
+ *   isError reply at once, and shed-oldest does so to the oldest queued call of the same or
+ *   a lower lane instead
+ *   (counted in reverse_mcp_calls_rejected_total / reverse_mcp_calls_shed_total)
+ * - Each JSON-RPC request gets its own slot in a sharded pending-response table, woken by the
+ *   SSE reader when the response with the matching "id" arrives
+ * - POSTs share a keep-alive connection pool owned by SSEConnection (--http-pool-size handles).
+ *   The advertised message endpoint is resolved once per session (URL, parsed host/path and
+ *   the header block) and shared read-only by every POST
+ * - When the shim config advertises a local endpoint ("unixSocket"), the SSE stream and every
+ *   POST use it (CURLOPT_UNIX_SOCKET_PATH, plain HTTP) instead of loopback TCP+TLS, falling
+ *   back to the server URL if it cannot be reached. WinHTTP has no such transport, so the
+ *   Windows build ignores "namedPipe" and stays on HTTPS
+ * - Request bodies of --compress-min-bytes or more (sqlite result sets, streamed images) are
+ *   compressed, zstd preferred over gzip, when the server lists the encoding in the SSE
+ *   response's Accept-Encoding (build with -DREVERSE_MCP_ZSTD -lzstd and/or -DREVERSE_MCP_ZLIB
+ *   -lz). Streamed replies are compressed chunk by chunk into the upload buffer; the threshold
+ *   rises while compressing costs more time than it saves. The SSE stream may arrive compressed
+ * - With --http2 the SSE stream and all POSTs become streams of one HTTP/2 connection; on
+ *   Linux/macOS a single multiplexer thread drives them all through a curl multi handle
+ * - With --event-loop, one thread drives the SSE stream and every POST through the curl multi
+ *   socket API on epoll/kqueue (WinHTTP async callbacks on Windows); replies are sent without
+ *   blocking the worker, so in-flight requests are not limited by thread count
+ * - With --batch-window-us, replies and requests that are sent while another POST is
+ *   outstanding are coalesced into one JSON-RPC batch array (never delaying a lone reply)
+ * - Every reverse call has a deadline (--call-timeout, counted from arrival) and can be
+ *   cancelled by the server with notifications/cancelled. Calls that expire or are cancelled
+ *   while queued never reach the handler; nested call_mcp_tool() waits are cut to the time
+ *   left and end at once on cancellation, and no tools/reply is sent for a cancelled call
+ * - With --result-cache N, call_mcp_tool() results for allow-listed idempotent calls (the demo's
+ *   sqlite .databases/.tables) are kept in an LRU cache for --result-cache-ttl seconds, and
+ *   identical calls made while one is in flight share its round trip
+ * - With several --manifest/--server targets, each server gets a session thread with its own
+ *   connection, reconnect backoff and cached endpoint, and the main thread only relays Ctrl+C.
+ *   Reverse calls are answered on the connection they came from; call_mcp_tool() goes to the
+ *   healthy server with the fewest requests awaiting a response (--route least-loaded) or the
+ *   shortest expected wait (lowest-latency), with reverse_mcp_server_* series per server
+ * - Log writer thread: lines that pass the --log-level gate are queued and written to stderr
+ *   off the hot path, warnings included (errors are written synchronously)
+ * 
+ * OBSERVABILITY:
+ * --------------
+ * - Counters and histograms (reverse calls, replies, POST latency, handler time, bytes in/out,
+ *   reconnects, queue depth) live in per-thread padded slots and are summed only when read
+ * - --metrics-port N serves them in Prometheus text format on 127.0.0.1:N
+ * - Calling demo_tool_cpp with {"operation":"stats"} returns the same text to the AI
  * 
  * DEPENDENCIES:
  * -------------
  * C++17 compiler with standard library:
  * - Windows: WinHTTP (included in Windows SDK), ws2_32, crypt32
- * - Linux/macOS: libcurl for HTTP/HTTPS communication
+ * - Linux/macOS: libcurl for HTTP/HTTPS communication (built with nghttp2 for --http2)
  * - Standard C++ threading, chrono, sstream libraries
  * 
  * ERROR HANDLING & RECONNECTION:
  * -------------------------------
  * - SSL certificate verification is disabled (self-signed certs are common in local servers)
  * - Native binary timeout is 5 seconds (increase if needed)
- * - SSE response timeout is 10 seconds per request (configurable)
+ * - The discovered url/Authorization are cached on disk (tied to the manifest's mtime, 24h TTL).
+ *   A cached endpoint that fails with a connection or auth error is dropped and the native
+ *   binary is re-run immediately
+ * - SSE response timeout is 10 seconds per request, 30 seconds for call_mcp_tool (configurable)
  * - All errors are logged to stderr for debugging
- * - Automatic reconnection with exponential backoff if SSE connection drops:
- *   * Retry delays: 2s, 4s, 8s, 16s, 32s, 60s (max), 60s, 60s...
- *   * After successful reconnection, retry counter resets
- *   * Tool is automatically re-registered after reconnection
+ * - Automatic reconnection if SSE connection drops:
+ *   * The first retry after a drop goes out within ~20ms, reusing the known endpoint and
+ *     skipping manifest lookup, discovery and tools/list
+ *   * The SSE GET carries Last-Event-ID so the server can replay events sent while we were away
+ *   * Further retries use decorrelated jitter: random between 0.5s and 3x the previous delay,
+ *     capped at 60s, so many clients don't reconnect in lockstep
+ *   * After successful reconnection, the backoff resets
+ *   * All tools are re-registered concurrently from their pre-serialized payloads
  *   * Retries forever until manually stopped (Ctrl+C)
  */
 
@@ -166,7 +262,13 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
 #include <queue>
+#include <deque>
+#include <list>
+#include <set>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -175,776 +277,7835 @@
 #include <cstring>
 #include <csignal>
 #include <algorithm>
+#include <functional>
+#include <string_view>
+#include <cctype>
+#include <cstdint>
+#include <atomic>
+#include <random>
+#ifdef REVERSE_MCP_COROUTINES
+#include <coroutine>  // C++20: co_await support for call_mcp_tool_async()
+#endif
+#ifdef REVERSE_MCP_ZLIB
+#include <zlib.h>     // gzip request bodies (link -lz)
+#endif
+#ifdef REVERSE_MCP_ZSTD
+#include <zstd.h>     // zstd request bodies (link -lzstd)
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>  // pshufb for base64_encode()
+#endif
 
 #ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <winhttp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #pragma comment(lib, "winhttp.lib")
+#pragma comment(lib, "Synchronization.lib")
+#pragma comment(lib, "ws2_32.lib")
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <sys/stat.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define REVERSE_MCP_EPOLL
+#define REVERSE_MCP_SOCKET_EVENTS
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#include <sys/event.h>
+#define REVERSE_MCP_KQUEUE
+#define REVERSE_MCP_SOCKET_EVENTS
+#endif
 #include <curl/curl.h>
 #endif
 
 using namespace std;
 
-// Global flag for graceful shutdown
-static volatile bool g_running = true;
+// Optional global allocation counter used by --bench (build with -DREVERSE_MCP_COUNT_ALLOCS)
+// Off by default: replacing operator new is not something an embedding host should inherit.
+// Dispatcher workers also set t_alloc_dispatch while handling a call, so --bench can report
+// the heap allocations of the dispatch path (parse, handler, reply) separately.
+static thread_local bool t_alloc_uncounted = false;
+static thread_local bool t_alloc_dispatch = false;
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+static atomic<uint64_t> g_alloc_count{0};
+static atomic<uint64_t> g_dispatch_alloc_count{0};
 
-// Signal handler for Ctrl+C
-void signal_handler(int signal) {
-  if (signal == SIGINT) {
-    g_running = false;
-  }
+void* operator new(size_t size) {
+  if (!t_alloc_uncounted) g_alloc_count.fetch_add(1, memory_order_relaxed);
+  if (t_alloc_dispatch) g_dispatch_alloc_count.fetch_add(1, memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  return p;
 }
+// GCC sees operator new's memory reach free() and warns, though this pair allocates with malloc()
+#if defined(__GNUC__) && __GNUC__ >= 11 && !defined(__clang__)  // The warning is new in GCC 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+#if defined(__GNUC__) && __GNUC__ >= 11 && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+#endif
 
-// Simple JSON string escaper
-string json_escape(const string& str) {
-  ostringstream escaped;
-  for (char c : str) {
-    if (c == '"') escaped << "\\\"";
-    else if (c == '\\') escaped << "\\\\";
-    else if (c == '\n') escaped << "\\n";
-    else if (c == '\r') escaped << "\\r";
-    else if (c == '\t') escaped << "\\t";
-    else escaped << c;
-  }
-  return escaped.str();
-}
+// Global flag for graceful shutdown
+static volatile bool g_running = true;
 
-// Extract JSON string value
-string extract_json_string(const string& json, const string& key) {
-  string search = "\"" + key + "\":";
-  size_t pos = json.find(search);
-  if (pos == string::npos) return "";
-  
-  pos = json.find('"', pos + search.length());
-  if (pos == string::npos) return "";
+// Wakes a thread blocked in wait() right away; notify() is async-signal-safe
+// eventfd on Linux, a self-pipe on other POSIX systems and an auto-reset event on Windows, so
+// waiters sleep in the kernel instead of polling a flag.
+class WakeupEvent {
+public:
+  WakeupEvent() {
+#ifdef _WIN32
+    event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#elif defined(__linux__)
+    read_fd = write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    int fds[2] = {-1, -1};
+    if (pipe(fds) == 0) {
+      for (int fd : fds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      read_fd = fds[0];
+      write_fd = fds[1];
+    }
+#endif
+  }
   
-  size_t end = json.find('"', pos + 1);
-  if (end == string::npos) return "";
+  ~WakeupEvent() {
+#ifdef _WIN32
+    if (event) CloseHandle(event);
+#else
+    if (read_fd >= 0) close(read_fd);
+    if (write_fd >= 0 && write_fd != read_fd) close(write_fd);
+#endif
+  }
   
-  return json.substr(pos + 1, end - pos - 1);
-}
-
-// Find native messaging manifest
-string find_native_messaging_manifest() {
-  vector<string> possible_paths;
+  WakeupEvent(const WakeupEvent&) = delete;
+  WakeupEvent& operator=(const WakeupEvent&) = delete;
   
+  void notify() {
 #ifdef _WIN32
-  char* local_appdata = getenv("LOCALAPPDATA");
-  if (local_appdata) {
-    possible_paths.push_back(string(local_appdata) + "\\AuraFriday\\com.aurafriday.shim.json");
-  }
-#elif defined(__APPLE__)
-  const char* home = getenv("HOME");
-  if (home) {
-    possible_paths.push_back(string(home) + "/Library/Application Support/Google/Chrome/NativeMessagingHosts/com.aurafriday.shim.json");
-    possible_paths.push_back(string(home) + "/Library/Application Support/Chromium/NativeMessagingHosts/com.aurafriday.shim.json");
-  }
+    if (event) SetEvent(event);
 #else
-  const char* home = getenv("HOME");
-  if (home) {
-    possible_paths.push_back(string(home) + "/.config/google-chrome/NativeMessagingHosts/com.aurafriday.shim.json");
-    possible_paths.push_back(string(home) + "/.config/chromium/NativeMessagingHosts/com.aurafriday.shim.json");
-  }
+    uint64_t one = 1;  // eventfd needs 8 bytes; a pipe takes any length
+    if (write_fd >= 0) {
+      ssize_t ignored = write(write_fd, &one, sizeof(one));
+      (void)ignored;
+    }
 #endif
+  }
   
-  for (const auto& path : possible_paths) {
-    ifstream f(path);
-    if (f.good()) {
-      f.close();
-      return path;
-    }
+  // Sleep until notify() or the timeout; true if notified. Notifications do not queue up:
+  // several before a wait() wake it once.
+  bool wait(chrono::milliseconds timeout) {
+#ifdef _WIN32
+    if (!event) return false;
+    return WaitForSingleObject(event, (DWORD)max<long long>(0, timeout.count())) == WAIT_OBJECT_0;
+#else
+    if (read_fd < 0) return false;
+    pollfd p = { read_fd, POLLIN, 0 };
+    int n = poll(&p, 1, (int)min<long long>(max<long long>(0, timeout.count()), INT32_MAX));
+    if (n <= 0) return false;
+    char drain[64];
+    while (read(read_fd, drain, sizeof(drain)) > 0) {}
+    return true;
+#endif
   }
   
-  return "";
-}
+private:
+#ifdef _WIN32
+  HANDLE event = NULL;
+#else
+  int read_fd = -1;
+  int write_fd = -1;
+#endif
+};
 
-// Read manifest file
-string read_file(const string& path) {
-  ifstream file(path);
-  if (!file.is_open()) return "";
-  
-  ostringstream content;
-  content << file.rdbuf();
-  return content.str();
+// Signalled on Ctrl+C and whenever the SSE stream closes; main_worker sleeps on it
+static WakeupEvent g_wakeup;
+
+// Signal handler for Ctrl+C
+void signal_handler(int signal) {
+  if (signal == SIGINT) {
+    g_running = false;
+    g_wakeup.notify();
+  }
 }
 
-// Execute native binary and get config
-string discover_mcp_server_endpoint(const string& binary_path) {
-  cerr << "Running native binary: " << binary_path << endl;
-  cerr << "[DEBUG] Native messaging protocol uses 4-byte length prefix (little-endian uint32)" << endl;
+// Process-wide counters and latency histograms
+// Every thread increments its own cache-line-padded slot, so recording on the hot path is an
+// uncontended relaxed add with no locking or false sharing. Slots are only summed when the
+// metrics are read (Prometheus scrape or the "stats" operation), which is rare by comparison.
+class Metrics {
+public:
+  enum Counter {
+    REVERSE_CALLS,     // Reverse calls received from the server
+    REPLIES_SENT,      // tools/reply messages accepted by the server
+    HTTP_POSTS,        // POSTs to the message endpoint
+    HTTP_POST_ERRORS,  // POSTs that did not get 202 Accepted
+    BYTES_OUT,         // Request bytes POSTed
+    BYTES_IN,          // Bytes read from the SSE stream
+    SSE_EVENTS,        // SSE events parsed
+    RECONNECTS,        // Reconnect attempts after a lost or failed connection
+    CALLS_REJECTED,    // Reverse calls refused at admission with an isError reply
+    CALLS_SHED,        // Queued reverse calls dropped (with an isError reply) to admit newer ones
+    CACHE_HITS,        // call_mcp_tool() answered from the result cache
+    CACHE_MISSES,      // Cacheable call_mcp_tool() calls that went to the server
+    CACHE_COALESCED,   // Cacheable calls that waited for an identical call already in flight
+    CALLS_CANCELLED,   // notifications/cancelled received for reverse calls
+    CALLS_EXPIRED,     // Reverse calls dropped because their deadline passed before a worker got to them
+    SSE_KEEPALIVES,    // Keep-alive comment lines (": ping") on the SSE stream
+    HEARTBEAT_PINGS,   // JSON-RPC pings sent because the SSE stream went quiet
+    HEARTBEAT_TIMEOUTS,  // Connections dropped because nothing arrived within the heartbeat window
+    COMPRESSED_POSTS,  // POSTs sent with a compressed body
+    COMPRESSION_SAVED_BYTES,  // Request bytes saved by compression
+    COUNTER_COUNT
+  };
   
-#ifdef _WIN32
-  SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
-  HANDLE hStdoutRead, hStdoutWrite;
+  enum Histogram {
+    HTTP_POST_LATENCY,  // Time to POST a message and get the 202
+    HANDLER_TIME,       // Time spent in a reverse call handler, including its tools/reply
+    BATCH_SIZE,         // Messages per POST when batching is enabled (a count, not a time)
+    HISTOGRAM_COUNT
+  };
   
-  if (!CreatePipe(&hStdoutRead, &hStdoutWrite, &sa, 0)) {
-    return "";
-  }
+  static const size_t kSlots = 64;
+  static const size_t kBuckets = 15;  // Finite bucket bounds; one more slot counts +Inf
   
-  SetHandleInformation(hStdoutRead, HANDLE_FLAG_INHERIT, 0);
+  void add(Counter counter, uint64_t n = 1) {
+    slot().counters[counter].fetch_add(n, memory_order_relaxed);
+  }
   
-  STARTUPINFOA si = { sizeof(STARTUPINFOA) };
-  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-  si.hStdOutput = hStdoutWrite;
-  si.hStdError = hStdoutWrite;
-  si.wShowWindow = SW_HIDE;
+  void observe(Histogram histogram, chrono::nanoseconds elapsed) {
+    uint64_t us = (uint64_t)max<long long>(0, chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    record(histogram, us, (uint64_t)max<long long>(0, elapsed.count()));
+  }
   
-  PROCESS_INFORMATION pi = { 0 };
+  // For histograms of counts such as BATCH_SIZE
+  void observe_count(Histogram histogram, uint64_t value) {
+    record(histogram, value, value);
+  }
   
-  string cmd = "\"" + binary_path + "\"";
-  if (!CreateProcessA(NULL, (LPSTR)cmd.c_str(), NULL, NULL, TRUE, 
-                      CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
-    CloseHandle(hStdoutRead);
-    CloseHandle(hStdoutWrite);
-    return "";
+  // Gauge read at scrape time (e.g. the current connection's reverse queue depth)
+  void set_queue_depth_source(function<size_t()> source) {
+    lock_guard<mutex> lock(gauge_mutex);
+    queue_depth_source = move(source);
   }
   
-  CloseHandle(hStdoutWrite);
+  uint64_t counter(Counter counter) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < kSlots; i++) total += slots[i].counters[counter].load(memory_order_relaxed);
+    return total;
+  }
   
-  // Read output using Chrome Native Messaging protocol
-  // Protocol: 4-byte length (little-endian uint32) followed by JSON message
+  size_t queue_depth() {
+    lock_guard<mutex> lock(gauge_mutex);
+    return queue_depth_source ? queue_depth_source() : 0;
+  }
   
-  // Step 1: Read the 4-byte length prefix (little-endian uint32)
-  uint8_t length_bytes[4];
-  DWORD bytes_read = 0;
-  DWORD total_read = 0;
+  // Appends labelled per-server series at scrape time (see ServerPool::write_prometheus)
+  void set_server_source(function<void(ostream&)> source) {
+    lock_guard<mutex> lock(gauge_mutex);
+    server_source = move(source);
+  }
   
-  while (total_read < 4) {
-    if (!ReadFile(hStdoutRead, length_bytes + total_read, 4 - total_read, &bytes_read, NULL) || bytes_read == 0) {
-      cerr << "ERROR: Failed to read 4-byte length prefix (got " << total_read << " bytes)" << endl;
-      TerminateProcess(pi.hProcess, 1);
-      CloseHandle(pi.hProcess);
-      CloseHandle(pi.hThread);
-      CloseHandle(hStdoutRead);
-      return "";
+  // Prometheus text exposition format (version 0.0.4)
+  string prometheus_text() {
+    static const char* counter_names[COUNTER_COUNT][2] = {
+      {"reverse_mcp_reverse_calls_total", "Reverse tool calls received"},
+      {"reverse_mcp_replies_sent_total", "tools/reply messages accepted by the server"},
+      {"reverse_mcp_http_posts_total", "POST requests to the message endpoint"},
+      {"reverse_mcp_http_post_errors_total", "POST requests that were not accepted"},
+      {"reverse_mcp_bytes_out_total", "Request bytes sent"},
+      {"reverse_mcp_bytes_in_total", "SSE bytes received"},
+      {"reverse_mcp_sse_events_total", "SSE events received"},
+      {"reverse_mcp_reconnects_total", "Reconnect attempts"},
+      {"reverse_mcp_calls_rejected_total", "Reverse calls rejected because the client was overloaded"},
+      {"reverse_mcp_calls_shed_total", "Queued reverse calls shed to admit newer ones"},
+      {"reverse_mcp_result_cache_hits_total", "Tool calls answered from the result cache"},
+      {"reverse_mcp_result_cache_misses_total", "Cacheable tool calls sent to the server"},
+      {"reverse_mcp_result_cache_coalesced_total", "Tool calls that shared an identical in-flight call"},
+      {"reverse_mcp_calls_cancelled_total", "Reverse calls cancelled by the server"},
+      {"reverse_mcp_calls_expired_total", "Reverse calls dropped after their deadline passed"},
+      {"reverse_mcp_sse_keepalives_total", "Keep-alive comments received on the SSE stream"},
+      {"reverse_mcp_heartbeat_pings_total", "Pings sent because the SSE stream was quiet"},
+      {"reverse_mcp_heartbeat_timeouts_total", "Connections dropped after a missed heartbeat"},
+      {"reverse_mcp_compressed_posts_total", "POST requests sent with a compressed body"},
+      {"reverse_mcp_compression_saved_bytes_total", "Request bytes saved by compression"},
+    };
+    static const char* histogram_names[HISTOGRAM_COUNT][2] = {
+      {"reverse_mcp_http_post_seconds", "Latency of POSTs to the message endpoint"},
+      {"reverse_mcp_handler_seconds", "Time spent handling a reverse call"},
+      {"reverse_mcp_batch_size", "JSON-RPC messages sent per batched POST"},
+    };
+    
+    ostringstream out;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+      out << "# HELP " << counter_names[c][0] << " " << counter_names[c][1] << "\n"
+          << "# TYPE " << counter_names[c][0] << " counter\n"
+          << counter_names[c][0] << " " << counter((Counter)c) << "\n";
     }
-    total_read += bytes_read;
+    out << "# HELP reverse_mcp_reverse_queue_depth Reverse calls waiting for a worker\n"
+        << "# TYPE reverse_mcp_reverse_queue_depth gauge\n"
+        << "reverse_mcp_reverse_queue_depth " << queue_depth() << "\n";
+    {
+      lock_guard<mutex> lock(gauge_mutex);
+      if (server_source) server_source(out);
+    }
+    
+    for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+      uint64_t buckets[kBuckets + 1] = {};
+      uint64_t sum = 0;
+      for (size_t i = 0; i < kSlots; i++) {
+        for (size_t b = 0; b <= kBuckets; b++) buckets[b] += slots[i].buckets[h][b].load(memory_order_relaxed);
+        sum += slots[i].sums[h].load(memory_order_relaxed);
+      }
+      bool seconds = is_latency((Histogram)h);
+      const char* name = histogram_names[h][0];
+      out << "# HELP " << name << " " << histogram_names[h][1] << "\n"
+          << "# TYPE " << name << " histogram\n";
+      uint64_t cumulative = 0;
+      for (size_t b = 0; b <= kBuckets; b++) {
+        cumulative += buckets[b];
+        out << name << "_bucket{le=\"";
+        if (b < kBuckets) out << (seconds ? (double)bucket_bounds(h)[b] / 1e6 : (double)bucket_bounds(h)[b]);
+        else out << "+Inf";
+        out << "\"} " << cumulative << "\n";
+      }
+      out << name << "_sum " << (seconds ? (double)sum / 1e9 : (double)sum) << "\n"
+          << name << "_count " << cumulative << "\n";
+    }
+    return out.str();
   }
   
-  // Convert little-endian bytes to uint32
-  uint32_t message_length = length_bytes[0] | (length_bytes[1] << 8) | (length_bytes[2] << 16) | (length_bytes[3] << 24);
-  cerr << "[DEBUG] Message length from native binary: " << message_length << " bytes" << endl;
+private:
+  struct alignas(64) Slot {
+    atomic<uint64_t> counters[COUNTER_COUNT] = {};
+    atomic<uint64_t> buckets[HISTOGRAM_COUNT][kBuckets + 1] = {};
+    atomic<uint64_t> sums[HISTOGRAM_COUNT] = {};  // Nanoseconds for latencies, plain sum for counts
+  };
   
-  if (message_length <= 0 || message_length > 10000000) {
-    cerr << "ERROR: Invalid message length: " << message_length << endl;
-    TerminateProcess(pi.hProcess, 1);
-    CloseHandle(pi.hProcess);
-    CloseHandle(pi.hThread);
-    CloseHandle(hStdoutRead);
-    return "";
-  }
+  static constexpr uint64_t kBucketBoundsUs[kBuckets] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000
+  };
+  static constexpr uint64_t kBucketBoundsCount[kBuckets] = {
+    1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 256
+  };
   
-  // Step 2: Read the JSON payload of the specified length
-  string json_str;
-  json_str.resize(message_length);
-  total_read = 0;
+  static bool is_latency(Histogram histogram) {
+    return histogram != BATCH_SIZE;
+  }
   
-  while (total_read < message_length) {
-    if (!ReadFile(hStdoutRead, &json_str[total_read], message_length - total_read, &bytes_read, NULL) || bytes_read == 0) {
-      cerr << "ERROR: Stream ended after " << total_read << " bytes (expected " << message_length << ")" << endl;
-      TerminateProcess(pi.hProcess, 1);
-      CloseHandle(pi.hProcess);
-      CloseHandle(pi.hThread);
-      CloseHandle(hStdoutRead);
-      return "";
-    }
-    total_read += bytes_read;
+  static const uint64_t* bucket_bounds(int histogram) {
+    return is_latency((Histogram)histogram) ? kBucketBoundsUs : kBucketBoundsCount;
   }
   
-  cerr << "[DEBUG] Successfully read " << total_read << " bytes of JSON" << endl;
-  cerr << "[DEBUG] JSON preview: " << json_str.substr(0, min((size_t)100, json_str.length())) << "..." << endl;
+  void record(Histogram histogram, uint64_t bucket_value, uint64_t sum_value) {
+    const uint64_t* bounds = bucket_bounds(histogram);
+    size_t bucket = 0;
+    while (bucket < kBuckets && bucket_value > bounds[bucket]) bucket++;
+    Slot& s = slot();
+    s.buckets[histogram][bucket].fetch_add(1, memory_order_relaxed);
+    s.sums[histogram].fetch_add(sum_value, memory_order_relaxed);
+  }
   
-  TerminateProcess(pi.hProcess, 1);
-  CloseHandle(pi.hProcess);
-  CloseHandle(pi.hThread);
-  CloseHandle(hStdoutRead);
+  Slot slots[kSlots];
+  atomic<size_t> next_slot{0};
+  mutex gauge_mutex;
+  function<size_t()> queue_depth_source;
+  function<void(ostream&)> server_source;
   
-  return json_str;
+  // Threads are assigned slots round-robin on first use; beyond kSlots threads they share
+  Slot& slot() {
+    thread_local size_t index = next_slot.fetch_add(1, memory_order_relaxed) % kSlots;
+    return slots[index];
+  }
+};
+
+constexpr uint64_t Metrics::kBucketBoundsUs[];
+constexpr uint64_t Metrics::kBucketBoundsCount[];
+
+Metrics& metrics() {
+  static Metrics instance;
+  return instance;
+}
+
+// Records the lifetime of a scope into a Metrics histogram
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Metrics::Histogram histogram)
+    : histogram(histogram), start(chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    metrics().observe(histogram, chrono::steady_clock::now() - start);
+  }
   
-#else
-  // Unix/Linux/macOS implementation
-  FILE* pipe = popen(binary_path.c_str(), "r");
-  if (!pipe) {
-    cerr << "ERROR: Failed to execute binary" << endl;
-    return "";
+private:
+  Metrics::Histogram histogram;
+  chrono::steady_clock::time_point start;
+};
+
+// Level-gated asynchronous log
+// Lines below the configured level are skipped before any formatting happens. Lines that
+// pass are formatted by the caller and handed to a background thread that writes stderr, so
+// per-call logging never blocks a worker on console I/O. Warnings go through LOG(LOG_WARN)
+// too, since some (overload, expired calls) come per call; the queue is drained at exit.
+// Errors stay on synchronous cerr, where they are seen immediately even if the process is
+// about to crash.
+enum LogLevel { LOG_ERROR = 0, LOG_WARN, LOG_INFO, LOG_DEBUG };
+
+class AsyncLog {
+public:
+  static AsyncLog& instance() {
+    static AsyncLog log;
+    return log;
   }
   
-  // Step 1: Read the 4-byte length prefix (little-endian uint32)
-  uint8_t length_bytes[4];
-  if (fread(length_bytes, 1, 4, pipe) != 4) {
-    cerr << "ERROR: Failed to read 4-byte length prefix" << endl;
-    pclose(pipe);
-    return "";
+  ~AsyncLog() {
+    flush_and_stop();
   }
   
-  // Convert little-endian bytes to uint32
-  uint32_t message_length = length_bytes[0] | (length_bytes[1] << 8) | (length_bytes[2] << 16) | (length_bytes[3] << 24);
-  cerr << "[DEBUG] Message length from native binary: " << message_length << " bytes" << endl;
+  static void set_level(LogLevel level) {
+    current_level().store(level, memory_order_relaxed);
+  }
   
-  if (message_length <= 0 || message_length > 10000000) {
-    cerr << "ERROR: Invalid message length: " << message_length << endl;
-    pclose(pipe);
-    return "";
+  static bool enabled(LogLevel level) {
+    return level <= current_level().load(memory_order_relaxed);
   }
   
-  // Step 2: Read the JSON payload of the specified length
-  string json_str;
-  json_str.resize(message_length);
-  size_t total_read = fread(&json_str[0], 1, message_length, pipe);
+  void write(string_view line) {
+    {
+      lock_guard<mutex> lock(log_mutex);
+      if (stopped) {
+        cerr << line;
+        return;
+      }
+      if (!writer.joinable()) writer = thread(&AsyncLog::writer_loop, this);
+      pending.append(line.data(), line.size());
+    }
+    log_cv.notify_one();
+  }
   
-  if (total_read != message_length) {
-    cerr << "ERROR: Stream ended after " << total_read << " bytes (expected " << message_length << ")" << endl;
-    pclose(pipe);
-    return "";
+  // Drain everything queued so far and stop the writer (lines logged later go straight to cerr)
+  void flush_and_stop() {
+    {
+      lock_guard<mutex> lock(log_mutex);
+      stopped = true;
+    }
+    log_cv.notify_one();
+    if (writer.joinable()) writer.join();
   }
   
-  cerr << "[DEBUG] Successfully read " << total_read << " bytes of JSON" << endl;
-  cerr << "[DEBUG] JSON preview: " << json_str.substr(0, min((size_t)100, json_str.length())) << "..." << endl;
+private:
+  mutex log_mutex;
+  condition_variable log_cv;
+  string pending;  // Swapped with the writer's buffer, so both keep their capacity
+  thread writer;
+  bool stopped = false;
   
-  pclose(pipe);
+  static atomic<int>& current_level() {
+    static atomic<int> level{LOG_INFO};
+    return level;
+  }
   
-  return json_str;
-#endif
-}
+  void writer_loop() {
+    string batch;
+    unique_lock<mutex> lock(log_mutex);
+    for (;;) {
+      log_cv.wait(lock, [this] { return !pending.empty() || stopped; });
+      batch.swap(pending);
+      bool done = stopped;
+      lock.unlock();
+      cerr.write(batch.data(), (streamsize)batch.size());
+      cerr.flush();
+      batch.clear();
+      lock.lock();
+      if (done && pending.empty()) return;
+    }
+  }
+};
 
-// HTTP POST request (Windows WinHTTP)
-#ifdef _WIN32
-string http_post_winhttp(const string& url, const string& auth_header, const string& body) {
-  wstring wide_url(url.begin(), url.end());
-  
-  URL_COMPONENTS urlComp = { 0 };
-  urlComp.dwStructSize = sizeof(urlComp);
-  wchar_t host[256], path[1024];
-  urlComp.lpszHostName = host;
-  urlComp.dwHostNameLength = sizeof(host) / sizeof(host[0]);
-  urlComp.lpszUrlPath = path;
-  urlComp.dwUrlPathLength = sizeof(path) / sizeof(path[0]);
-  
-  if (!WinHttpCrackUrl(wide_url.c_str(), 0, 0, &urlComp)) {
-    return "";
+// One log line: formatted with << and queued on destruction
+// Formats into a per-thread buffer that keeps its capacity, so logging does not allocate once
+// warmed up. A line built while another is being formatted on the same thread (a logging
+// function called inside a << chain) gets its own buffer.
+class LogLine {
+public:
+  LogLine() : buffer(acquire_buffer()), stream(&buffer) {}
+  ~LogLine() {
+    buffer.line.push_back('\n');
+    AsyncLog::instance().write(buffer.line);
+    release_buffer();
+  }
+  template <typename T>
+  LogLine& operator<<(const T& value) {
+    stream << value;
+    return *this;
   }
   
-  HINTERNET hSession = WinHttpOpen(L"MCP Client/1.0",
-                                   WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                                   WINHTTP_NO_PROXY_NAME,
-                                   WINHTTP_NO_PROXY_BYPASS, 0);
-  if (!hSession) return "";
+private:
+  struct LineBuffer : streambuf {
+    string line;
+    int_type overflow(int_type c) override {
+      if (c != traits_type::eof()) line.push_back((char)c);
+      return c;
+    }
+    streamsize xsputn(const char* s, streamsize n) override {
+      line.append(s, (size_t)n);
+      return n;
+    }
+  };
   
-  HINTERNET hConnect = WinHttpConnect(hSession, host, urlComp.nPort, 0);
-  if (!hConnect) {
-    WinHttpCloseHandle(hSession);
-    return "";
+  unique_ptr<LineBuffer> nested;  // Declared first: acquire_buffer() may set it
+  LineBuffer& buffer;
+  ostream stream;
+  
+  static thread_local LineBuffer t_buffer;
+  static thread_local bool t_buffer_busy;
+  
+  LineBuffer& acquire_buffer() {
+    if (t_buffer_busy) {
+      nested.reset(new LineBuffer());
+      return *nested;
+    }
+    t_buffer_busy = true;
+    t_buffer.line.clear();
+    return t_buffer;
   }
   
-  DWORD flags = WINHTTP_FLAG_SECURE;
-  if (urlComp.nScheme == INTERNET_SCHEME_HTTPS) {
-    flags |= WINHTTP_FLAG_SECURE;
+  void release_buffer() {
+    if (!nested) t_buffer_busy = false;
   }
+};
+
+thread_local LogLine::LineBuffer LogLine::t_buffer;
+thread_local bool LogLine::t_buffer_busy = false;
+
+// LOG(LOG_DEBUG) << "..." - the arguments are not evaluated when the level is disabled
+#define LOG(level) if (!AsyncLog::enabled(level)) {} else LogLine()
+
+// Append-only JSON writer over a caller-owned byte buffer
+// Reusing the buffer (see thread_send_buffer) means steady-state serialization never allocates.
+// String escaping copies runs of safe bytes in bulk, finding the next byte that needs escaping
+// 16 at a time with SSE2, and escapes every control character below 0x20 as required by JSON.
+// The buffer may be a std::string or a pmr::string living in a per-call arena.
+template <typename String>
+class BasicJsonWriter {
+public:
+  explicit BasicJsonWriter(String& out) : out(out) {}
   
-  HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"POST", path, NULL,
-                                          WINHTTP_NO_REFERER,
-                                          WINHTTP_DEFAULT_ACCEPT_TYPES,
-                                          flags);
-  if (!hRequest) {
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return "";
+  BasicJsonWriter& raw(string_view s) {
+    out.append(s.data(), s.size());
+    return *this;
   }
   
-  // Ignore SSL certificate errors
-  DWORD security_flags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
-                         SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
-                         SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
-                         SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE;
-  WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &security_flags, sizeof(security_flags));
+  BasicJsonWriter& raw(char c) {
+    out.push_back(c);
+    return *this;
+  }
   
-  wstring wide_auth(auth_header.begin(), auth_header.end());
-  WinHttpAddRequestHeaders(hRequest, wide_auth.c_str(), -1, WINHTTP_ADDREQ_FLAG_ADD);
-  WinHttpAddRequestHeaders(hRequest, L"Content-Type: application/json", -1, WINHTTP_ADDREQ_FLAG_ADD);
+  // Quoted, escaped JSON string
+  BasicJsonWriter& str(string_view s) {
+    out.push_back('"');
+    append_escaped(out, s);
+    out.push_back('"');
+    return *this;
+  }
   
-  BOOL result = WinHttpSendRequest(hRequest,
-                                   WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                                   (LPVOID)body.c_str(), body.length(),
-                                   body.length(), 0);
+  BasicJsonWriter& number(long long value) {
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%lld", value);
+    out.append(digits, (size_t)n);
+    return *this;
+  }
   
-  if (!result || !WinHttpReceiveResponse(hRequest, NULL)) {
-    WinHttpCloseHandle(hRequest);
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return "";
+  BasicJsonWriter& decimal(double value, int precision = 3) {
+    char digits[48];
+    int n = snprintf(digits, sizeof(digits), "%.*f", precision, value);
+    out.append(digits, (size_t)n);
+    return *this;
   }
   
-  DWORD status_code = 0;
-  DWORD size = sizeof(status_code);
-  WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                     NULL, &status_code, &size, NULL);
+  BasicJsonWriter& boolean(bool value) {
+    return raw(value ? string_view("true") : string_view("false"));
+  }
   
-  WinHttpCloseHandle(hRequest);
-  WinHttpCloseHandle(hConnect);
-  WinHttpCloseHandle(hSession);
+  String& buffer() { return out; }
   
-  return (status_code == 202) ? "OK" : "";
-}
-#endif
-
-// HTTP POST request (Unix libcurl)
-#ifndef _WIN32
-size_t curl_write_callback(void* contents, size_t size, size_t nmemb, string* output) {
-  size_t total_size = size * nmemb;
-  output->append((char*)contents, total_size);
-  return total_size;
-}
-
-string http_post_curl(const string& url, const string& auth_header, const string& body) {
-  CURL* curl = curl_easy_init();
-  if (!curl) return "";
+  // Size of s once escaped (without the surrounding quotes)
+  static size_t escaped_length(string_view s) {
+    const char* p = s.data();
+    const char* end = p + s.size();
+    size_t length = s.size();
+    char seq[6];
+    while ((p = find_escape(p, end)) < end) length += escape_sequence((unsigned char)*p++, seq) - 1;
+    return length;
+  }
   
-  string response;
-  struct curl_slist* headers = NULL;
-  headers = curl_slist_append(headers, auth_header.c_str());
-  headers = curl_slist_append(headers, "Content-Type: application/json");
+  static void append_escaped(String& out, string_view s) {
+    const char* p = s.data();
+    const char* end = p + s.size();
+    while (p < end) {
+      const char* run = p;
+      p = find_escape(p, end);
+      if (p > run) out.append(run, (size_t)(p - run));
+      if (p >= end) break;
+      append_escape_sequence(out, (unsigned char)*p++);
+    }
+  }
   
-  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-  
-  CURLcode res = curl_easy_perform(curl);
+  // First byte in [p, end) that cannot appear unescaped inside a JSON string
+  static const char* find_escape(const char* p, const char* end) {
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+    while (end - p >= 16) {
+      __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i is_control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max);  // unsigned <= 0x1F
+      __m128i special = _mm_or_si128(is_control, _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+      int mask = _mm_movemask_epi8(special);
+      if (mask) {
+#ifdef _MSC_VER
+        unsigned long idx;
+        _BitScanForward(&idx, (unsigned long)mask);
+        return p + idx;
+#else
+        return p + __builtin_ctz((unsigned)mask);
+#endif
+      }
+      p += 16;
+    }
+#endif
+    while (p < end) {
+      unsigned char c = (unsigned char)*p;
+      if (c < 0x20 || c == '"' || c == '\\') return p;
+      p++;
+    }
+    return end;
+  }
   
-  long response_code = 0;
-  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+  // Writes the escape sequence for c into seq; returns its length (2 or 6)
+  static size_t escape_sequence(unsigned char c, char* seq) {
+    seq[0] = '\\';
+    switch (c) {
+      case '"': seq[1] = '"'; return 2;
+      case '\\': seq[1] = '\\'; return 2;
+      case '\n': seq[1] = 'n'; return 2;
+      case '\r': seq[1] = 'r'; return 2;
+      case '\t': seq[1] = 't'; return 2;
+      case '\b': seq[1] = 'b'; return 2;
+      case '\f': seq[1] = 'f'; return 2;
+      default: {
+        static const char hex[] = "0123456789abcdef";
+        seq[1] = 'u';
+        seq[2] = '0';
+        seq[3] = '0';
+        seq[4] = hex[c >> 4];
+        seq[5] = hex[c & 0xF];
+        return 6;
+      }
+    }
+  }
   
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
+private:
+  String& out;
   
-  return (res == CURLE_OK && response_code == 202) ? "OK" : "";
+  static void append_escape_sequence(String& out, unsigned char c) {
+    char seq[6];
+    out.append(seq, escape_sequence(c, seq));
+  }
+};
+
+using JsonWriter = BasicJsonWriter<string>;
+using ArenaJsonWriter = BasicJsonWriter<pmr::string>;
+
+// Per-thread request body buffer; its capacity survives between requests, so building a
+// body and handing it to the HTTP layer does not touch the heap once warmed up
+string& thread_send_buffer() {
+  thread_local string buffer;
+  buffer.clear();
+  return buffer;
 }
-#endif
 
-// Send HTTP POST
-string http_post(const string& url, const string& auth_header, const string& body) {
-#ifdef _WIN32
-  return http_post_winhttp(url, auth_header, body);
-#else
-  return http_post_curl(url, auth_header, body);
-#endif
+// Simple JSON string escaper (returns the escaped contents without surrounding quotes)
+string json_escape(const string& str) {
+  string escaped;
+  escaped.reserve(str.size() + 8);
+  JsonWriter::append_escaped(escaped, str);
+  return escaped;
 }
 
-// Generate UUID-like string
-string generate_uuid() {
-  ostringstream oss;
-  oss << hex;
-  for (int i = 0; i < 32; i++) {
-    oss << (rand() % 16);
-    if (i == 7 || i == 11 || i == 15 || i == 19) oss << "-";
+// Standard base64 (RFC 4648, with padding)
+inline size_t base64_encoded_length(size_t n) {
+  return (n + 2) / 3 * 4;
+}
+
+// Encode n bytes; out needs base64_encoded_length(n) bytes. Pads only the final partial group,
+// so a long input can be encoded piecewise as long as every piece but the last is a multiple of 3.
+// With SSSE3, 12 input bytes become 16 characters per step (shuffle + multiply-shift to split
+// the 6-bit fields, then one pshufb table lookup for the ASCII offsets).
+size_t base64_encode(const uint8_t* in, size_t n, char* out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  char* start = out;
+  size_t i = 0;
+#if defined(__SSSE3__) || defined(__AVX__)
+  const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+  for (; i + 16 <= n; i += 12, out += 16) {  // Loads 16, consumes 12
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), spread);
+    __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(hi, lo);
+    __m128i lut_index = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    lut_index = _mm_or_si128(lut_index, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_add_epi8(_mm_shuffle_epi8(shift_lut, lut_index), indices));
+  }
+#endif
+  for (; i + 3 <= n; i += 3, out += 4) {
+    uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+    out[0] = alphabet[v >> 18];
+    out[1] = alphabet[(v >> 12) & 63];
+    out[2] = alphabet[(v >> 6) & 63];
+    out[3] = alphabet[v & 63];
   }
-  return oss.str();
+  if (i < n) {
+    uint32_t v = (uint32_t)in[i] << 16 | (i + 1 < n ? (uint32_t)in[i + 1] << 8 : 0);
+    out[0] = alphabet[v >> 18];
+    out[1] = alphabet[(v >> 12) & 63];
+    out[2] = i + 1 < n ? alphabet[(v >> 6) & 63] : '=';
+    out[3] = '=';
+    out += 4;
+  }
+  return (size_t)(out - start);
 }
 
-// SSE Connection class
-class SSEConnection {
+// A tools/reply whose body is generated while it is being sent
+// Content items only reference the caller's data: text is escaped and binary data is
+// base64-encoded chunk by chunk straight into the HTTP layer's upload buffer, so a multi-MB
+// screenshot is never copied into a JSON string first. The exact Content-Length is known up
+// front, so the POST is not chunk-encoded. Referenced data must stay valid until the reply is
+// sent (SSEConnection::send_tool_reply blocks until then).
+//
+//   StreamingReply reply(call.call_id);
+//   reply.text("Here is the viewport:").image(png.data(), png.size(), "image/png");
+//   conn.send_tool_reply(reply);
+class StreamingReply {
 public:
-  string server_url;
-  string auth_header;
-  string session_id;
-  string message_endpoint;
-  queue<string> reverse_queue;
-  mutex queue_mutex;
-  condition_variable queue_cv;
+  // Fills at most cap bytes of buf with the next part of a binary item; 0 means no more data
+  using Source = function<size_t(uint8_t* buf, size_t cap)>;
   
-  bool connect() {
-    // For simplicity, we'll use a minimal SSE implementation
-    // In production, you'd want a full SSE client library
-    cerr << "[INFO] SSE connection setup (simplified for demo)" << endl;
-    
-    // Extract base URL
-    size_t sse_pos = server_url.find("/sse");
-    if (sse_pos != string::npos) {
-      message_endpoint = "/message";
-      session_id = "cpp-session-" + generate_uuid();
-      return true;
-    }
-    
-    return false;
+  explicit StreamingReply(string_view call_id) {
+    string prefix;
+    JsonWriter(prefix).raw("{\"jsonrpc\":\"2.0\",\"id\":").str(call_id)
+                      .raw(",\"method\":\"tools/reply\",\"params\":{\"result\":{\"content\":[");
+    add_literal(move(prefix));
   }
   
-  string send_request(const string& method, const string& params_json) {
-    string request_id = generate_uuid();
-    ostringstream body;
-    body << "{\"jsonrpc\":\"2.0\",\"id\":\"" << request_id 
-         << "\",\"method\":\"" << method 
-         << "\",\"params\":" << params_json << "}";
-    
-    string full_url = server_url;
-    size_t sse_pos = full_url.find("/sse");
-    if (sse_pos != string::npos) {
-      full_url = full_url.substr(0, sse_pos) + message_endpoint;
-    }
-    
-    string result = http_post(full_url, "Authorization: " + auth_header, body.str());
-    return result;
+  StreamingReply& text(string_view s) {
+    add_literal(item_separator() + "{\"type\":\"text\",\"text\":\"");
+    Piece piece;
+    piece.kind = Piece::Escaped;
+    piece.text = s;
+    piece.length = JsonWriter::escaped_length(s);
+    add(move(piece));
+    add_literal("\"}");
+    return *this;
   }
   
-  void send_tool_reply(const string& call_id, const string& result_json) {
-    ostringstream body;
-    body << "{\"jsonrpc\":\"2.0\",\"id\":\"" << call_id 
-         << "\",\"method\":\"tools/reply\",\"params\":{\"result\":" << result_json << "}}";
-    
-    string full_url = server_url;
-    size_t sse_pos = full_url.find("/sse");
-    if (sse_pos != string::npos) {
-      full_url = full_url.substr(0, sse_pos) + message_endpoint;
+  // Binary data already in memory
+  StreamingReply& image(const void* data, size_t size, string_view mime_type) {
+    return binary("image", mime_type, size, static_cast<const uint8_t*>(data), nullptr);
+  }
+  
+  // Binary data produced on demand (e.g. read from a file or rendered in strips); exactly
+  // size bytes must come out of read. Only one chunk of it is held in memory at a time.
+  StreamingReply& image(size_t size, Source read, string_view mime_type) {
+    return binary("image", mime_type, size, nullptr, move(read));
+  }
+  
+  StreamingReply& error(bool is_error) {
+    this->is_error = is_error;
+    return *this;
+  }
+  
+  // Exact body size; closes the content list, so add nothing afterwards
+  size_t content_length() {
+    finish();
+    return total;
+  }
+  
+  // Next bytes of the body; 0 once everything was produced (or a source came up short)
+  size_t read(char* out, size_t cap) {
+    finish();
+    size_t written = 0;
+    while (written < cap) {
+      if (spill_pos < spill_len) {
+        size_t n = min(cap - written, spill_len - spill_pos);
+        memcpy(out + written, spill + spill_pos, n);
+        spill_pos += n;
+        written += n;
+        continue;
+      }
+      if (current >= pieces.size() || source_failed) break;
+      Piece& piece = pieces[current];
+      size_t n = read_piece(piece, out + written, cap - written);
+      written += n;
+      if (piece.done) {
+        current++;
+      } else if (n == 0 && !source_failed) {
+        // Less room left than the next escape sequence or base64 group needs: produce it
+        // into the spill buffer and hand it out in pieces
+        spill_len = read_piece(piece, spill, sizeof(spill));
+        spill_pos = 0;
+        if (piece.done) current++;
+        if (spill_len == 0) break;
+      }
     }
-    
-    string result = http_post(full_url, "Authorization: " + auth_header, body.str());
-    if (!result.empty()) {
-      cerr << "[OK] Sent tools/reply for call_id " << call_id << endl;
+    sent += written;
+    return written;
+  }
+  
+  // True if a source delivered fewer bytes than it promised; the POST was aborted
+  bool failed() const {
+    return source_failed;
+  }
+  
+  // How many body bytes have been produced so far
+  size_t bytes_sent() const {
+    return sent;
+  }
+  
+private:
+  static constexpr size_t kSourceChunk = 48 * 1024;  // Multiple of 3, so chunks encode without padding
+  
+  struct Piece {
+    enum Kind { Literal, Escaped, Base64 } kind = Literal;
+    string literal;
+    string_view text;
+    const uint8_t* data = nullptr;   // Base64 input: caller's memory, or staging when read from source
+    size_t size = 0;                 // Base64: total input bytes
+    Source source;
+    vector<uint8_t> staging;
+    size_t avail = 0;                // Bytes of data[] currently usable
+    size_t consumed = 0;             // Bytes of data[] / text / literal already emitted
+    size_t delivered = 0;            // Source bytes read so far
+    size_t length = 0;               // Encoded length
+    bool done = false;
+  };
+  
+  vector<Piece> pieces;
+  size_t current = 0;
+  size_t total = 0;
+  size_t sent = 0;
+  size_t items = 0;
+  bool is_error = false;
+  bool finished = false;
+  bool source_failed = false;
+  char spill[16];
+  size_t spill_len = 0, spill_pos = 0;
+  
+  size_t read_piece(Piece& piece, char* out, size_t cap) {
+    switch (piece.kind) {
+      case Piece::Literal: return read_literal(piece, out, cap);
+      case Piece::Escaped: return read_escaped(piece, out, cap);
+      case Piece::Base64: return read_base64(piece, out, cap);
     }
+    return 0;
   }
   
-  // Call another MCP tool on the server
-  // This demonstrates how to call other MCP tools from within your remote tool handler
-  string call_mcp_tool(const string& tool_name, const string& arguments_json) {
-    ostringstream params;
-    params << "{\"name\":\"" << json_escape(tool_name) << "\",\"arguments\":" << arguments_json << "}";
-    
-    string request_id = generate_uuid();
-    ostringstream body;
-    body << "{\"jsonrpc\":\"2.0\",\"id\":\"" << request_id 
-         << "\",\"method\":\"tools/call\",\"params\":" << params.str() << "}";
-    
-    string full_url = server_url;
-    size_t sse_pos = full_url.find("/sse");
-    if (sse_pos != string::npos) {
-      full_url = full_url.substr(0, sse_pos) + message_endpoint;
+  string item_separator() {
+    return items++ ? "," : "";
+  }
+  
+  void add(Piece piece) {
+    total += piece.length;
+    piece.done = piece.length == 0;
+    pieces.push_back(move(piece));
+  }
+  
+  void add_literal(string s) {
+    Piece piece;
+    piece.length = s.size();
+    piece.literal = move(s);
+    add(move(piece));
+  }
+  
+  StreamingReply& binary(string_view type, string_view mime_type, size_t size, const uint8_t* data, Source source) {
+    string head = item_separator();
+    JsonWriter(head).raw("{\"type\":").str(type).raw(",\"mimeType\":").str(mime_type).raw(",\"data\":\"");
+    add_literal(move(head));
+    Piece piece;
+    piece.kind = Piece::Base64;
+    piece.size = size;
+    piece.length = base64_encoded_length(size);
+    if (data) {
+      piece.data = data;
+      piece.avail = size;
+    } else {
+      piece.source = move(source);
+      piece.staging.resize(min(size, kSourceChunk));
+      piece.data = piece.staging.data();
     }
-    
-    string result = http_post(full_url, "Authorization: " + auth_header, body.str());
-    
-    // For demo purposes, we return "OK" if POST succeeded
-    // In production, you'd wait for the actual response via SSE
-    return result;
+    add(move(piece));
+    add_literal("\"}");
+    return *this;
   }
-};
-
-// Handle echo request
-// This demonstrates TWO capabilities:
-// 1. Basic echo functionality - echoes back the message
-// 2. Calling OTHER MCP tools - demonstrates how to call sqlite, browser, etc.
-string handleEchoRequest(const string& message, SSEConnection* conn = nullptr) {
-  cerr << "[ECHO] Received echo request: " << message << endl;
   
-  // Basic echo response
-  string response_text = "Echo: " + message;
+  void finish() {
+    if (finished) return;
+    finished = true;
+    add_literal(is_error ? "],\"isError\":true}}}" : "],\"isError\":false}}}");
+  }
   
-  // DEMONSTRATION: If we have connection info, show how to call other tools
-  if (conn != nullptr) {
-    // Convert message to lowercase for keyword detection
-    string message_lower = message;
-    transform(message_lower.begin(), message_lower.end(), message_lower.begin(), ::tolower);
-    
-    // Demo 1: List databases (triggered by keyword "databases" or "db")
-    // Check this FIRST because it's more specific and helps users discover what databases exist
-    if (message_lower.find("databases") != string::npos || message_lower.find("list db") != string::npos) {
-      cerr << "[DEMO] Calling sqlite tool to list databases..." << endl;
-      
-      // Call the sqlite tool to list databases
-      string sqlite_args = R"({"input":{"sql":".databases","tool_unlock_token":"29e63eb5"}})";
-      string sqlite_result = conn->call_mcp_tool("sqlite", sqlite_args);
-      
-      // Append the result to our response
-      if (!sqlite_result.empty()) {
-        response_text += "\n\n[DEMO] Called sqlite tool successfully!\n";
-        response_text += "Result: " + sqlite_result;
-      } else {
-        response_text += "\n\n[DEMO] SQLite tool call failed or returned no result";
-      }
+  static size_t read_literal(Piece& piece, char* out, size_t cap) {
+    size_t n = min(cap, piece.literal.size() - piece.consumed);
+    memcpy(out, piece.literal.data() + piece.consumed, n);
+    piece.consumed += n;
+    piece.done = piece.consumed == piece.literal.size();
+    return n;
+  }
+  
+  static size_t read_escaped(Piece& piece, char* out, size_t cap) {
+    const char* p = piece.text.data() + piece.consumed;
+    const char* end = piece.text.data() + piece.text.size();
+    char* o = out;
+    char* o_end = out + cap;
+    while (p < end && o < o_end) {
+      const char* limit = p + min((size_t)(end - p), (size_t)(o_end - o));
+      const char* stop = JsonWriter::find_escape(p, limit);
+      memcpy(o, p, (size_t)(stop - p));
+      o += stop - p;
+      p = stop;
+      if (p == limit) continue;
+      char seq[6];
+      size_t len = JsonWriter::escape_sequence((unsigned char)*p, seq);
+      if ((size_t)(o_end - o) < len) break;
+      memcpy(o, seq, len);
+      o += len;
+      p++;
     }
-    // Demo 2: List tables (triggered by keywords "tables" - check AFTER databases to avoid conflicts)
-    else if (message_lower.find("tables") != string::npos) {
-      cerr << "[DEMO] Calling sqlite tool to list tables..." << endl;
-      
-      // Extract database name if specified (e.g., "list tables in test.db")
-      string database = ":memory:";
-      size_t in_pos = message_lower.find(" in ");
-      if (in_pos != string::npos) {
-        database = message.substr(in_pos + 4);
-        // Trim whitespace
-        size_t start = database.find_first_not_of(" \t\n\r");
-        size_t end = database.find_last_not_of(" \t\n\r");
-        if (start != string::npos && end != string::npos) {
-          database = database.substr(start, end - start + 1);
+    piece.consumed = (size_t)(p - piece.text.data());
+    piece.done = p == end;
+    return (size_t)(o - out);
+  }
+  
+  size_t read_base64(Piece& piece, char* out, size_t cap) {
+    size_t written = 0;
+    while (cap - written >= 4) {
+      size_t ready = piece.avail - piece.consumed;
+      bool last = piece.delivered + (piece.source ? 0 : piece.size) >= piece.size;
+      if (ready < 3 && !last) {
+        // Refill staging from the source, keeping the 0-2 bytes of an incomplete group
+        memmove(piece.staging.data(), piece.staging.data() + piece.consumed, ready);
+        size_t want = min(piece.staging.size(), piece.size - piece.delivered + ready) - ready;
+        size_t got = piece.source(piece.staging.data() + ready, want);
+        if (got == 0) {
+          source_failed = true;
+          break;
         }
+        piece.delivered += min(got, want);
+        piece.avail = ready + min(got, want);
+        piece.consumed = 0;
+        continue;
       }
-      
-      // Call the sqlite tool to list tables
-      ostringstream sqlite_args;
-      sqlite_args << "{\"input\":{\"sql\":\".tables\",\"database\":\"" 
-                  << json_escape(database) 
-                  << "\",\"tool_unlock_token\":\"29e63eb5\"}}";
-      string sqlite_result = conn->call_mcp_tool("sqlite", sqlite_args.str());
-      
-      // Append the result to our response
-      if (!sqlite_result.empty()) {
-        response_text += "\n\n[DEMO] Called sqlite tool successfully!\n";
-        response_text += "Database: " + database + "\n";
-        response_text += "Result: " + sqlite_result;
-      } else {
-        response_text += "\n\n[DEMO] SQLite tool call failed or returned no result";
+      if (ready == 0) {
+        piece.done = true;
+        break;
       }
+      // Whole groups only, except for the very end of the data
+      size_t groups = min((cap - written) / 4, ready / 3);
+      size_t take = groups * 3;
+      if (last && groups == ready / 3 && ready % 3 && (cap - written) / 4 > groups) take = ready;
+      if (take == 0) break;
+      written += base64_encode(piece.data + piece.consumed, take, out + written);
+      piece.consumed += take;
     }
+    if (piece.consumed == piece.avail && piece.delivered + (piece.source ? 0 : piece.size) >= piece.size) {
+      piece.done = true;
+    }
+    return written;
   }
+};
+
+// Minimal on-demand JSON reader
+// Works directly over the original text: values are returned as string_view slices of the
+// input and nothing is allocated unless a string containing escapes has to be decoded.
+// Only the parts of a document that lead to a requested key are descended into; everything
+// else is skipped structurally (string contents are skipped 16 bytes at a time with SSE2).
+struct JsonValue {
+  enum Type { Missing, Null, Bool, Number, String, Object, Array };
+  Type type = Missing;
+  string_view raw;  // Exact source text; for strings, the contents between the quotes
+  bool has_escapes = false;
   
-  // Build JSON result
-  ostringstream result;
-  result << "{\"content\":[{\"type\":\"text\",\"text\":\"" 
-         << json_escape(response_text) 
-         << "\"}],\"isError\":false}";
+  bool found() const { return type != Missing; }
+  bool is_string() const { return type == String; }
+  bool is_object() const { return type == Object; }
   
-  return result.str();
+  // String contents; points into the source unless escapes had to be decoded into scratch
+  string_view as_string(string& scratch) const;
+  string to_string() const {
+    string s;
+    return string(as_string(s));
+  }
 };
 
-// Main worker function
-int main_worker(bool background) {
-  cerr << "=== Aura Friday Remote Tool Provider Demo ===" << endl;
-  cerr << "PID: " << getpid() << endl;
-  cerr << "Registering demo_tool_cpp with MCP server" << endl << endl;
+class JsonReader {
+public:
+  static const size_t kMaxDepth = 8;
   
-  // Connection state for reconnection logic
-  int retry_count = 0;
-  int max_retry_delay = 60; // Max 1 minute between retries
-  
-  // Outer reconnection loop - keeps trying forever
-  while (true) {
-    try {
-      // Calculate retry delay with exponential backoff
-      if (retry_count > 0) {
-        int delay = min(1 << retry_count, max_retry_delay); // 2^retry_count
-        cerr << endl << "[RECONNECT] Waiting " << delay << " seconds before retry (attempt #" << retry_count << ")..." << endl;
-        this_thread::sleep_for(chrono::seconds(delay));
-        
-        // Check for Ctrl+C during sleep
-        if (!g_running) {
-          cerr << endl << endl << string(60, '=') << endl;
-          cerr << "Shutting down..." << endl;
-          cerr << string(60, '=') << endl;
-          return 0;
-        }
-        
-        cerr << "[RECONNECT] Attempting to reconnect..." << endl << endl;
-      }
-      
-      // Step 1: Find manifest
-      cerr << "Step 1: Finding native messaging manifest..." << endl;
-      string manifest_path = find_native_messaging_manifest();
-      if (manifest_path.empty()) {
-        cerr << "ERROR: Could not find manifest" << endl;
-        retry_count++;
-        continue;
+  // One lookup for extract(): dotted path such as "reverse.input.params"
+  struct Field {
+    string_view segments[kMaxDepth];
+    size_t segment_count = 0;
+    JsonValue value;
+    
+    explicit Field(string_view path = string_view()) {
+      while (!path.empty() && segment_count < kMaxDepth) {
+        size_t dot = path.find('.');
+        segments[segment_count++] = path.substr(0, dot);
+        if (dot == string_view::npos) break;
+        path.remove_prefix(dot + 1);
       }
-      cerr << "[OK] Found manifest: " << manifest_path << endl << endl;
-      
-      // Step 2: Read manifest
-      cerr << "Step 2: Reading manifest..." << endl;
-      string manifest_content = read_file(manifest_path);
-      if (manifest_content.empty()) {
-        cerr << "ERROR: Could not read manifest" << endl;
-        retry_count++;
+    }
+  };
+  
+  // Resolve up to 32 paths in a single pass over the document
+  static bool extract(string_view doc, Field* fields, size_t count) {
+    if (count == 0 || count > 32) return false;
+    const char* p = doc.data();
+    const char* end = p + doc.size();
+    skip_ws(p, end);
+    uint32_t all = (count == 32) ? 0xFFFFFFFFu : ((1u << count) - 1);
+    uint32_t remaining = all;
+    if (p >= end || *p != '{') return false;
+    return walk_object(p, end, 0, all, fields, remaining);
+  }
+  
+  // Look up a single dotted path
+  static JsonValue get(string_view doc, string_view path) {
+    Field f(path);
+    extract(doc, &f, 1);
+    return f.value;
+  }
+  
+  // First value stored under key at any depth, in document order
+  static JsonValue find_key(string_view doc, string_view key) {
+    const char* p = doc.data();
+    const char* end = p + doc.size();
+    JsonValue out;
+    skip_ws(p, end);
+    search_value(p, end, key, out, 0);
+    return out;
+  }
+  
+  // Call fn(JsonValue) for each element of a JSON array (raw array text, brackets included)
+  template <typename Fn>
+  static bool for_each_element(string_view array, Fn&& fn) {
+    const char* p = array.data();
+    const char* end = p + array.size();
+    skip_ws(p, end);
+    if (p >= end || *p != '[') return false;
+    p++;
+    for (;;) {
+      skip_ws(p, end);
+      if (p >= end) return false;
+      if (*p == ']') return true;
+      if (*p == ',') {
+        p++;
         continue;
       }
-      string binary_path = extract_json_string(manifest_content, "path");
-      if (binary_path.empty()) {
-        cerr << "ERROR: No path in manifest" << endl;
-        retry_count++;
+      JsonValue element;
+      if (!parse_value(p, end, element)) return false;
+      fn(element);
+    }
+  }
+  
+  // Call fn(key, value) for each member of a JSON object (raw object text, braces included)
+  // key is a String JsonValue, so its escapes can be decoded with as_string()
+  template <typename Fn>
+  static bool for_each_member(string_view object, Fn&& fn) {
+    const char* p = object.data();
+    const char* end = p + object.size();
+    skip_ws(p, end);
+    if (p >= end || *p != '{') return false;
+    p++;
+    for (;;) {
+      skip_ws(p, end);
+      if (p >= end) return false;
+      if (*p == '}') return true;
+      if (*p == ',') {
+        p++;
         continue;
       }
-      cerr << "[OK] Manifest loaded" << endl << endl;
-      
-      // Step 3: Discover endpoint
-      cerr << "Step 3: Discovering MCP server endpoint..." << endl;
-      string config = discover_mcp_server_endpoint(binary_path);
-      if (config.empty()) {
-        cerr << "ERROR: Could not get configuration from native binary" << endl;
-        cerr << "Is the Aura Friday MCP server running?" << endl;
-        retry_count++;
-        continue;
+      JsonValue key, value;
+      if (!parse_value(p, end, key) || !key.is_string()) return false;
+      skip_ws(p, end);
+      if (p >= end || *p != ':') return false;
+      p++;
+      if (!parse_value(p, end, value)) return false;
+      fn(key, value);
+    }
+  }
+  
+  // Parse one value at p and advance past it
+  static bool parse_value(const char*& p, const char* end, JsonValue& out) {
+    skip_ws(p, end);
+    if (p >= end) return false;
+    const char* start = p;
+    switch (*p) {
+      case '"': {
+        bool escapes = false;
+        if (!skip_string(p, end, escapes)) return false;
+        out.type = JsonValue::String;
+        out.raw = string_view(start + 1, (size_t)(p - start - 2));
+        out.has_escapes = escapes;
+        return true;
       }
-      
-      string server_url = extract_json_string(config, "url");
-      string auth_token = extract_json_string(config, "Authorization");
-      
-      // Debug output to see what we extracted
-      cerr << "[DEBUG] Config length: " << config.length() << " bytes" << endl;
-      cerr << "[DEBUG] Extracted URL: '" << server_url << "'" << endl;
-      cerr << "[DEBUG] Extracted auth token: '" << auth_token << "'" << endl;
-      
-      if (server_url.empty()) {
-        cerr << "ERROR: Could not extract server URL from config" << endl;
-        cerr << "       Config preview: " << config.substr(0, 200) << "..." << endl;
-        retry_count++;
+      case '{':
+      case '[':
+        if (!skip_container(p, end)) return false;
+        out.type = (*start == '{') ? JsonValue::Object : JsonValue::Array;
+        break;
+      case 't': case 'f':
+        if (!skip_literal(p, end, (*p == 't') ? "true" : "false")) return false;
+        out.type = JsonValue::Bool;
+        break;
+      case 'n':
+        if (!skip_literal(p, end, "null")) return false;
+        out.type = JsonValue::Null;
+        break;
+      default:
+        while (p < end && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) p++;
+        if (p == start) return false;
+        out.type = JsonValue::Number;
+        break;
+    }
+    if (p > end) return false;
+    out.raw = string_view(start, (size_t)(p - start));
+    return true;
+  }
+  
+  // Decode the contents of a JSON string (without quotes) into UTF-8
+  // Works for std::string and pmr::string (e.g. decoding into a per-call arena)
+  template <typename String>
+  static void unescape(string_view in, String& out) {
+    out.clear();
+    out.reserve(in.size());
+    for (size_t i = 0; i < in.size(); i++) {
+      char c = in[i];
+      if (c != '\\' || i + 1 >= in.size()) {
+        out.push_back(c);
         continue;
       }
-      
-      if (auth_token.empty()) {
-        cerr << "ERROR: Could not extract Authorization header from config" << endl;
-        cerr << "       Looking for nested 'Authorization' key in mcpServers.*.headers" << endl;
-        
-        // Try harder to find the auth token in nested structure
-        size_t auth_pos = config.find("\"Authorization\"");
-        if (auth_pos != string::npos) {
-          size_t colon_pos = config.find(":", auth_pos);
-          if (colon_pos != string::npos) {
-            size_t quote1 = config.find("\"", colon_pos);
-            if (quote1 != string::npos) {
-              size_t quote2 = config.find("\"", quote1 + 1);
-              if (quote2 != string::npos) {
-                auth_token = config.substr(quote1 + 1, quote2 - quote1 - 1);
-                cerr << "       Found auth token via fallback: '" << auth_token << "'" << endl;
-              }
+      char e = in[++i];
+      switch (e) {
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'u': {
+          uint32_t cp = 0;
+          if (!read_hex4(in, i + 1, cp)) { out.push_back('?'); break; }
+          i += 4;
+          if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 < in.size() && in[i + 1] == '\\' && in[i + 2] == 'u') {
+            uint32_t low = 0;
+            if (read_hex4(in, i + 3, low) && low >= 0xDC00 && low <= 0xDFFF) {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+              i += 6;
             }
           }
+          append_utf8(out, cp);
+          break;
         }
-        
-        if (auth_token.empty()) {
-          cerr << "       Config preview: " << config.substr(0, 500) << "..." << endl;
-          retry_count++;
-          continue;
+        default: out.push_back(e); break;  // \" \\ \/
+      }
+    }
+  }
+  
+  static void skip_ws(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+  }
+  
+private:
+  // Advance past literal (true/false/null) if the text at p is exactly that
+  static bool skip_literal(const char*& p, const char* end, string_view literal) {
+    if ((size_t)(end - p) < literal.size() || string_view(p, literal.size()) != literal) return false;
+    p += literal.size();
+    return true;
+  }
+  
+  // p is on the opening quote; leaves p just past the closing quote
+  static bool skip_string(const char*& p, const char* end, bool& has_escapes) {
+    p++;
+    for (;;) {
+#if defined(__SSE2__) || defined(_M_X64)
+      const __m128i quote = _mm_set1_epi8('"');
+      const __m128i backslash = _mm_set1_epi8('\\');
+      while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+        if (mask) {
+          p += ctz32((uint32_t)mask);
+          break;
         }
+        p += 16;
       }
-      
-      cerr << "[OK] Found server at: " << server_url << endl << endl;
-      
-      // Step 4: Connect to SSE
-      cerr << "Step 4: Connecting to SSE endpoint..." << endl;
-      SSEConnection conn;
-      conn.server_url = server_url;
-      conn.auth_header = auth_token;
-      
-      if (!conn.connect()) {
-        cerr << "ERROR: Could not connect to SSE" << endl;
-        retry_count++;
+#endif
+      while (p < end && *p != '"' && *p != '\\') p++;
+      if (p >= end) return false;
+      if (*p == '"') {
+        p++;
+        return true;
+      }
+      has_escapes = true;
+      p += 2;  // Skip the escaped character
+      if (p > end) return false;
+    }
+  }
+  
+  // p is on '{' or '['; leaves p just past the matching close bracket
+  static bool skip_container(const char*& p, const char* end) {
+    int depth = 0;
+    while (p < end) {
+      char c = *p;
+      if (c == '"') {
+        bool escapes = false;
+        if (!skip_string(p, end, escapes)) return false;
         continue;
       }
-      cerr << "[OK] Connected! Session ID: " << conn.session_id << endl << endl;
-      
-      // Step 5: Check for remote tool
-      cerr << "Step 5: Checking for remote tool..." << endl;
-      cerr << "[DEBUG] Sending tools/list request..." << endl;
-      string tools_result = conn.send_request("tools/list", "{}");
-      cerr << "[DEBUG] tools/list result: '" << tools_result << "'" << endl;
-      
-      if (tools_result.empty()) {
-        cerr << "ERROR: Could not get tools list (HTTP POST may have failed)" << endl;
-        cerr << "       This is likely due to WinHTTP not working properly" << endl;
-        cerr << "       Continuing anyway to attempt registration..." << endl;
-        // Don't fail here - continue to registration
-      } else {
-        cerr << "[OK] Remote tool found" << endl << endl;
+      if (c == '{' || c == '[') depth++;
+      else if (c == '}' || c == ']') {
+        if (--depth == 0) {
+          p++;
+          return true;
+        }
       }
+      p++;
+    }
+    return false;
+  }
+  
+  static bool walk_object(const char*& p, const char* end, size_t depth, uint32_t active,
+                          Field* fields, uint32_t& remaining) {
+    p++;  // '{'
+    for (;;) {
+      skip_ws(p, end);
+      if (p >= end) return false;
+      if (*p == '}') {
+        p++;
+        return true;
+      }
+      if (*p == ',') {
+        p++;
+        continue;
+      }
+      if (*p != '"') return false;
+      const char* key_start = p + 1;
+      bool escapes = false;
+      if (!skip_string(p, end, escapes)) return false;
+      string_view key(key_start, (size_t)(p - key_start - 1));
+      skip_ws(p, end);
+      if (p >= end || *p != ':') return false;
+      p++;
+      skip_ws(p, end);
       
-      // Step 6: Register demo_tool_cpp
-      cerr << "Step 6: Registering demo_tool_cpp..." << endl;
-      
-      // Get source file location (executable path + .cpp extension)
-      string source_file = "reverse_mcp.cpp (executable location + .cpp)";
-      
-      string register_params = R"JSON({
-        "name":"remote",
-        "arguments":{
-          "input":{
-            "operation":"register",
-            "tool_name":"demo_tool_cpp",
-            "readme":"Demo tool that echoes messages back and can call other MCP tools.\n- Use this to test the remote tool system and verify bidirectional communication.\n- Demonstrates how remote tools can call OTHER tools on the server (like sqlite, browser, etc.)",
-            "description":"Demo tool (C++ implementation) for testing remote tool registration and end-to-end MCP communication. This tool demonstrates TWO key capabilities: (1) Basic echo functionality - echoes back any message sent to it, and (2) Tool-to-tool communication - shows how remote tools can call OTHER MCP tools on the server. This verifies that: (a) tool registration works correctly, (b) reverse calls from server to client function properly, (c) the client can successfully reply to tool calls, (d) the full bidirectional JSON-RPC communication channel is operational, and (e) remote tools can orchestrate other tools. This tool is implemented in reverse_mcp.cpp and serves as a reference template for integrating MCP tool support into other applications like Fusion 360, Blender, Ghidra, and similar products. Usage workflow: (1) Start by discovering databases: {\"message\": \"list databases\"} calls sqlite to show all available databases. (2) Then list tables in a specific database: {\"message\": \"list tables in test.db\"} calls sqlite and returns table names. (3) Basic echo: {\"message\": \"test\"} returns 'Echo: test'. The tool automatically detects keywords in the message to trigger different demonstrations.",
-            "parameters":{
-              "type":"object",
-              "properties":{
-                "message":{"type":"string","description":"The message to echo back"}
-              },
-              "required":["message"]
-            },
-            "callback_endpoint":"cpp-client://demo-tool-callback",
-            "TOOL_API_KEY":"cpp_demo_tool_auth_key_12345"
-          }
+      // Which lookups continue through this key?
+      uint32_t here = 0, deeper = 0;
+      for (uint32_t bits = active & remaining; bits; bits &= bits - 1) {
+        uint32_t i = ctz32(bits);
+        Field& f = fields[i];
+        if (depth < f.segment_count && f.segments[depth] == key) {
+          if (depth + 1 == f.segment_count) here |= 1u << i;
+          else deeper |= 1u << i;
         }
-      })JSON";
+      }
       
-      string register_result = conn.send_request("tools/call", register_params);
-      if (register_result.empty()) {
-        cerr << "ERROR: Registration failed" << endl;
-        retry_count++;
+      if (deeper && p < end && *p == '{') {
+        const char* value_start = p;
+        if (!walk_object(p, end, depth + 1, deeper, fields, remaining)) return false;
+        if (here) {
+          JsonValue v;
+          v.type = JsonValue::Object;
+          v.raw = string_view(value_start, (size_t)(p - value_start));
+          assign(fields, here, v, remaining);
+        }
+      } else {
+        JsonValue v;
+        if (!parse_value(p, end, v)) return false;
+        if (here) assign(fields, here, v, remaining);
+      }
+      if (remaining == 0) return true;  // Everything found - stop early
+    }
+  }
+  
+  static void assign(Field* fields, uint32_t bits, const JsonValue& v, uint32_t& remaining) {
+    for (; bits; bits &= bits - 1) {
+      uint32_t i = ctz32(bits);
+      fields[i].value = v;
+      remaining &= ~(1u << i);
+    }
+  }
+  
+  static bool search_value(const char*& p, const char* end, string_view key, JsonValue& out, size_t depth) {
+    skip_ws(p, end);
+    if (p >= end) return false;
+    if ((*p != '{' && *p != '[') || depth > 64) {
+      JsonValue ignored;
+      return parse_value(p, end, ignored);
+    }
+    bool is_object = (*p == '{');
+    p++;
+    for (;;) {
+      skip_ws(p, end);
+      if (p >= end) return false;
+      if (*p == '}' || *p == ']') {
+        p++;
+        return true;
+      }
+      if (*p == ',') {
+        p++;
         continue;
       }
-      cerr << "[OK] Successfully registered tool: demo_tool_cpp" << endl;
-      
-      // Reset retry count after successful connection and registration
-      retry_count = 0;
-      
-      cerr << endl << string(60, '=') << endl;
-      cerr << "[OK] demo_tool_cpp registered successfully!" << endl;
-      cerr << "Listening for reverse tool calls... (Press Ctrl+C to stop)" << endl;
-      cerr << string(60, '=') << endl << endl;
-      
-      // Step 7: Listen for reverse calls (simplified - no actual SSE in this demo)
-      cerr << "[INFO] In production, this would listen for SSE events and detect disconnections" << endl;
-      cerr << "[INFO] For demo purposes, the tool is registered and ready" << endl;
-      cerr << "[INFO] Press Ctrl+C to stop" << endl;
-      
-      while (g_running) {
-        this_thread::sleep_for(chrono::seconds(1));
-        // In a full implementation, we would check if SSE connection is still alive here
-        // and break to trigger reconnection if it's down
+      if (is_object) {
+        const char* key_start = p + 1;
+        bool escapes = false;
+        if (*p != '"' || !skip_string(p, end, escapes)) return false;
+        string_view k(key_start, (size_t)(p - key_start - 1));
+        skip_ws(p, end);
+        if (p >= end || *p != ':') return false;
+        p++;
+        skip_ws(p, end);
+        if (k == key) {
+          return parse_value(p, end, out);
+        }
       }
-      
-      // If g_running is false, user hit Ctrl+C - exit gracefully
-      if (!g_running) {
-        cerr << endl << endl << string(60, '=') << endl;
-        cerr << "Shutting down..." << endl;
-        cerr << string(60, '=') << endl;
-        return 0;
+      if (!search_value(p, end, key, out, depth + 1)) return false;
+      if (out.found()) return true;
+    }
+  }
+  
+  static bool read_hex4(string_view in, size_t pos, uint32_t& cp) {
+    if (pos + 4 > in.size()) return false;
+    cp = 0;
+    for (size_t k = 0; k < 4; k++) {
+      char h = in[pos + k];
+      cp <<= 4;
+      if (h >= '0' && h <= '9') cp |= (uint32_t)(h - '0');
+      else if (h >= 'a' && h <= 'f') cp |= (uint32_t)(h - 'a' + 10);
+      else if (h >= 'A' && h <= 'F') cp |= (uint32_t)(h - 'A' + 10);
+      else return false;
+    }
+    return true;
+  }
+  
+  template <typename String>
+  static void append_utf8(String& out, uint32_t cp) {
+    if (cp < 0x80) {
+      out.push_back((char)cp);
+    } else if (cp < 0x800) {
+      out.push_back((char)(0xC0 | (cp >> 6)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+      out.push_back((char)(0xE0 | (cp >> 12)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+      out.push_back((char)(0xF0 | (cp >> 18)));
+      out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+      out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+      out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+  }
+  
+  static uint32_t ctz32(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return (uint32_t)idx;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+  }
+};
+
+inline string_view JsonValue::as_string(string& scratch) const {
+  if (type != String) return string_view();
+  if (!has_escapes) return raw;
+  JsonReader::unescape(raw, scratch);
+  return scratch;
+}
+
+// Append the canonical form of a JSON value: no whitespace, object members sorted by key and
+// strings re-encoded after decoding escapes, so documents that mean the same thing produce
+// the same text. False if the value is malformed or nested too deeply.
+bool append_canonical_json(const JsonValue& value, string& out, size_t depth = 0) {
+  if (depth > 32) return false;
+  JsonWriter w(out);
+  string scratch;
+  switch (value.type) {
+    case JsonValue::Missing:
+      return false;
+    case JsonValue::String:
+      w.str(value.as_string(scratch));
+      return true;
+    case JsonValue::Array: {
+      bool ok = true, first = true;
+      w.raw('[');
+      bool parsed = JsonReader::for_each_element(value.raw, [&](const JsonValue& element) {
+        if (!first) w.raw(',');
+        first = false;
+        if (ok) ok = append_canonical_json(element, out, depth + 1);
+      });
+      w.raw(']');
+      return parsed && ok;
+    }
+    case JsonValue::Object: {
+      vector<pair<string, JsonValue>> members;
+      if (!JsonReader::for_each_member(value.raw, [&](const JsonValue& key, const JsonValue& member) {
+        members.emplace_back(key.to_string(), member);
+      })) return false;
+      sort(members.begin(), members.end(),
+           [](const pair<string, JsonValue>& a, const pair<string, JsonValue>& b) { return a.first < b.first; });
+      w.raw('{');
+      for (size_t i = 0; i < members.size(); i++) {
+        if (i) w.raw(',');
+        w.str(members[i].first).raw(':');
+        if (!append_canonical_json(members[i].second, out, depth + 1)) return false;
       }
-      
-      // If we get here, connection dropped - outer loop will retry
-      
-    } catch (const exception& e) {
-      cerr << endl << "[ERROR] Unexpected error in main loop: " << e.what() << endl;
-      retry_count++;
-      // Loop continues to retry
+      w.raw('}');
+      return true;
     }
+    default:
+      w.raw(value.raw);  // Numbers, true, false, null
+      return true;
   }
 }
 
-int main(int argc, char* argv[]) {
-  bool background = false;
-  bool help = false;
+// Extract JSON string value (first occurrence of key at any depth, escapes decoded)
+string extract_json_string(const string& json, const string& key) {
+  JsonValue v = JsonReader::find_key(json, key);
+  return v.is_string() ? v.to_string() : string();
+}
+
+// Find native messaging manifest
+string find_native_messaging_manifest() {
+  vector<string> possible_paths;
   
-  for (int i = 1; i < argc; i++) {
-    string arg = argv[i];
-    if (arg == "--background") background = true;
-    if (arg == "--help") help = true;
+#ifdef _WIN32
+  char* local_appdata = getenv("LOCALAPPDATA");
+  if (local_appdata) {
+    possible_paths.push_back(string(local_appdata) + "\\AuraFriday\\com.aurafriday.shim.json");
   }
-  
-  if (help) {
-    cout << "Usage: reverse_mcp_cpp [--background]" << endl;
-    cout << endl << "Aura Friday Remote Tool Provider - Registers demo_tool_cpp with MCP server" << endl;
-    return 0;
+#elif defined(__APPLE__)
+  const char* home = getenv("HOME");
+  if (home) {
+    possible_paths.push_back(string(home) + "/Library/Application Support/Google/Chrome/NativeMessagingHosts/com.aurafriday.shim.json");
+    possible_paths.push_back(string(home) + "/Library/Application Support/Chromium/NativeMessagingHosts/com.aurafriday.shim.json");
+  }
+#else
+  const char* home = getenv("HOME");
+  if (home) {
+    possible_paths.push_back(string(home) + "/.config/google-chrome/NativeMessagingHosts/com.aurafriday.shim.json");
+    possible_paths.push_back(string(home) + "/.config/chromium/NativeMessagingHosts/com.aurafriday.shim.json");
+  }
+#endif
+  
+  for (const auto& path : possible_paths) {
+    ifstream f(path);
+    if (f.good()) {
+      f.close();
+      return path;
+    }
+  }
+  
+  return "";
+}
+
+// Read manifest file
+string read_file(const string& path) {
+  ifstream file(path);
+  if (!file.is_open()) return "";
+  
+  ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+// Modification time of a file in seconds since the epoch, or -1 if it does not exist
+long long file_mtime(const string& path) {
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(path.c_str(), &st) != 0) return -1;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return -1;
+#endif
+  return (long long)st.st_mtime;
+}
+
+// Where the discovered server endpoint is cached between runs
+// Each extra server connected to at once (see ServerSession) caches under its own variant.
+string discovery_cache_path(const string& variant = string()) {
+  string file = variant.empty() ? "reverse_mcp_cpp.endpoint.json" : "reverse_mcp_cpp.endpoint-" + variant + ".json";
+#ifdef _WIN32
+  char* local_appdata = getenv("LOCALAPPDATA");
+  if (!local_appdata) return "";
+  string dir = string(local_appdata) + "\\AuraFriday";
+  CreateDirectoryA(dir.c_str(), NULL);
+  return dir + "\\" + file;
+#else
+  const char* home = getenv("HOME");
+  if (!home) return "";
+#ifdef __APPLE__
+  string dir = string(home) + "/Library/Caches/AuraFriday";
+  mkdir((string(home) + "/Library/Caches").c_str(), 0700);
+#else
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  string base = (xdg && *xdg) ? string(xdg) : string(home) + "/.cache";
+  mkdir(base.c_str(), 0700);
+  string dir = base + "/aurafriday";
+#endif
+  mkdir(dir.c_str(), 0700);
+  return dir + "/" + file;
+#endif
+}
+
+// Load the cached url/Authorization if it was written for this manifest (same path and
+// mtime - reinstalling the server rewrites the manifest) and is younger than ttl_seconds
+bool load_cached_endpoint(const string& manifest_path, long long ttl_seconds,
+                          string& server_url, string& auth_token, string& local_socket,
+                          const string& variant = string()) {
+  if (ttl_seconds <= 0) return false;
+  string path = discovery_cache_path(variant);
+  if (path.empty()) return false;
+  string cache = read_file(path);
+  if (cache.empty()) return false;
+  
+  JsonReader::Field fields[6] = {
+    JsonReader::Field("manifest"), JsonReader::Field("manifest_mtime"), JsonReader::Field("saved_at"),
+    JsonReader::Field("url"), JsonReader::Field("Authorization"), JsonReader::Field("local_socket"),
+  };
+  if (!JsonReader::extract(cache, fields, 6)) return false;
+  
+  long long now = (long long)chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+  long long saved_at = atoll(string(fields[2].value.raw).c_str());
+  if (fields[0].value.to_string() != manifest_path) return false;
+  if (atoll(string(fields[1].value.raw).c_str()) != file_mtime(manifest_path)) return false;
+  if (now - saved_at < 0 || now - saved_at > ttl_seconds) return false;
+  
+  server_url = fields[3].value.to_string();
+  auth_token = fields[4].value.to_string();
+  local_socket = fields[5].value.is_string() ? fields[5].value.to_string() : string();
+  return !server_url.empty() && !auth_token.empty();
+}
+
+void save_cached_endpoint(const string& manifest_path, const string& server_url, const string& auth_token,
+                          const string& local_socket, const string& variant = string()) {
+  string path = discovery_cache_path(variant);
+  if (path.empty()) return;
+  long long now = (long long)chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+  
+  string cache;
+  JsonWriter(cache).raw("{\"manifest\":").str(manifest_path)
+                   .raw(",\"manifest_mtime\":").number(file_mtime(manifest_path))
+                   .raw(",\"saved_at\":").number(now)
+                   .raw(",\"url\":").str(server_url)
+                   .raw(",\"Authorization\":").str(auth_token)
+                   .raw(",\"local_socket\":").str(local_socket)
+                   .raw("}\n");
+  
+  // The file holds a bearer token - keep it private to this user
+#ifdef _WIN32
+  ofstream f(path, ios::binary | ios::trunc);
+  if (f.is_open()) f << cache;
+#else
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) return;
+  if (write(fd, cache.data(), cache.size()) < 0) {
+    LOG(LOG_WARN) << "[WARN] Could not write discovery cache " << path;
+  }
+  close(fd);
+#endif
+}
+
+void invalidate_cached_endpoint(const string& variant = string()) {
+  string path = discovery_cache_path(variant);
+  if (!path.empty()) remove(path.c_str());
+}
+
+// Execute native binary and get config
+string discover_mcp_server_endpoint(const string& binary_path) {
+  cerr << "Running native binary: " << binary_path << endl;
+  LOG(LOG_DEBUG) << "[DEBUG] Native messaging protocol uses 4-byte length prefix (little-endian uint32)";
+  
+#ifdef _WIN32
+  SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+  HANDLE hStdoutRead, hStdoutWrite;
+  
+  if (!CreatePipe(&hStdoutRead, &hStdoutWrite, &sa, 0)) {
+    return "";
+  }
+  
+  SetHandleInformation(hStdoutRead, HANDLE_FLAG_INHERIT, 0);
+  
+  STARTUPINFOA si = { sizeof(STARTUPINFOA) };
+  si.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  si.hStdOutput = hStdoutWrite;
+  si.hStdError = hStdoutWrite;
+  si.wShowWindow = SW_HIDE;
+  
+  PROCESS_INFORMATION pi = { 0 };
+  
+  string cmd = "\"" + binary_path + "\"";
+  if (!CreateProcessA(NULL, (LPSTR)cmd.c_str(), NULL, NULL, TRUE, 
+                      CREATE_NO_WINDOW, NULL, NULL, &si, &pi)) {
+    CloseHandle(hStdoutRead);
+    CloseHandle(hStdoutWrite);
+    return "";
+  }
+  
+  CloseHandle(hStdoutWrite);
+  
+  // Read output using Chrome Native Messaging protocol
+  // Protocol: 4-byte length (little-endian uint32) followed by JSON message
+  
+  // Step 1: Read the 4-byte length prefix (little-endian uint32)
+  uint8_t length_bytes[4];
+  DWORD bytes_read = 0;
+  DWORD total_read = 0;
+  
+  while (total_read < 4) {
+    if (!ReadFile(hStdoutRead, length_bytes + total_read, 4 - total_read, &bytes_read, NULL) || bytes_read == 0) {
+      cerr << "ERROR: Failed to read 4-byte length prefix (got " << total_read << " bytes)" << endl;
+      TerminateProcess(pi.hProcess, 1);
+      CloseHandle(pi.hProcess);
+      CloseHandle(pi.hThread);
+      CloseHandle(hStdoutRead);
+      return "";
+    }
+    total_read += bytes_read;
+  }
+  
+  // Convert little-endian bytes to uint32
+  uint32_t message_length = length_bytes[0] | (length_bytes[1] << 8) | (length_bytes[2] << 16) | (length_bytes[3] << 24);
+  LOG(LOG_DEBUG) << "[DEBUG] Message length from native binary: " << message_length << " bytes";
+  
+  if (message_length <= 0 || message_length > 10000000) {
+    cerr << "ERROR: Invalid message length: " << message_length << endl;
+    TerminateProcess(pi.hProcess, 1);
+    CloseHandle(pi.hProcess);
+    CloseHandle(pi.hThread);
+    CloseHandle(hStdoutRead);
+    return "";
+  }
+  
+  // Step 2: Read the JSON payload of the specified length
+  string json_str;
+  json_str.resize(message_length);
+  total_read = 0;
+  
+  while (total_read < message_length) {
+    if (!ReadFile(hStdoutRead, &json_str[total_read], message_length - total_read, &bytes_read, NULL) || bytes_read == 0) {
+      cerr << "ERROR: Stream ended after " << total_read << " bytes (expected " << message_length << ")" << endl;
+      TerminateProcess(pi.hProcess, 1);
+      CloseHandle(pi.hProcess);
+      CloseHandle(pi.hThread);
+      CloseHandle(hStdoutRead);
+      return "";
+    }
+    total_read += bytes_read;
+  }
+  
+  LOG(LOG_DEBUG) << "[DEBUG] Successfully read " << total_read << " bytes of JSON";
+  LOG(LOG_DEBUG) << "[DEBUG] JSON preview: " << json_str.substr(0, min((size_t)100, json_str.length())) << "...";
+  
+  TerminateProcess(pi.hProcess, 1);
+  CloseHandle(pi.hProcess);
+  CloseHandle(pi.hThread);
+  CloseHandle(hStdoutRead);
+  
+  return json_str;
+  
+#else
+  // Unix/Linux/macOS implementation
+  FILE* pipe = popen(binary_path.c_str(), "r");
+  if (!pipe) {
+    cerr << "ERROR: Failed to execute binary" << endl;
+    return "";
+  }
+  
+  // Step 1: Read the 4-byte length prefix (little-endian uint32)
+  uint8_t length_bytes[4];
+  if (fread(length_bytes, 1, 4, pipe) != 4) {
+    cerr << "ERROR: Failed to read 4-byte length prefix" << endl;
+    pclose(pipe);
+    return "";
+  }
+  
+  // Convert little-endian bytes to uint32
+  uint32_t message_length = length_bytes[0] | (length_bytes[1] << 8) | (length_bytes[2] << 16) | (length_bytes[3] << 24);
+  LOG(LOG_DEBUG) << "[DEBUG] Message length from native binary: " << message_length << " bytes";
+  
+  if (message_length <= 0 || message_length > 10000000) {
+    cerr << "ERROR: Invalid message length: " << message_length << endl;
+    pclose(pipe);
+    return "";
+  }
+  
+  // Step 2: Read the JSON payload of the specified length
+  string json_str;
+  json_str.resize(message_length);
+  size_t total_read = fread(&json_str[0], 1, message_length, pipe);
+  
+  if (total_read != message_length) {
+    cerr << "ERROR: Stream ended after " << total_read << " bytes (expected " << message_length << ")" << endl;
+    pclose(pipe);
+    return "";
+  }
+  
+  LOG(LOG_DEBUG) << "[DEBUG] Successfully read " << total_read << " bytes of JSON";
+  LOG(LOG_DEBUG) << "[DEBUG] JSON preview: " << json_str.substr(0, min((size_t)100, json_str.length())) << "...";
+  
+  pclose(pipe);
+  
+  return json_str;
+#endif
+}
+
+#ifndef _WIN32
+// Drives many curl transfers over shared connections from one thread (--http2, --event-loop)
+// Every transfer in the same multi handle that goes to the same host can become a stream on
+// one HTTP/2 connection (negotiated via ALPN, falling back to HTTP/1.1 keep-alive when the
+// server does not offer h2). submit() starts a transfer without blocking; perform() keeps
+// the blocking interface on top of it.
+// The thread sleeps in epoll (Linux) or kqueue (macOS/BSD) on exactly the sockets curl asks
+// for (curl_multi_socket_action), so thousands of in-flight transfers cost one thread and no
+// per-wakeup scan; other platforms fall back to curl_multi_poll.
+// Callbacks of every transfer run on the multiplexer thread, so they must never block; a
+// transfer that cannot accept more data calls pause() and is resumed once its resume_when
+// hook (polled by the multiplexer) returns true.
+class CurlMultiplexer {
+public:
+  using Completion = function<void(CURLcode result)>;
+  
+  // max_host_connections caps parallel HTTP/1.1 connections (0 = unlimited); extra transfers
+  // wait inside curl for a free connection instead of each needing a thread
+  explicit CurlMultiplexer(long max_host_connections = 0) {
+    multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    if (max_host_connections > 0) curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_host_connections);
+#ifdef REVERSE_MCP_SOCKET_EVENTS
+    curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+#endif
+    loop_thread = thread(&CurlMultiplexer::loop, this);
+  }
+  
+  ~CurlMultiplexer() {
+    {
+      lock_guard<mutex> lock(mux_mutex);
+      stopping = true;
+    }
+    wakeup();
+    if (loop_thread.joinable()) loop_thread.join();
+    curl_multi_cleanup(multi);
+  }
+  
+  CurlMultiplexer(const CurlMultiplexer&) = delete;
+  CurlMultiplexer& operator=(const CurlMultiplexer&) = delete;
+  
+  // Options that let easy handles share connections as HTTP/2 streams
+  static void configure_handle(CURL* easy) {
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);  // Wait for an h2 connection rather than open another
+  }
+  
+  // Start easy on the multiplexer thread and return at once; done(result) runs on that
+  // thread when the transfer ends (CURLE_ABORTED_BY_CALLBACK if the multiplexer shuts down)
+  void submit(CURL* easy, Completion done, function<bool()> resume_when = nullptr) {
+    Transfer* transfer = new Transfer;
+    transfer->easy = easy;
+    transfer->done = move(done);
+    transfer->resume_when = move(resume_when);
+    if (!enqueue(transfer)) {
+      transfer->done(CURLE_ABORTED_BY_CALLBACK);
+      delete transfer;
+    }
+  }
+  
+  // Run easy to completion on the multiplexer thread; blocks the calling thread
+  // The transfer lives on this stack frame and its completion captures one pointer (small
+  // enough for std::function's inline storage), so a blocking request does not allocate.
+  CURLcode perform(CURL* easy, function<bool()> resume_when = nullptr) {
+    struct Waiter {
+      mutex done_mutex;
+      condition_variable done_cv;
+      bool finished = false;
+      CURLcode result = CURLE_OK;
+    } waiter;
+    Transfer transfer;
+    transfer.owned = false;
+    transfer.easy = easy;
+    transfer.done = [w = &waiter](CURLcode r) {
+      lock_guard<mutex> lock(w->done_mutex);
+      w->result = r;
+      w->finished = true;
+      w->done_cv.notify_one();  // Under the lock: the waiter's stack frame owns done_cv
+    };
+    transfer.resume_when = move(resume_when);
+    if (!enqueue(&transfer)) return CURLE_ABORTED_BY_CALLBACK;
+    unique_lock<mutex> lock(waiter.done_mutex);
+    waiter.done_cv.wait(lock, [&] { return waiter.finished; });
+    return waiter.result;
+  }
+  
+  // Stop receiving on a transfer; only valid from inside that transfer's callbacks
+  static void pause(CURL* easy) {
+    Transfer* transfer = nullptr;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&transfer);
+    if (!transfer || !transfer->resume_when) return;
+    transfer->paused = true;
+    curl_easy_pause(easy, CURLPAUSE_RECV);
+  }
+  
+  // Make the multiplexer thread look at its transfers now (e.g. after a disconnect request)
+  void wakeup() {
+#ifdef REVERSE_MCP_SOCKET_EVENTS
+    poller.wakeup();
+#elif LIBCURL_VERSION_NUM >= 0x074400
+    curl_multi_wakeup(multi);
+#endif
+  }
+  
+private:
+  struct Transfer {
+    CURL* easy = nullptr;
+    Completion done;
+    function<bool()> resume_when;
+    bool paused = false;
+    bool owned = true;  // false: belongs to a perform() call, which outlives done()
+  };
+  
+  // Hand a transfer to the loop thread; false if the multiplexer is shutting down
+  bool enqueue(Transfer* transfer) {
+    curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+    {
+      lock_guard<mutex> lock(mux_mutex);
+      if (stopping) return false;
+      incoming.push_back(transfer);
+    }
+    wakeup();
+    return true;
+  }
+  
+  // Runs done(); a perform() transfer may be gone as soon as done() has signalled
+  static void complete(Transfer* transfer, CURLcode result) {
+    bool owned = transfer->owned;
+    transfer->done(result);
+    if (owned) delete transfer;
+  }
+  
+#ifdef REVERSE_MCP_SOCKET_EVENTS
+  // Readiness notification for the sockets curl hands us, plus a wakeup descriptor
+  class Poller {
+  public:
+    struct Event {
+      int fd;
+      int flags;  // CURL_CSELECT_IN / _OUT / _ERR
+    };
+    
+    Poller() {
+#ifdef REVERSE_MCP_EPOLL
+      poll_fd = epoll_create1(EPOLL_CLOEXEC);
+      wake_read = wake_write = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = wake_read;
+      epoll_ctl(poll_fd, EPOLL_CTL_ADD, wake_read, &ev);
+#else
+      poll_fd = kqueue();
+      int fds[2] = {-1, -1};
+      if (pipe(fds) == 0) {
+        for (int fd : fds) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        wake_read = fds[0];
+        wake_write = fds[1];
+      }
+      struct kevent change;
+      EV_SET(&change, wake_read, EVFILT_READ, EV_ADD, 0, 0, NULL);
+      kevent(poll_fd, &change, 1, NULL, 0, NULL);
+#endif
+    }
+    
+    ~Poller() {
+      close(poll_fd);
+      close(wake_read);
+      if (wake_write != wake_read) close(wake_write);
+    }
+    
+    // Watch fd for the directions curl asked for (CURL_POLL_*); CURL_POLL_REMOVE stops watching
+    void update(int fd, int what) {
+      int previous = 0;
+      auto it = watched.find(fd);
+      if (it != watched.end()) previous = it->second;
+      if (what == CURL_POLL_REMOVE) {
+        if (it != watched.end()) watched.erase(it);
+      } else {
+        watched[fd] = what;
+      }
+#ifdef REVERSE_MCP_EPOLL
+      epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.data.fd = fd;
+      if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+      if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+      if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, &ev);  // May already be closed; harmless
+      } else if (epoll_ctl(poll_fd, previous ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+        // fd numbers are reused after close; fall back to the other operation
+        epoll_ctl(poll_fd, previous ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+      }
+#else
+      int now_in = (what != CURL_POLL_REMOVE) && (what & CURL_POLL_IN);
+      int now_out = (what != CURL_POLL_REMOVE) && (what & CURL_POLL_OUT);
+      struct kevent change;
+      // One change per kevent() call, so a failing EV_DELETE cannot hide the others
+      EV_SET(&change, fd, EVFILT_READ, now_in ? EV_ADD : EV_DELETE, 0, 0, NULL);
+      if (now_in || (previous & CURL_POLL_IN)) kevent(poll_fd, &change, 1, NULL, 0, NULL);
+      EV_SET(&change, fd, EVFILT_WRITE, now_out ? EV_ADD : EV_DELETE, 0, 0, NULL);
+      if (now_out || (previous & CURL_POLL_OUT)) kevent(poll_fd, &change, 1, NULL, 0, NULL);
+#endif
+    }
+    
+    // Wait up to timeout_ms for socket events (the wakeup descriptor is drained, not reported)
+    void wait(vector<Event>& events, int timeout_ms) {
+      events.clear();
+#ifdef REVERSE_MCP_EPOLL
+      epoll_event ready[256];
+      int n = epoll_wait(poll_fd, ready, 256, timeout_ms);
+      for (int i = 0; i < n; i++) {
+        int fd = ready[i].data.fd;
+        if (fd == wake_read) {
+          drain_wakeup();
+          continue;
+        }
+        int flags = 0;
+        if (ready[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+        if (ready[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+        if (ready[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+        events.push_back(Event{fd, flags});
+      }
+#else
+      struct kevent ready[256];
+      timespec ts;
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+      int n = kevent(poll_fd, NULL, 0, ready, 256, timeout_ms < 0 ? NULL : &ts);
+      for (int i = 0; i < n; i++) {
+        int fd = (int)ready[i].ident;
+        if (fd == wake_read) {
+          drain_wakeup();
+          continue;
+        }
+        int flags = ready[i].filter == EVFILT_READ ? CURL_CSELECT_IN : CURL_CSELECT_OUT;
+        if (ready[i].flags & EV_ERROR) flags |= CURL_CSELECT_ERR;
+        events.push_back(Event{fd, flags});
+      }
+#endif
+    }
+    
+    void wakeup() {
+#ifdef REVERSE_MCP_EPOLL
+      uint64_t one = 1;
+      ssize_t ignored = write(wake_write, &one, sizeof(one));
+#else
+      char one = 1;
+      ssize_t ignored = write(wake_write, &one, 1);
+#endif
+      (void)ignored;  // Full means a wakeup is already pending
+    }
+    
+  private:
+    int poll_fd = -1;
+    int wake_read = -1;
+    int wake_write = -1;
+    unordered_map<int, int> watched;  // fd -> CURL_POLL_* currently registered
+    
+    void drain_wakeup() {
+      char buffer[64];
+      while (read(wake_read, buffer, sizeof(buffer)) > 0) {}
+    }
+  };
+  
+  Poller poller;
+  long timer_ms = -1;  // Last timeout curl asked for (-1 = none)
+  chrono::steady_clock::time_point timer_deadline;
+  
+  static int socket_callback(CURL*, curl_socket_t s, int what, void* userp, void*) {
+    static_cast<CurlMultiplexer*>(userp)->poller.update((int)s, what);
+    return 0;
+  }
+  
+  static int timer_callback(CURLM*, long timeout_ms, void* userp) {
+    CurlMultiplexer* self = static_cast<CurlMultiplexer*>(userp);
+    self->timer_ms = timeout_ms;
+    if (timeout_ms >= 0) self->timer_deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+    return 0;
+  }
+#endif
+  
+  CURLM* multi = NULL;
+  thread loop_thread;
+  mutex mux_mutex;
+  vector<Transfer*> incoming;
+  vector<Transfer*> active;
+  bool stopping = false;
+  
+  void finish(Transfer* transfer, CURLcode result) {
+    curl_multi_remove_handle(multi, transfer->easy);
+    active.erase(remove(active.begin(), active.end(), transfer), active.end());
+    complete(transfer, result);
+  }
+  
+  void collect_finished() {
+    CURLMsg* msg;
+    int remaining = 0;
+    while ((msg = curl_multi_info_read(multi, &remaining))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      CURLcode result = msg->data.result;
+      Transfer* transfer = nullptr;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+      if (transfer) finish(transfer, result);
+    }
+  }
+  
+  void loop() {
+    int running = 0;
+#ifdef REVERSE_MCP_SOCKET_EVENTS
+    vector<Poller::Event> events;
+#endif
+    vector<Transfer*> added;  // Swapped with incoming, so neither vector reallocates once warm
+    for (;;) {
+      {
+        lock_guard<mutex> lock(mux_mutex);
+        if (stopping) break;
+        added.swap(incoming);
+      }
+      for (Transfer* t : added) {
+        active.push_back(t);
+        curl_multi_add_handle(multi, t->easy);
+      }
+      added.clear();
+      
+      // Paused transfers are polled rather than signalled; keep the wait short while any exist
+      bool any_paused = false;
+      for (Transfer* t : active) {
+        if (!t->paused) continue;
+        if (t->resume_when()) {
+          t->paused = false;
+          curl_easy_pause(t->easy, CURLPAUSE_CONT);
+        } else {
+          any_paused = true;
+        }
+      }
+      int max_wait_ms = any_paused ? 5 : 1000;
+      
+#ifdef REVERSE_MCP_SOCKET_EVENTS
+      int wait_ms = max_wait_ms;
+      if (timer_ms >= 0) {
+        long long remaining = chrono::duration_cast<chrono::milliseconds>(timer_deadline - chrono::steady_clock::now()).count();
+        wait_ms = (int)max(0LL, min((long long)wait_ms, remaining));
+      }
+      poller.wait(events, wait_ms);
+      for (auto& ev : events) curl_multi_socket_action(multi, ev.fd, ev.flags, &running);
+      if (timer_ms >= 0 && chrono::steady_clock::now() >= timer_deadline) {
+        timer_ms = -1;  // curl re-arms it from inside socket_action if still needed
+        curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+      }
+#else
+      curl_multi_perform(multi, &running);
+#endif
+      collect_finished();
+#ifndef REVERSE_MCP_SOCKET_EVENTS
+#if LIBCURL_VERSION_NUM >= 0x074200
+      curl_multi_poll(multi, NULL, 0, max_wait_ms, NULL);
+#else
+      curl_multi_wait(multi, NULL, 0, min(max_wait_ms, 50), NULL);  // No wakeup support: poll faster
+#endif
+#endif
+    }
+    
+    // Shutting down: fail whatever is still queued or running
+    vector<Transfer*> leftover = active;
+    for (Transfer* t : leftover) finish(t, CURLE_ABORTED_BY_CALLBACK);
+    vector<Transfer*> queued;
+    {
+      lock_guard<mutex> lock(mux_mutex);
+      queued.swap(incoming);
+    }
+    for (Transfer* t : queued) complete(t, CURLE_ABORTED_BY_CALLBACK);
+  }
+};
+#endif
+
+// Content-Encoding of request bodies
+// The server lists what it accepts in an Accept-Encoding header on the SSE response (as in
+// RFC 7694); zstd is preferred and gzip is the fallback. Producing either needs the library
+// at build time: -DREVERSE_MCP_ZSTD (link -lzstd) and/or -DREVERSE_MCP_ZLIB (link -lz).
+enum class BodyEncoding { IDENTITY, GZIP, ZSTD };
+enum class CompressionMode { OFF, AUTO, GZIP, ZSTD };  // --compress
+
+static const char* body_encoding_name(BodyEncoding encoding) {
+  switch (encoding) {
+    case BodyEncoding::GZIP: return "gzip";
+    case BodyEncoding::ZSTD: return "zstd";
+    default: return "identity";
+  }
+}
+
+static bool body_encoding_available(BodyEncoding encoding) {
+  switch (encoding) {
+#ifdef REVERSE_MCP_ZLIB
+    case BodyEncoding::GZIP: return true;
+#endif
+#ifdef REVERSE_MCP_ZSTD
+    case BodyEncoding::ZSTD: return true;
+#endif
+    case BodyEncoding::IDENTITY: return true;
+    default: return false;
+  }
+}
+
+// Pick the body encoding for a session from the mode and the server's Accept-Encoding value
+static BodyEncoding choose_body_encoding(CompressionMode mode, string_view accept_encoding) {
+  auto accepts = [accept_encoding](string_view name) {
+    for (size_t pos = 0; pos < accept_encoding.size();) {
+      size_t end = accept_encoding.find(',', pos);
+      string_view token = accept_encoding.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+      size_t first = token.find_first_not_of(" \t");
+      token = first == string_view::npos ? string_view() : token.substr(first);
+      // "q=0", "q=0.0", "q=0.000" all refuse the coding; compare the weight as a number
+      bool refused = false;
+      size_t params = token.find(';');
+      if (params != string_view::npos) {
+        size_t q = token.find("q=", params);
+        if (q == string_view::npos) q = token.find("Q=", params);
+        if (q != string_view::npos) refused = strtod(string(token.substr(q + 2)).c_str(), nullptr) == 0;
+      }
+      token = token.substr(0, token.find_first_of(" \t;"));
+      if (token.size() == name.size() && !refused &&
+          equal(token.begin(), token.end(), name.begin(), [](char a, char b) { return tolower(a) == b; })) {
+        return true;
+      }
+      if (end == string_view::npos) break;
+      pos = end + 1;
+    }
+    return false;
+  };
+  BodyEncoding wanted = BodyEncoding::IDENTITY;
+  switch (mode) {
+    case CompressionMode::OFF:
+      return BodyEncoding::IDENTITY;
+    case CompressionMode::GZIP:
+      wanted = BodyEncoding::GZIP;
+      break;
+    case CompressionMode::ZSTD:
+      wanted = BodyEncoding::ZSTD;
+      break;
+    case CompressionMode::AUTO:
+      if (body_encoding_available(BodyEncoding::ZSTD) && accepts("zstd")) return BodyEncoding::ZSTD;
+      if (body_encoding_available(BodyEncoding::GZIP) && (accepts("gzip") || accepts("x-gzip"))) return BodyEncoding::GZIP;
+      return BodyEncoding::IDENTITY;
+  }
+  return body_encoding_available(wanted) ? wanted : BodyEncoding::IDENTITY;
+}
+
+// Streaming request-body compressor for one encoding, reused body after body
+// step() works on caller-provided buffers, so a streamed reply is compressed straight into
+// curl's upload buffer with only one input chunk held at a time. Fast levels are used: the
+// point is fewer bytes on the wire, not the smallest possible output.
+class BodyCompressor {
+public:
+  explicit BodyCompressor(BodyEncoding encoding) : encoding(encoding) {
+#ifdef REVERSE_MCP_ZLIB
+    if (encoding == BodyEncoding::GZIP) {
+      memset(&z, 0, sizeof(z));
+      ready = deflateInit2(&z, 1, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;  // +16: gzip wrapper
+    }
+#endif
+#ifdef REVERSE_MCP_ZSTD
+    if (encoding == BodyEncoding::ZSTD) {
+      zstd = ZSTD_createCCtx();
+      ready = zstd && !ZSTD_isError(ZSTD_CCtx_setParameter(zstd, ZSTD_c_compressionLevel, 1));
+    }
+#endif
+  }
+  
+  ~BodyCompressor() {
+#ifdef REVERSE_MCP_ZLIB
+    if (encoding == BodyEncoding::GZIP && ready) deflateEnd(&z);
+#endif
+#ifdef REVERSE_MCP_ZSTD
+    if (zstd) ZSTD_freeCCtx(zstd);
+#endif
+  }
+  
+  BodyCompressor(const BodyCompressor&) = delete;
+  BodyCompressor& operator=(const BodyCompressor&) = delete;
+  
+  // This thread's compressor for encoding, created on first use; null if unavailable
+  static BodyCompressor* for_this_thread(BodyEncoding encoding) {
+    thread_local unique_ptr<BodyCompressor> compressors[3];
+    unique_ptr<BodyCompressor>& c = compressors[(size_t)encoding];
+    if (!c) c.reset(new BodyCompressor(encoding));
+    return c->ready ? c.get() : nullptr;
+  }
+  
+  // Start a new body
+  void reset() {
+    broken = false;
+#ifdef REVERSE_MCP_ZLIB
+    if (encoding == BodyEncoding::GZIP) deflateReset(&z);
+#endif
+#ifdef REVERSE_MCP_ZSTD
+    if (encoding == BodyEncoding::ZSTD) ZSTD_CCtx_reset(zstd, ZSTD_reset_session_only);
+#endif
+  }
+  
+  // Compress from in into out; returns the bytes written and sets consumed. With finish the
+  // frame is ended, and done becomes true once all of it has been written.
+  size_t step(const uint8_t* in, size_t in_len, size_t& consumed, uint8_t* out, size_t out_cap,
+              bool finish, bool& done) {
+    consumed = 0;
+    done = false;
+    (void)in; (void)in_len; (void)out; (void)out_cap; (void)finish;
+#ifdef REVERSE_MCP_ZLIB
+    if (encoding == BodyEncoding::GZIP) {
+      z.next_in = const_cast<Bytef*>(in);
+      z.avail_in = (uInt)min<size_t>(in_len, UINT32_MAX);
+      z.next_out = out;
+      z.avail_out = (uInt)min<size_t>(out_cap, UINT32_MAX);
+      uInt offered = z.avail_in, room = z.avail_out;
+      int rc = deflate(&z, finish && z.avail_in == in_len ? Z_FINISH : Z_NO_FLUSH);
+      consumed = offered - z.avail_in;
+      done = rc == Z_STREAM_END;
+      if (rc == Z_STREAM_ERROR) broken = true;
+      return room - z.avail_out;
+    }
+#endif
+#ifdef REVERSE_MCP_ZSTD
+    if (encoding == BodyEncoding::ZSTD) {
+      ZSTD_inBuffer input = { in, in_len, 0 };
+      ZSTD_outBuffer output = { out, out_cap, 0 };
+      size_t remaining = ZSTD_compressStream2(zstd, &output, &input, finish ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining)) {
+        broken = true;
+        return 0;
+      }
+      consumed = input.pos;
+      done = finish && remaining == 0;
+      return output.pos;
+    }
+#endif
+    broken = true;
+    return 0;
+  }
+  
+  // Compress a whole body into out (replacing its contents); false on failure
+  bool compress(string_view in, string& out) {
+    reset();
+    out.resize(max<size_t>(out.capacity(), in.size() / 2 + 1024));
+    size_t written = 0, offset = 0;
+    for (bool done = false; !done;) {
+      if (written == out.size()) out.resize(out.size() * 2);
+      size_t consumed = 0;
+      written += step(reinterpret_cast<const uint8_t*>(in.data()) + offset, in.size() - offset, consumed,
+                      reinterpret_cast<uint8_t*>(&out[0]) + written, out.size() - written, true, done);
+      offset += consumed;
+      if (broken) return false;
+    }
+    out.resize(written);
+    return true;
+  }
+  
+  bool failed() const {
+    return broken;
+  }
+  
+private:
+  BodyEncoding encoding;
+  bool ready = false;
+  bool broken = false;
+#ifdef REVERSE_MCP_ZLIB
+  z_stream z;
+#endif
+#ifdef REVERSE_MCP_ZSTD
+  ZSTD_CCtx* zstd = nullptr;
+#endif
+};
+
+// Decides which request bodies are compressed
+// Bodies under min_bytes never are. Above it, the total cost per input byte of compressed
+// POSTs (compressing plus sending) is compared with that of plain ones, both smoothed: while
+// compressing loses - typical against a server on the same machine - the threshold doubles,
+// so ever fewer bodies pay the compression latency; while it wins the threshold halves back
+// towards min_bytes. One eligible body in kProbeInterval goes the other way, which keeps both
+// estimates current.
+class AdaptiveCompression {
+public:
+  // Call before the first POST
+  void configure(size_t min_bytes) {
+    this->min_bytes = max<size_t>(min_bytes, 64);
+    threshold.store(this->min_bytes, memory_order_relaxed);
+  }
+  
+  // The server refused a compressed body (415): plain bodies from now on
+  void disable() {
+    if (!refused.exchange(true)) {
+      LOG(LOG_WARN) << "[WARN] Server rejected a compressed request body - sending uncompressed from now on";
+    }
+  }
+  
+  bool eligible(BodyEncoding encoding, size_t size) const {
+    return encoding != BodyEncoding::IDENTITY && size >= min_bytes && !refused.load(memory_order_relaxed);
+  }
+  
+  bool should_compress(BodyEncoding encoding, size_t size) {
+    if (!eligible(encoding, size)) return false;
+    bool compress = size >= threshold.load(memory_order_relaxed);
+    if (probes.fetch_add(1, memory_order_relaxed) % kProbeInterval == kProbeInterval - 1) compress = !compress;
+    return compress;
+  }
+  
+  // A POST of an eligible body finished; elapsed includes compressing it
+  void record(size_t original, chrono::nanoseconds elapsed, bool compressed) {
+    double per_byte = (double)elapsed.count() / (double)max<size_t>(original, 1);
+    lock_guard<mutex> lock(stats_mutex);
+    double& average = ns_per_byte[compressed ? 1 : 0];
+    average = average > 0 ? average * 0.8 + per_byte * 0.2 : per_byte;
+    if (ns_per_byte[0] <= 0 || ns_per_byte[1] <= 0) return;
+    size_t t = threshold.load(memory_order_relaxed);
+    t = ns_per_byte[1] < ns_per_byte[0] ? max(min_bytes, t / 2) : min(kMaxThreshold, t * 2);
+    threshold.store(t, memory_order_relaxed);
+  }
+  
+private:
+  static constexpr size_t kMaxThreshold = 64 * 1024 * 1024;
+  static constexpr uint64_t kProbeInterval = 32;
+  atomic<bool> refused{false};
+  atomic<size_t> threshold{8192};
+  atomic<uint64_t> probes{0};
+  size_t min_bytes = 8192;
+  mutex stats_mutex;
+  double ns_per_byte[2] = {0, 0};  // Smoothed cost of plain [0] and compressed [1] POSTs
+};
+
+// Where and how to POST messages for one session
+// Resolved once from the server's "event: endpoint" and then shared read-only by every
+// request, so no POST rebuilds the URL, re-parses it or re-assembles the headers.
+struct MessageEndpoint {
+  string url;
+  string local_socket;  // Unix socket to reach the server through instead of TCP (empty = none)
+#ifdef _WIN32
+  wstring host;
+  INTERNET_PORT port = 0;
+  wstring path;      // Path and query, as WinHttpOpenRequest takes it
+  bool secure = false;
+  wstring headers;   // Header block for WinHttpSendRequest
+  wstring encoded_headers;  // The same plus Content-Encoding, for compressed bodies
+#else
+#if LIBCURL_VERSION_NUM >= 0x073F00
+  CURLU* parsed = nullptr;  // Set with CURLOPT_CURLU: curl copies it instead of parsing the string
+#endif
+  struct curl_slist* headers = nullptr;
+  struct curl_slist* encoded_headers = nullptr;  // The same plus Content-Encoding, for compressed bodies
+#endif
+  BodyEncoding encoding = BodyEncoding::IDENTITY;
+  
+  MessageEndpoint() = default;
+  MessageEndpoint(const MessageEndpoint&) = delete;
+  MessageEndpoint& operator=(const MessageEndpoint&) = delete;
+  
+  ~MessageEndpoint() {
+#ifndef _WIN32
+#if LIBCURL_VERSION_NUM >= 0x073F00
+    if (parsed) curl_url_cleanup(parsed);
+#endif
+    if (headers) curl_slist_free_all(headers);
+    if (encoded_headers) curl_slist_free_all(encoded_headers);
+#endif
+  }
+  
+  // The endpoint the server advertised, against the SSE URL it came from: an absolute URL is
+  // used as is, "/path" keeps the SSE URL's origin, anything else is relative to its directory.
+  static string join(const string& sse_url, const string& advertised) {
+    if (advertised.compare(0, 7, "http://") == 0 || advertised.compare(0, 8, "https://") == 0) {
+      return advertised;
+    }
+    size_t scheme = sse_url.find("://");
+    size_t origin_end = sse_url.find('/', scheme == string::npos ? 0 : scheme + 3);
+    if (origin_end == string::npos) origin_end = sse_url.size();
+    if (!advertised.empty() && advertised[0] == '/') {
+      return sse_url.substr(0, origin_end) + advertised;
+    }
+    size_t query = sse_url.find_first_of("?#", origin_end);
+    size_t dir_end = sse_url.rfind('/', query == string::npos ? string::npos : query - 1);
+    if (dir_end == string::npos || dir_end < origin_end) {
+      return sse_url.substr(0, origin_end) + "/" + advertised;
+    }
+    return sse_url.substr(0, dir_end + 1) + advertised;
+  }
+  
+  // Plain HTTP over a local socket: nothing leaves the machine, so TLS would only add cost
+  static string local_socket_url(const string& url) {
+    return url.compare(0, 8, "https://") == 0 ? "http://" + url.substr(8) : url;
+  }
+  
+  // Returns null if the URL cannot be parsed
+  static shared_ptr<const MessageEndpoint> resolve(const string& sse_url, const string& advertised,
+                                                   const string& auth_header, bool http2,
+                                                   const string& local_socket = string(),
+                                                   BodyEncoding encoding = BodyEncoding::IDENTITY) {
+    auto ep = make_shared<MessageEndpoint>();
+    ep->url = join(sse_url, advertised);
+    ep->encoding = encoding;
+    string content_encoding = string("Content-Encoding: ") + body_encoding_name(encoding);
+#ifndef _WIN32
+    if (!local_socket.empty()) {
+      ep->url = local_socket_url(ep->url);
+      ep->local_socket = local_socket;
+    }
+#endif
+#ifdef _WIN32
+    wstring wide_url(ep->url.begin(), ep->url.end());
+    URL_COMPONENTS urlComp = { 0 };
+    urlComp.dwStructSize = sizeof(urlComp);
+    urlComp.dwHostNameLength = (DWORD)-1;
+    urlComp.dwUrlPathLength = (DWORD)-1;
+    urlComp.dwExtraInfoLength = (DWORD)-1;
+    if (!WinHttpCrackUrl(wide_url.c_str(), 0, 0, &urlComp)) return nullptr;
+    ep->host.assign(urlComp.lpszHostName, urlComp.dwHostNameLength);
+    ep->port = urlComp.nPort;
+    ep->path.assign(urlComp.lpszUrlPath, urlComp.dwUrlPathLength);
+    ep->path.append(urlComp.lpszExtraInfo, urlComp.dwExtraInfoLength);
+    ep->secure = urlComp.nScheme == INTERNET_SCHEME_HTTPS;
+    string block = "Authorization: " + auth_header + "\r\nContent-Type: application/json";
+    ep->headers.assign(block.begin(), block.end());
+    block += "\r\n" + content_encoding;
+    ep->encoded_headers.assign(block.begin(), block.end());
+#else
+#if LIBCURL_VERSION_NUM >= 0x073F00
+    ep->parsed = curl_url();
+    if (!ep->parsed || curl_url_set(ep->parsed, CURLUPART_URL, ep->url.c_str(), 0) != CURLUE_OK) return nullptr;
+#else
+    if (ep->url.find("://") == string::npos) return nullptr;
+#endif
+    ep->headers = curl_slist_append(ep->headers, ("Authorization: " + auth_header).c_str());
+    ep->headers = curl_slist_append(ep->headers, "Content-Type: application/json");
+    if (!http2) ep->headers = curl_slist_append(ep->headers, "Connection: keep-alive");  // Not allowed in HTTP/2
+    ep->headers = curl_slist_append(ep->headers, "Expect:");  // No 100-continue round trip for large streamed bodies
+    if (encoding != BodyEncoding::IDENTITY) {
+      for (curl_slist* h = ep->headers; h; h = h->next) ep->encoded_headers = curl_slist_append(ep->encoded_headers, h->data);
+      ep->encoded_headers = curl_slist_append(ep->encoded_headers, content_encoding.c_str());
+    }
+#endif
+    return ep;
+  }
+  
+#ifndef _WIN32
+  // Point an easy handle at this endpoint; the URL and header options only store a pointer
+  void apply(CURL* curl, bool encoded = false) const {
+#if LIBCURL_VERSION_NUM >= 0x073F00
+    curl_easy_setopt(curl, CURLOPT_CURLU, parsed);
+#else
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+#endif
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, encoded && encoded_headers ? encoded_headers : headers);
+#if LIBCURL_VERSION_NUM >= 0x072800
+    if (!local_socket.empty()) curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, local_socket.c_str());
+#endif
+  }
+#endif
+};
+
+// Pooled HTTP POST client
+// Keeps handles (and therefore TCP+TLS connections) alive between requests so that
+// tools/reply and tools/call do not pay for a fresh handshake every time.
+// Up to max_handles requests can be in flight at once; extra callers wait for a free slot.
+// With enable_http2() the requests become concurrent streams on one HTTP/2 connection,
+// which the SSE stream can join as well (see SSEConnection). With enable_event_loop(),
+// post_async() sends without holding a thread per request.
+class HttpConnectionPool {
+public:
+  explicit HttpConnectionPool(size_t max_handles = 4) : max_handles(max_handles ? max_handles : 1) {
+#ifndef _WIN32
+    static once_flag curl_init_once;
+    call_once(curl_init_once, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif
+  }
+  
+  ~HttpConnectionPool() {
+    shutdown();
+#ifdef _WIN32
+    if (hConnect) WinHttpCloseHandle(hConnect);
+    if (hSession) WinHttpCloseHandle(hSession);
+#else
+    for (auto* h : all_handles) {
+      curl_easy_cleanup(h->curl);
+      delete h;
+    }
+    if (share) curl_share_cleanup(share);
+#endif
+  }
+  
+  HttpConnectionPool(const HttpConnectionPool&) = delete;
+  HttpConnectionPool& operator=(const HttpConnectionPool&) = delete;
+  
+  // Negotiate HTTP/2 and multiplex requests over one connection; call before the first request
+  void enable_http2() {
+    lock_guard<mutex> lock(pool_mutex);
+    http2 = true;
+#ifndef _WIN32
+    start_multiplexer();
+#endif
+  }
+  
+  // Non-blocking transport: post_async() requests are driven by one event loop (curl multi
+  // socket API / WinHTTP async callbacks) instead of a blocked thread each
+  void enable_event_loop() {
+    lock_guard<mutex> lock(pool_mutex);
+    event_loop = true;
+#ifndef _WIN32
+    start_multiplexer();
+#endif
+  }
+  
+  bool http2_enabled() const {
+    return http2;
+  }
+  
+  bool event_loop_enabled() const {
+    return event_loop;
+  }
+  
+  // True if post_async() returns without waiting: always with enable_event_loop(), and with
+  // enable_http2() too on Linux/macOS, where the multiplexer can take the request
+  bool async_capable() const {
+#ifdef _WIN32
+    return event_loop;
+#else
+    return mux != nullptr;
+#endif
+  }
+  
+  // Abort asynchronous POSTs still in flight and wait for their callbacks to finish
+  void shutdown() {
+#ifdef _WIN32
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      if (hAsyncConnect) WinHttpCloseHandle(hAsyncConnect);
+      hAsyncConnect = NULL;
+    }
+    // Open requests are not closed with their parent; they finish or fail on their own shortly
+    unique_lock<mutex> lock(pool_mutex);
+    pool_cv.wait_for(lock, chrono::seconds(10), [this] { return async_outstanding == 0; });
+    if (hAsyncSession) WinHttpCloseHandle(hAsyncSession);
+    hAsyncSession = NULL;
+#else
+    mux.reset();  // Fails leftover transfers through their callbacks, then joins the loop
+#endif
+  }
+  
+#ifdef _WIN32
+  // The session's connect handle, so other requests (the SSE GET) can share its connections
+  HINTERNET shared_connect_handle(const wstring& host, INTERNET_PORT port) {
+    lock_guard<mutex> lock(pool_mutex);
+    return get_connect_handle(host, port);
+  }
+#else
+  // Apply the pool's shared connection cache and HTTP version to another easy handle
+  void configure_shared_handle(CURL* easy) {
+    curl_easy_setopt(easy, CURLOPT_SHARE, share);
+    if (http2) CurlMultiplexer::configure_handle(easy);
+  }
+  
+  CurlMultiplexer* multiplexer() {
+    return mux.get();
+  }
+#endif
+  
+  // Bodies smaller than this are never compressed, whatever the endpoint's encoding
+  void set_compression_min_bytes(size_t min_bytes) {
+    compression.configure(min_bytes);
+  }
+  
+  // POST body to the endpoint; returns "OK" on 202 Accepted, "" on any failure
+  string post(const MessageEndpoint& endpoint, string_view body) {
+    auto start = chrono::steady_clock::now();
+    thread_local string packed;
+    bool encoded = compress_body(endpoint, body, packed);
+    string_view wire = encoded ? string_view(packed) : body;
+#ifdef _WIN32
+    string result = post_winhttp(endpoint, wire, encoded);
+#else
+    string result = post_curl(endpoint, wire, encoded);
+#endif
+    record_post(start, wire.size(), !result.empty());
+    record_compression(endpoint.encoding, start, body.size(), wire.size(), encoded);
+    if (packed.capacity() > kMaxRetainedBuffer) string().swap(packed);
+    return result;
+  }
+  
+  // POST a body generated while it is sent (see StreamingReply); "OK" on 202 Accepted
+  string post_stream(const MessageEndpoint& endpoint, StreamingReply& body) {
+    auto start = chrono::steady_clock::now();
+    bool encoded = false;
+    size_t wire = 0;
+#ifdef _WIN32
+    string result = post_winhttp_stream(endpoint, body);
+    wire = body.bytes_sent();
+#else
+    string result = post_curl_stream(endpoint, body, encoded, wire);
+#endif
+    record_post(start, wire, !result.empty());
+    record_compression(endpoint.encoding, start, body.bytes_sent(), wire, encoded);
+    return result;
+  }
+  
+  // POST without waiting: done(accepted) runs on the event loop thread when the 202 (or a
+  // failure) arrives, so it must be quick. The body is copied and the endpoint kept alive
+  // until then. Without an event loop (see async_capable()) this is a blocking post()
+  // followed by done().
+  void post_async(const shared_ptr<const MessageEndpoint>& endpoint, string_view body,
+                  function<void(bool accepted)> done) {
+    if (!async_capable()) {
+      done(!post(*endpoint, body).empty());
+      return;
+    }
+#ifdef _WIN32
+    post_winhttp_async(*endpoint, body, move(done));
+#else
+    post_curl_async(endpoint, body, move(done));
+#endif
+  }
+  
+private:
+  size_t max_handles;
+  mutex pool_mutex;
+  condition_variable pool_cv;
+  bool http2 = false;
+  bool event_loop = false;
+  AdaptiveCompression compression;
+  static constexpr size_t kMaxRetainedBuffer = 4 * 1024 * 1024;
+  
+  static void record_post(chrono::steady_clock::time_point start, size_t bytes, bool ok) {
+    Metrics& m = metrics();
+    m.observe(Metrics::HTTP_POST_LATENCY, chrono::steady_clock::now() - start);
+    m.add(Metrics::HTTP_POSTS);
+    m.add(Metrics::BYTES_OUT, bytes);
+    if (!ok) m.add(Metrics::HTTP_POST_ERRORS);
+  }
+  
+  // Compress body into out if the policy says it is worth it; true if it did
+  bool compress_body(const MessageEndpoint& endpoint, string_view body, string& out) {
+    if (!compression.should_compress(endpoint.encoding, body.size())) return false;
+    BodyCompressor* compressor = BodyCompressor::for_this_thread(endpoint.encoding);
+    return compressor && compressor->compress(body, out);
+  }
+  
+  // Feed a finished POST of a compressible body back into the policy
+  void record_compression(BodyEncoding encoding, chrono::steady_clock::time_point start,
+                          size_t original, size_t wire, bool encoded) {
+    if (!compression.eligible(encoding, original)) return;
+    compression.record(original, chrono::steady_clock::now() - start, encoded);
+    if (encoded) {
+      metrics().add(Metrics::COMPRESSED_POSTS);
+      if (original > wire) metrics().add(Metrics::COMPRESSION_SAVED_BYTES, original - wire);
+    }
+  }
+  
+#ifdef _WIN32
+  HINTERNET hSession = NULL;
+  HINTERNET hConnect = NULL;
+  wstring connect_host;
+  INTERNET_PORT connect_port = 0;
+  size_t in_flight = 0;
+  
+  // Returns the shared connect handle for host:port, (re)creating the session on first use
+  HINTERNET get_connect_handle(const wstring& host, INTERNET_PORT port) {
+    if (!hSession) {
+      hSession = WinHttpOpen(L"MCP Client/1.0",
+                             WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                             WINHTTP_NO_PROXY_NAME,
+                             WINHTTP_NO_PROXY_BYPASS, 0);
+      if (!hSession) return NULL;
+      DWORD max_conns = (DWORD)max_handles;
+      WinHttpSetOption(hSession, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &max_conns, sizeof(max_conns));
+#ifdef WINHTTP_PROTOCOL_FLAG_HTTP2
+      if (http2) {
+        // Windows 10 1607+: requests on this session become streams of one HTTP/2 connection
+        DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+        WinHttpSetOption(hSession, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols, sizeof(protocols));
+      }
+#endif
+    }
+    if (hConnect && (host != connect_host || port != connect_port)) {
+      WinHttpCloseHandle(hConnect);
+      hConnect = NULL;
+    }
+    if (!hConnect) {
+      hConnect = WinHttpConnect(hSession, host.c_str(), port, 0);
+      connect_host = host;
+      connect_port = port;
+    }
+    return hConnect;
+  }
+  
+  string post_winhttp(const MessageEndpoint& endpoint, string_view body, bool encoded) {
+    HINTERNET connect_handle;
+    {
+      unique_lock<mutex> lock(pool_mutex);
+      pool_cv.wait(lock, [this] { return in_flight < max_handles; });
+      connect_handle = get_connect_handle(endpoint.host, endpoint.port);
+      if (!connect_handle) return "";
+      in_flight++;
+    }
+    
+    DWORD status_code = 0;
+    string result = send_winhttp(connect_handle, endpoint.path.c_str(), endpoint.secure,
+                                 encoded ? endpoint.encoded_headers : endpoint.headers, body, status_code);
+    if (encoded && status_code == 415) compression.disable();
+    
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      in_flight--;
+    }
+    pool_cv.notify_one();
+    return result;
+  }
+  
+  // One asynchronous POST; owned by WinHTTP's callbacks until the request handle closes
+  struct AsyncPost {
+    HttpConnectionPool* pool;
+    string body;  // As sent (compressed if encoded)
+    function<void(bool)> done;
+    chrono::steady_clock::time_point start;
+    BodyEncoding encoding = BodyEncoding::IDENTITY;
+    size_t original_size = 0;
+    bool encoded = false;
+    DWORD status_code = 0;
+    bool accepted = false;
+    bool closing = false;
+    char drain[512];
+  };
+  
+  HINTERNET hAsyncSession = NULL;
+  HINTERNET hAsyncConnect = NULL;
+  size_t async_outstanding = 0;
+  
+  void post_winhttp_async(const MessageEndpoint& endpoint, string_view body, function<void(bool)> done) {
+    HINTERNET hRequest = NULL;
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      if (!hAsyncSession) {
+        // WinHTTP runs the callbacks below on its own thread pool; no thread waits per request
+        hAsyncSession = WinHttpOpen(L"MCP Client/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                                    WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, WINHTTP_FLAG_ASYNC);
+        if (hAsyncSession) {
+          DWORD max_conns = (DWORD)max_handles;
+          WinHttpSetOption(hAsyncSession, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &max_conns, sizeof(max_conns));
+#ifdef WINHTTP_PROTOCOL_FLAG_HTTP2
+          if (http2) {
+            DWORD protocols = WINHTTP_PROTOCOL_FLAG_HTTP2;
+            WinHttpSetOption(hAsyncSession, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &protocols, sizeof(protocols));
+          }
+#endif
+          WinHttpSetStatusCallback(hAsyncSession, async_status_callback,
+                                   WINHTTP_CALLBACK_FLAG_ALL_COMPLETIONS | WINHTTP_CALLBACK_FLAG_HANDLES, 0);
+          hAsyncConnect = WinHttpConnect(hAsyncSession, endpoint.host.c_str(), endpoint.port, 0);
+        }
+      }
+      if (hAsyncConnect) {
+        DWORD flags = endpoint.secure ? WINHTTP_FLAG_SECURE : 0;
+        hRequest = WinHttpOpenRequest(hAsyncConnect, L"POST", endpoint.path.c_str(), NULL, WINHTTP_NO_REFERER,
+                                      WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
+      }
+      if (hRequest) async_outstanding++;
+    }
+    if (!hRequest) {
+      done(false);
+      return;
+    }
+    
+    DWORD security_flags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
+                           SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
+                           SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
+                           SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE;
+    WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &security_flags, sizeof(security_flags));
+    
+    AsyncPost* ctx = new AsyncPost{this, string(), move(done), chrono::steady_clock::now()};
+    ctx->encoding = endpoint.encoding;
+    ctx->original_size = body.size();
+    ctx->encoded = compress_body(endpoint, body, ctx->body);
+    if (!ctx->encoded) ctx->body.assign(body.data(), body.size());
+    const wstring& headers = ctx->encoded ? endpoint.encoded_headers : endpoint.headers;
+    // From here on the context is released only by WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING
+    if (!WinHttpSendRequest(hRequest, headers.c_str(), (DWORD)-1L,
+                            (LPVOID)ctx->body.data(), (DWORD)ctx->body.size(),
+                            (DWORD)ctx->body.size(), (DWORD_PTR)ctx)) {
+      WinHttpSetOption(hRequest, WINHTTP_OPTION_CONTEXT_VALUE, &ctx, sizeof(ctx));
+      close_async(hRequest, ctx);
+    }
+  }
+  
+  static void close_async(HINTERNET hRequest, AsyncPost* ctx) {
+    if (ctx->closing) return;
+    ctx->closing = true;
+    WinHttpCloseHandle(hRequest);
+  }
+  
+  // Request state machine: send -> receive headers -> drain body -> close
+  static void CALLBACK async_status_callback(HINTERNET hRequest, DWORD_PTR context, DWORD status,
+                                             LPVOID info, DWORD info_length) {
+    AsyncPost* ctx = reinterpret_cast<AsyncPost*>(context);
+    if (!ctx) return;
+    switch (status) {
+      case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+        if (!WinHttpReceiveResponse(hRequest, NULL)) close_async(hRequest, ctx);
+        break;
+      case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE: {
+        DWORD status_code = 0;
+        DWORD size = sizeof(status_code);
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                            NULL, &status_code, &size, NULL);
+        ctx->status_code = status_code;
+        ctx->accepted = (status_code == 202);
+        if (!WinHttpQueryDataAvailable(hRequest, NULL)) close_async(hRequest, ctx);
+        break;
+      }
+      case WINHTTP_CALLBACK_STATUS_DATA_AVAILABLE: {
+        DWORD available = *static_cast<DWORD*>(info);
+        if (available == 0 ||
+            !WinHttpReadData(hRequest, ctx->drain, min((DWORD)sizeof(ctx->drain), available), NULL)) {
+          close_async(hRequest, ctx);
+        }
+        break;
+      }
+      case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
+        if (info_length == 0 || !WinHttpQueryDataAvailable(hRequest, NULL)) close_async(hRequest, ctx);
+        break;
+      case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
+        ctx->accepted = false;
+        close_async(hRequest, ctx);
+        break;
+      case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING: {
+        HttpConnectionPool* pool = ctx->pool;
+        record_post(ctx->start, ctx->body.size(), ctx->accepted);
+        if (ctx->encoded && ctx->status_code == 415) pool->compression.disable();
+        pool->record_compression(ctx->encoding, ctx->start, ctx->original_size, ctx->body.size(), ctx->encoded);
+        ctx->done(ctx->accepted);
+        delete ctx;
+        {
+          lock_guard<mutex> lock(pool->pool_mutex);
+          pool->async_outstanding--;
+        }
+        pool->pool_cv.notify_all();
+        break;
+      }
+    }
+  }
+  
+  // Request handles are cheap; WinHTTP keeps the underlying sockets alive per session
+  static string send_winhttp(HINTERNET connect_handle, const wchar_t* path, bool secure,
+                             const wstring& headers, string_view body, DWORD& status_code) {
+    DWORD flags = secure ? WINHTTP_FLAG_SECURE : 0;
+    HINTERNET hRequest = WinHttpOpenRequest(connect_handle, L"POST", path, NULL,
+                                            WINHTTP_NO_REFERER,
+                                            WINHTTP_DEFAULT_ACCEPT_TYPES,
+                                            flags);
+    if (!hRequest) return "";
+    
+    // Ignore SSL certificate errors
+    DWORD security_flags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
+                           SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
+                           SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
+                           SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE;
+    WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &security_flags, sizeof(security_flags));
+    
+    BOOL result = WinHttpSendRequest(hRequest,
+                                     headers.c_str(), (DWORD)-1L,
+                                     (LPVOID)body.data(), (DWORD)body.size(),
+                                     (DWORD)body.size(), 0);
+    
+    if (!result || !WinHttpReceiveResponse(hRequest, NULL)) {
+      WinHttpCloseHandle(hRequest);
+      return "";
+    }
+    
+    DWORD size = sizeof(status_code);
+    WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                       NULL, &status_code, &size, NULL);
+    
+    // Drain the body so the connection can go back to WinHTTP's keep-alive pool
+    DWORD available = 0;
+    char drain[512];
+    while (WinHttpQueryDataAvailable(hRequest, &available) && available > 0) {
+      DWORD read = 0;
+      if (!WinHttpReadData(hRequest, drain, min((DWORD)sizeof(drain), available), &read) || read == 0) break;
+    }
+    
+    WinHttpCloseHandle(hRequest);
+    return (status_code == 202) ? "OK" : "";
+  }
+  
+  // Same as post_winhttp, but the body is written in chunks with WinHttpWriteData
+  string post_winhttp_stream(const MessageEndpoint& endpoint, StreamingReply& body) {
+    HINTERNET connect_handle;
+    {
+      unique_lock<mutex> lock(pool_mutex);
+      pool_cv.wait(lock, [this] { return in_flight < max_handles; });
+      connect_handle = get_connect_handle(endpoint.host, endpoint.port);
+      if (!connect_handle) return "";
+      in_flight++;
+    }
+    
+    DWORD status_code = 0;
+    DWORD flags = endpoint.secure ? WINHTTP_FLAG_SECURE : 0;
+    HINTERNET hRequest = WinHttpOpenRequest(connect_handle, L"POST", endpoint.path.c_str(), NULL, WINHTTP_NO_REFERER,
+                                            WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
+    if (hRequest) {
+      DWORD security_flags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
+                             SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
+                             SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
+                             SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE;
+      WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &security_flags, sizeof(security_flags));
+      
+      bool ok = WinHttpSendRequest(hRequest, endpoint.headers.c_str(), (DWORD)-1L, WINHTTP_NO_REQUEST_DATA, 0,
+                                   (DWORD)body.content_length(), 0) != FALSE;
+      char chunk[64 * 1024];
+      while (ok) {
+        size_t n = body.read(chunk, sizeof(chunk));
+        if (n == 0) break;
+        DWORD written = 0;
+        ok = WinHttpWriteData(hRequest, chunk, (DWORD)n, &written) && written == n;
+      }
+      if (ok && !body.failed() && WinHttpReceiveResponse(hRequest, NULL)) {
+        DWORD size = sizeof(status_code);
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                            NULL, &status_code, &size, NULL);
+        DWORD available = 0;
+        char drain[512];
+        while (WinHttpQueryDataAvailable(hRequest, &available) && available > 0) {
+          DWORD read = 0;
+          if (!WinHttpReadData(hRequest, drain, min((DWORD)sizeof(drain), available), &read) || read == 0) break;
+        }
+      }
+      WinHttpCloseHandle(hRequest);
+    }
+    
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      in_flight--;
+    }
+    pool_cv.notify_one();
+    return (status_code == 202) ? "OK" : "";
+  }
+#else
+  struct PooledHandle {
+    CURL* curl;
+    string response;
+    string body;  // Owned copy for post_async
+    shared_ptr<const MessageEndpoint> endpoint;  // Pinned while a post_async is in flight
+  };
+  
+  CURLSH* share = NULL;
+  mutex share_mutexes[CURL_LOCK_DATA_LAST];
+  unique_ptr<CurlMultiplexer> mux;
+  vector<PooledHandle*> all_handles;
+  vector<PooledHandle*> idle_handles;
+  
+  static void share_lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+    static_cast<HttpConnectionPool*>(userptr)->share_mutexes[data].lock();
+  }
+  
+  static void share_unlock(CURL*, curl_lock_data data, void* userptr) {
+    static_cast<HttpConnectionPool*>(userptr)->share_mutexes[data].unlock();
+  }
+  
+  static size_t append_to_string(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total_size = size * nmemb;
+    static_cast<string*>(userp)->append((char*)contents, total_size);
+    return total_size;
+  }
+  
+  // Options that never change between requests are set once, when the handle is created
+  PooledHandle* create_handle() {
+    CURL* curl = curl_easy_init();
+    if (!curl) return nullptr;
+    PooledHandle* h = new PooledHandle{curl, string(), string(), nullptr};
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, append_to_string);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &h->response);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    if (http2) CurlMultiplexer::configure_handle(curl);
+    all_handles.push_back(h);
+    return h;
+  }
+  
+  // One connection per pooled handle plus one for the SSE stream when it shares the multi
+  void start_multiplexer() {
+    if (!mux) mux.reset(new CurlMultiplexer((long)max_handles + 1));
+  }
+  
+  // Event-loop mode never waits for a handle: extra requests queue inside curl instead
+  PooledHandle* acquire_nowait() {
+    lock_guard<mutex> lock(pool_mutex);
+    if (idle_handles.empty()) return create_handle();
+    PooledHandle* h = idle_handles.back();
+    idle_handles.pop_back();
+    return h;
+  }
+  
+  void post_curl_async(const shared_ptr<const MessageEndpoint>& endpoint, string_view body,
+                       function<void(bool)> done) {
+    CurlMultiplexer* loop = mux.get();
+    PooledHandle* h = loop ? acquire_nowait() : nullptr;
+    if (!h) {
+      done(false);
+      return;
+    }
+    auto start = chrono::steady_clock::now();
+    h->response.clear();
+    bool encoded = compress_body(*endpoint, body, h->body);  // The owned copy is the compressed one
+    if (!encoded) h->body.assign(body.data(), body.size());
+    h->endpoint = endpoint;
+    endpoint->apply(h->curl, encoded);
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)h->body.size());
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, h->body.data());
+    
+    loop->submit(h->curl, [this, h, start, encoded, original = body.size(), done = move(done)](CURLcode res) {
+      long response_code = 0;
+      curl_easy_getinfo(h->curl, CURLINFO_RESPONSE_CODE, &response_code);
+      bool ok = res == CURLE_OK && response_code == 202;
+      record_post(start, h->body.size(), ok);
+      if (encoded && response_code == 415) compression.disable();
+      record_compression(h->endpoint->encoding, start, original, h->body.size(), encoded);
+      h->endpoint.reset();
+      release(h);
+      done(ok);
+    });
+  }
+  
+  PooledHandle* acquire() {
+    unique_lock<mutex> lock(pool_mutex);
+    while (idle_handles.empty()) {
+      if (all_handles.size() < max_handles) {
+        return create_handle();
+      }
+      pool_cv.wait(lock);
+    }
+    PooledHandle* h = idle_handles.back();
+    idle_handles.pop_back();
+    return h;
+  }
+  
+  void release(PooledHandle* h) {
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      idle_handles.push_back(h);
+    }
+    pool_cv.notify_one();
+  }
+  
+  string post_curl(const MessageEndpoint& endpoint, string_view body, bool encoded) {
+    PooledHandle* h = acquire();
+    if (!h) return "";
+    
+    h->response.clear();
+    endpoint.apply(h->curl, encoded);
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, body.data());
+    
+    CURLcode res = mux ? mux->perform(h->curl) : curl_easy_perform(h->curl);
+    
+    long response_code = 0;
+    curl_easy_getinfo(h->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (encoded && response_code == 415) compression.disable();
+    
+    release(h);
+    return (res == CURLE_OK && response_code == 202) ? "OK" : "";
+  }
+  
+  static size_t read_stream(char* buffer, size_t size, size_t nitems, void* userp) {
+    StreamingReply* body = static_cast<StreamingReply*>(userp);
+    size_t n = body->read(buffer, size * nitems);
+    return body->failed() ? CURL_READFUNC_ABORT : n;
+  }
+  
+  // A streamed body compressed on its way into curl's upload buffer
+  struct CompressedStream {
+    StreamingReply* body;
+    BodyCompressor* compressor;
+    size_t in_pos = 0, in_len = 0;
+    bool input_done = false, done = false;
+    size_t bytes_out = 0;
+    uint8_t in[16 * 1024];
+  };
+  
+  static size_t read_compressed(char* buffer, size_t size, size_t nitems, void* userp) {
+    CompressedStream* s = static_cast<CompressedStream*>(userp);
+    size_t cap = size * nitems, written = 0;
+    while (written < cap && !s->done) {
+      if (s->in_pos == s->in_len && !s->input_done) {
+        s->in_len = s->body->read(reinterpret_cast<char*>(s->in), sizeof(s->in));
+        s->in_pos = 0;
+        if (s->body->failed()) return CURL_READFUNC_ABORT;
+        s->input_done = s->in_len == 0;
+      }
+      size_t consumed = 0;
+      written += s->compressor->step(s->in + s->in_pos, s->in_len - s->in_pos, consumed,
+                                     reinterpret_cast<uint8_t*>(buffer) + written, cap - written,
+                                     s->input_done, s->done);
+      s->in_pos += consumed;
+      if (s->compressor->failed()) return CURL_READFUNC_ABORT;
+    }
+    s->bytes_out += written;
+    return written;
+  }
+  
+  // curl pulls the body through read_stream into its upload buffer as the socket drains.
+  // A compressed body has no known length, so it goes out chunked (or as HTTP/2 DATA frames).
+  string post_curl_stream(const MessageEndpoint& endpoint, StreamingReply& body, bool& encoded, size_t& wire) {
+    PooledHandle* h = acquire();
+    if (!h) return "";
+    
+    // The compressor belongs to this thread, which is blocked until the transfer is done
+    BodyCompressor* compressor = compression.should_compress(endpoint.encoding, body.content_length())
+                                 ? BodyCompressor::for_this_thread(endpoint.encoding) : nullptr;
+    encoded = compressor != nullptr;
+    unique_ptr<CompressedStream> stream;
+    if (encoded) {
+      compressor->reset();
+      stream.reset(new CompressedStream());
+      stream->body = &body;
+      stream->compressor = compressor;
+    }
+    
+    h->response.clear();
+    endpoint.apply(h->curl, encoded);
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, NULL);
+    curl_easy_setopt(h->curl, CURLOPT_POSTFIELDSIZE_LARGE, encoded ? (curl_off_t)-1 : (curl_off_t)body.content_length());
+    curl_easy_setopt(h->curl, CURLOPT_READFUNCTION, encoded ? read_compressed : read_stream);
+    curl_easy_setopt(h->curl, CURLOPT_READDATA, encoded ? (void*)stream.get() : (void*)&body);
+    curl_easy_setopt(h->curl, CURLOPT_POST, 1L);
+    
+    CURLcode res = mux ? mux->perform(h->curl) : curl_easy_perform(h->curl);
+    
+    long response_code = 0;
+    curl_easy_getinfo(h->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    curl_easy_setopt(h->curl, CURLOPT_READDATA, NULL);  // Later posts use POSTFIELDS again
+    if (encoded && response_code == 415) compression.disable();
+    wire = encoded ? stream->bytes_out : body.bytes_sent();
+    
+    release(h);
+    return (res == CURLE_OK && response_code == 202) ? "OK" : "";
+  }
+#endif
+};
+
+// Request id source: fixed width, lock-free and unique within the process
+// Each thread draws a random 60-bit prefix (random_device mixed with the clock and the thread,
+// so ids differ across restarts) and counts up a 30-bit suffix, drawing a new prefix when the
+// counter wraps. 15 characters fit std::string's small buffer, so an id never allocates, and
+// the URL-safe alphabet needs no JSON escaping.
+class RequestIdGenerator {
+public:
+  static const size_t kLength = 15;
+  
+  static void next(char* out) {
+    thread_local State state;
+    if (state.counter == 0) state.reseed();
+    memcpy(out, state.prefix, 10);
+    uint32_t n = state.counter;
+    for (int i = 14; i >= 10; i--, n >>= 6) out[i] = kAlphabet[n & 63];
+    state.counter = (state.counter + 1) & ((1u << 30) - 1);
+  }
+  
+  static string next() {
+    string id(kLength, '\0');  // Small-buffer storage, no heap allocation
+    next(&id[0]);
+    return id;
+  }
+  
+private:
+  static constexpr const char* kAlphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  
+  struct State {
+    char prefix[10];
+    uint32_t counter = 0;
+    
+    void reseed() {
+      uint64_t seed = ((uint64_t)random_device{}() << 32) ^ random_device{}();
+      seed ^= (uint64_t)chrono::steady_clock::now().time_since_epoch().count();
+      seed ^= (uint64_t)hash<thread::id>()(this_thread::get_id()) * 0x9E3779B97F4A7C15ull;
+      // splitmix64 finalizer spreads the mixed seed over all 64 bits
+      seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+      seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+      seed ^= seed >> 31;
+      for (int i = 0; i < 10; i++, seed >>= 6) prefix[i] = kAlphabet[seed & 63];
+      counter = 1;
+    }
+  };
+};
+
+// Parking primitive for idle threads
+// Waiters sleep on a 32-bit epoch word using futex (Linux) or WaitOnAddress (Windows), so
+// notify is a single atomic load when nobody is parked and there is no mutex on the fast path.
+class EventCount {
+public:
+  // Register as a waiter; re-check the condition after this, then wait() or cancel_wait()
+  uint32_t prepare_wait() {
+    waiters.fetch_add(1, memory_order_seq_cst);
+    return epoch.load(memory_order_seq_cst);
+  }
+  
+  void cancel_wait() {
+    waiters.fetch_sub(1, memory_order_seq_cst);
+  }
+  
+  // Sleep until notified (epoch moves past key) or the timeout expires
+  void wait(uint32_t key, chrono::milliseconds timeout) {
+    if (epoch.load(memory_order_seq_cst) == key) {
+      platform_wait(key, timeout);
+    }
+    waiters.fetch_sub(1, memory_order_seq_cst);
+  }
+  
+  void notify_one() {
+    if (waiters.load(memory_order_seq_cst) == 0) return;
+    epoch.fetch_add(1, memory_order_seq_cst);
+    platform_wake(false);
+  }
+  
+  void notify_all() {
+    if (waiters.load(memory_order_seq_cst) == 0) return;
+    epoch.fetch_add(1, memory_order_seq_cst);
+    platform_wake(true);
+  }
+  
+private:
+  atomic<uint32_t> epoch{0};
+  atomic<uint32_t> waiters{0};
+  
+#if defined(__linux__)
+  void platform_wait(uint32_t key, chrono::milliseconds timeout) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(timeout.count() / 1000);
+    ts.tv_nsec = (long)((timeout.count() % 1000) * 1000000);
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0);
+  }
+  void platform_wake(bool all) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch), FUTEX_WAKE_PRIVATE, all ? INT32_MAX : 1, nullptr, nullptr, 0);
+  }
+#elif defined(_WIN32)
+  void platform_wait(uint32_t key, chrono::milliseconds timeout) {
+    WaitOnAddress(reinterpret_cast<volatile VOID*>(&epoch), &key, sizeof(key), (DWORD)timeout.count());
+  }
+  void platform_wake(bool all) {
+    if (all) WakeByAddressAll(reinterpret_cast<PVOID>(&epoch));
+    else WakeByAddressSingle(reinterpret_cast<PVOID>(&epoch));
+  }
+#else
+  // Portable fallback (macOS has no public futex API)
+  mutex park_mutex;
+  condition_variable park_cv;
+  void platform_wait(uint32_t key, chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(park_mutex);
+    park_cv.wait_for(lock, timeout, [&] { return epoch.load(memory_order_seq_cst) != key; });
+  }
+  void platform_wake(bool all) {
+    { lock_guard<mutex> lock(park_mutex); }
+    if (all) park_cv.notify_all();
+    else park_cv.notify_one();
+  }
+#endif
+};
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's algorithm)
+// Items are moved in and out of preallocated cells, so message buffers are never copied.
+template <typename T>
+class MPMCQueue {
+public:
+  explicit MPMCQueue(size_t min_capacity) {
+    size_t cap = 2;
+    while (cap < min_capacity) cap <<= 1;
+    mask = cap - 1;
+    cells.reset(new Cell[cap]);
+    for (size_t i = 0; i < cap; i++) cells[i].sequence.store(i, memory_order_relaxed);
+  }
+  
+  bool try_push(T& item) {
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.sequence.load(memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          cell.data = move(item);
+          cell.sequence.store(pos + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // Full
+      } else {
+        pos = enqueue_pos.load(memory_order_relaxed);
+      }
+    }
+  }
+  
+  bool try_pop(T& item) {
+    size_t pos = dequeue_pos.load(memory_order_relaxed);
+    for (;;) {
+      Cell& cell = cells[pos & mask];
+      size_t seq = cell.sequence.load(memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+          item = move(cell.data);
+          cell.sequence.store(pos + mask + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // Empty
+      } else {
+        pos = dequeue_pos.load(memory_order_relaxed);
+      }
+    }
+  }
+  
+  // Approximate number of queued items (exact when producers and consumers are quiet)
+  size_t size_approx() const {
+    size_t enq = enqueue_pos.load(memory_order_relaxed);
+    size_t deq = dequeue_pos.load(memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+  
+  size_t capacity() const { return mask + 1; }
+  
+private:
+  struct alignas(64) Cell {
+    atomic<size_t> sequence;
+    T data;
+  };
+  unique_ptr<Cell[]> cells;
+  size_t mask = 0;
+  alignas(64) atomic<size_t> enqueue_pos{0};
+  alignas(64) atomic<size_t> dequeue_pos{0};
+};
+
+// Table of JSON-RPC requests waiting for their response on the SSE stream
+// Keyed by request id and split into independently locked shards so that thousands of
+// in-flight calls from many threads do not contend on a single mutex.
+// Also tracks how many requests are outstanding and how long responses take, which is what
+// ServerPool balances on.
+class PendingResponseTable {
+public:
+  struct Slot {
+    mutex m;
+    condition_variable cv;
+    bool done = false;
+    bool ok = false;       // false when the connection dropped before a response arrived
+    string response;       // Full JSON-RPC response message
+    function<void()> on_done;  // Run once, on the thread that completes the slot
+    chrono::steady_clock::time_point started;
+  };
+  
+  shared_ptr<Slot> add(const string& id) {
+    auto slot = make_shared<Slot>();
+    slot->started = chrono::steady_clock::now();
+    Shard& shard = shard_for(id);
+    lock_guard<mutex> lock(shard.m);
+    if (shard.slots.insert_or_assign(id, slot).second) outstanding.fetch_add(1, memory_order_relaxed);
+    return slot;
+  }
+  
+  void remove(const string& id) {
+    Shard& shard = shard_for(id);
+    lock_guard<mutex> lock(shard.m);
+    if (shard.slots.erase(id)) outstanding.fetch_sub(1, memory_order_relaxed);
+  }
+  
+  // Requests still waiting for a response
+  size_t in_flight() const {
+    return outstanding.load(memory_order_relaxed);
+  }
+  
+  // Smoothed time from sending a request to its response (zero until one has completed)
+  chrono::microseconds response_latency() const {
+    return chrono::microseconds(latency_us.load(memory_order_relaxed));
+  }
+  
+  // Deliver a response; returns false if nobody is waiting for this id
+  bool complete(const string& id, string&& response) {
+    shared_ptr<Slot> slot;
+    {
+      Shard& shard = shard_for(id);
+      lock_guard<mutex> lock(shard.m);
+      auto it = shard.slots.find(id);
+      if (it == shard.slots.end()) return false;
+      slot = it->second;
+    }
+    note_latency(chrono::steady_clock::now() - slot->started);
+    finish(*slot, true, move(response));
+    return true;
+  }
+  
+  // Wake the waiter for one id with a failure (e.g. its asynchronous POST was rejected)
+  void fail(const string& id) {
+    shared_ptr<Slot> slot;
+    {
+      Shard& shard = shard_for(id);
+      lock_guard<mutex> lock(shard.m);
+      auto it = shard.slots.find(id);
+      if (it == shard.slots.end()) return;
+      slot = it->second;
+    }
+    finish(*slot, false, string());
+  }
+  
+  // Wake every waiter with a failure (used when the SSE stream goes away)
+  void fail_all() {
+    for (auto& shard : shards) {
+      vector<shared_ptr<Slot>> slots;
+      {
+        lock_guard<mutex> lock(shard.m);
+        for (auto& kv : shard.slots) slots.push_back(kv.second);
+      }
+      for (auto& slot : slots) finish(*slot, false, string());
+    }
+  }
+  
+  static bool is_done(Slot& slot) {
+    lock_guard<mutex> lock(slot.m);
+    return slot.done;
+  }
+  
+  // Run fn when the slot completes (right away, on this thread, if it already has)
+  static void when_done(Slot& slot, function<void()> fn) {
+    {
+      lock_guard<mutex> lock(slot.m);
+      if (!slot.done) {
+        slot.on_done = move(fn);
+        return;
+      }
+    }
+    fn();
+  }
+  
+  static bool wait(Slot& slot, string& response, chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(slot.m);
+    if (!slot.cv.wait_for(lock, timeout, [&slot] { return slot.done; })) return false;
+    if (!slot.ok) return false;
+    response = move(slot.response);
+    return true;
+  }
+  
+private:
+  static const size_t kShardCount = 64;
+  
+  struct alignas(64) Shard {
+    mutex m;
+    unordered_map<string, shared_ptr<Slot>> slots;
+  };
+  Shard shards[kShardCount];
+  atomic<size_t> outstanding{0};
+  atomic<long long> latency_us{0};
+  
+  Shard& shard_for(const string& id) {
+    return shards[hash<string>()(id) % kShardCount];
+  }
+  
+  // EWMA with weight 1/8; concurrent updates may drop a sample, which an average can afford
+  void note_latency(chrono::steady_clock::duration elapsed) {
+    long long us = max<long long>(1, chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    long long average = latency_us.load(memory_order_relaxed);
+    latency_us.store(average ? average + (us - average) / 8 : us, memory_order_relaxed);
+  }
+  
+  static void finish(Slot& slot, bool ok, string&& response) {
+    function<void()> on_done;
+    {
+      lock_guard<mutex> lock(slot.m);
+      if (slot.done) return;
+      slot.done = true;
+      slot.ok = ok;
+      slot.response = move(response);
+      on_done.swap(slot.on_done);
+    }
+    slot.cv.notify_all();
+    if (on_done) on_done();
+  }
+};
+
+// Handle for one in-flight JSON-RPC request
+// Removes itself from the pending table when destroyed, so abandoned requests never leak.
+class PendingRequest {
+public:
+  PendingRequest() = default;
+  PendingRequest(PendingResponseTable* table, string id)
+    : table(table), id(move(id)), slot(table->add(this->id)) {}
+  PendingRequest(PendingRequest&& other) noexcept { *this = move(other); }
+  PendingRequest& operator=(PendingRequest&& other) noexcept {
+    release();
+    table = other.table;
+    id = move(other.id);
+    slot = move(other.slot);
+    other.table = nullptr;
+    return *this;
+  }
+  ~PendingRequest() { release(); }
+  
+  const string& request_id() const { return id; }
+  bool valid() const { return slot != nullptr; }
+  PendingResponseTable* pending_table() const { return table; }
+  
+  // Block until the correlated SSE response arrives; false on timeout or disconnect
+  bool wait(string& response, chrono::milliseconds timeout) {
+    if (!slot) return false;
+    return PendingResponseTable::wait(*slot, response, timeout);
+  }
+  
+  // True once a response (or a failure) has been delivered
+  bool done() const {
+    return !slot || PendingResponseTable::is_done(*slot);
+  }
+  
+  // Run fn once the request completes; fn runs on whichever thread completes it
+  void when_done(function<void()> fn) {
+    if (!slot) {
+      fn();
+      return;
+    }
+    PendingResponseTable::when_done(*slot, move(fn));
+  }
+  
+  // Mark as failed without waiting (e.g. the POST itself was rejected)
+  void reset() { release(); }
+  
+  // Complete with a failure, waking the waiter and running the when_done() callback
+  void fail() {
+    if (table) table->fail(id);
+  }
+  
+private:
+  PendingResponseTable* table = nullptr;
+  string id;
+  shared_ptr<PendingResponseTable::Slot> slot;
+  
+  void release() {
+    if (table) table->remove(id);
+    table = nullptr;
+    slot.reset();
+  }
+};
+
+// Incremental Server-Sent Events parser
+// Network bytes are written into a ring buffer and complete lines are parsed in place as soon
+// as their terminating newline arrives, so the stream is never accumulated into one string.
+// Only the payload of the event currently being assembled is copied out.
+class SSEParser {
+public:
+  struct Event {
+    string type;   // "event:" field ("message" when absent)
+    string data;   // "data:" lines joined with '\n'
+    string id;     // "id:" field, also remembered as last_event_id
+  };
+  
+  explicit SSEParser(size_t initial_capacity = 64 * 1024) {
+    size_t cap = 1024;
+    while (cap < initial_capacity) cap <<= 1;
+    ring.resize(cap);
+  }
+  
+  // Feed raw bytes; on_event is called once for every complete event
+  template <typename Callback>
+  void feed(const char* bytes, size_t len, Callback&& on_event) {
+    while (len > 0) {
+      size_t free_space = ring.size() - (write_pos - read_pos);
+      if (free_space == 0) {
+        // A single line is larger than the ring; grow it (rare - only for very large data lines)
+        grow();
+        continue;
+      }
+      size_t n = min(free_space, len);
+      write_ring(bytes, n);
+      bytes += n;
+      len -= n;
+      parse_lines(on_event);
+    }
+  }
+  
+  // Discard any partially received event (e.g. after the stream was interrupted)
+  void reset() {
+    read_pos = scan_pos = write_pos = 0;
+    pending = Event();
+  }
+  
+  string last_event_id;
+  
+private:
+  vector<char> ring;   // Power-of-two capacity
+  size_t read_pos = 0;   // Start of the current (incomplete) line
+  size_t scan_pos = 0;   // Bytes before this have been searched for '\n'
+  size_t write_pos = 0;  // Positions are monotonic; index with (pos & mask)
+  string line_scratch;   // Only used when a line wraps around the end of the ring
+  Event pending;
+  
+  size_t mask() const { return ring.size() - 1; }
+  
+  void write_ring(const char* bytes, size_t n) {
+    size_t start = write_pos & mask();
+    size_t first = min(n, ring.size() - start);
+    memcpy(&ring[start], bytes, first);
+    if (n > first) memcpy(&ring[0], bytes + first, n - first);
+    write_pos += n;
+  }
+  
+  void grow() {
+    vector<char> bigger(ring.size() * 2);
+    size_t used = write_pos - read_pos;
+    for (size_t i = 0; i < used; i++) bigger[i] = ring[(read_pos + i) & mask()];
+    scan_pos -= read_pos;
+    write_pos = used;
+    read_pos = 0;
+    ring.swap(bigger);
+  }
+  
+  template <typename Callback>
+  void parse_lines(Callback& on_event) {
+    while (scan_pos < write_pos) {
+      // Search the contiguous stretch [scan_pos, end of data or end of ring)
+      size_t start = scan_pos & mask();
+      size_t avail = min(write_pos - scan_pos, ring.size() - start);
+      const char* hit = (const char*)memchr(&ring[start], '\n', avail);
+      if (!hit) {
+        scan_pos += avail;
+        continue;
+      }
+      size_t newline_pos = scan_pos + (size_t)(hit - &ring[start]);
+      size_t line_len = newline_pos - read_pos;
+      size_t line_start = read_pos & mask();
+      
+      const char* line;
+      if (line_start + line_len <= ring.size()) {
+        line = &ring[line_start];
+      } else {
+        size_t first = ring.size() - line_start;
+        line_scratch.assign(&ring[line_start], first);
+        line_scratch.append(&ring[0], line_len - first);
+        line = line_scratch.data();
+      }
+      if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+      process_line(line, line_len, on_event);
+      
+      read_pos = scan_pos = newline_pos + 1;
+    }
+  }
+  
+  template <typename Callback>
+  void process_line(const char* line, size_t len, Callback& on_event) {
+    if (len == 0) {
+      // Blank line terminates the event
+      if (!pending.data.empty() || !pending.type.empty()) {
+        if (!pending.data.empty() && pending.data.back() == '\n') pending.data.pop_back();
+        if (pending.type.empty()) pending.type = "message";
+        on_event(pending);
+      }
+      pending.type.clear();
+      pending.data.clear();
+      pending.id.clear();
+      return;
+    }
+    if (line[0] == ':') {
+      metrics().add(Metrics::SSE_KEEPALIVES);  // Comment / keep-alive ping
+      return;
+    }
+    
+    const char* colon = (const char*)memchr(line, ':', len);
+    size_t name_len = colon ? (size_t)(colon - line) : len;
+    const char* value = colon ? colon + 1 : line + len;
+    size_t value_len = len - (size_t)(value - line);
+    if (value_len > 0 && *value == ' ') {
+      value++;
+      value_len--;
+    }
+    
+    if (name_len == 4 && memcmp(line, "data", 4) == 0) {
+      pending.data.append(value, value_len);
+      pending.data.push_back('\n');
+    } else if (name_len == 5 && memcmp(line, "event", 5) == 0) {
+      pending.type.assign(value, value_len);
+    } else if (name_len == 2 && memcmp(line, "id", 2) == 0) {
+      pending.id.assign(value, value_len);
+      last_event_id = pending.id;
+    }
+    // "retry:" and unknown fields are ignored
+  }
+};
+
+// Runs completion callbacks for asynchronous tool calls on one dedicated thread
+// Responses are correlated on the SSE reader thread (or the HTTP/2 multiplexer thread), which
+// must never block or run user code; callbacks and resumed coroutines are handed over here.
+class CompletionQueue {
+public:
+  ~CompletionQueue() {
+    shutdown();
+  }
+  
+  void post(function<void()> fn) {
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      if (!stopped) {
+        if (!worker.joinable()) worker = thread(&CompletionQueue::run, this);
+        tasks.push_back(move(fn));
+        queue_cv.notify_one();
+        return;
+      }
+    }
+    fn();  // Shutting down: run inline rather than drop a completion
+  }
+  
+  // Run fn on the completion thread once `when` has passed; dropped if the queue shuts down first
+  void post_at(chrono::steady_clock::time_point when, function<void()> fn) {
+    lock_guard<mutex> lock(queue_mutex);
+    if (stopped) return;
+    if (!worker.joinable()) worker = thread(&CompletionQueue::run, this);
+    timers.emplace(when, move(fn));
+    queue_cv.notify_one();
+  }
+  
+  // Run everything already queued, then stop the thread
+  void shutdown() {
+    {
+      lock_guard<mutex> lock(queue_mutex);
+      stopped = true;
+    }
+    queue_cv.notify_one();
+    if (worker.joinable() && worker.get_id() != this_thread::get_id()) worker.join();
+  }
+  
+private:
+  mutex queue_mutex;
+  condition_variable queue_cv;
+  deque<function<void()>> tasks;
+  multimap<chrono::steady_clock::time_point, function<void()>> timers;
+  thread worker;
+  bool stopped = false;
+  
+  void run() {
+    unique_lock<mutex> lock(queue_mutex);
+    for (;;) {
+      if (tasks.empty() && !stopped) {
+        if (timers.empty()) queue_cv.wait(lock);
+        else queue_cv.wait_until(lock, timers.begin()->first);
+      }
+      auto now = chrono::steady_clock::now();
+      while (!timers.empty() && timers.begin()->first <= now) {
+        tasks.push_back(move(timers.begin()->second));
+        timers.erase(timers.begin());
+      }
+      if (tasks.empty()) {
+        if (stopped) return;
+        continue;
+      }
+      function<void()> fn = move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      fn();
+      lock.lock();
+    }
+  }
+};
+
+// Deadline and cancellation state of the reverse call a dispatcher worker is running
+// The worker points t_call_context at it around the handler, so nested call_mcp_tool() waits
+// (and ToolCallFuture::get()) never outlast the call's remaining budget. When the server sends
+// notifications/cancelled, the flag is set and a call_mcp_tool() in progress is woken at once.
+class CallContext {
+public:
+  using Clock = chrono::steady_clock;
+  
+  bool cancelled() const {
+    return cancel_flag.load(memory_order_acquire);
+  }
+  
+  Clock::time_point deadline() const {
+    return call_deadline;
+  }
+  
+  // Budget left: zero once the deadline passed or the call was cancelled
+  chrono::milliseconds remaining() const {
+    if (cancelled()) return chrono::milliseconds(0);
+    if (call_deadline == Clock::time_point::max()) return chrono::milliseconds::max();
+    auto left = chrono::duration_cast<chrono::milliseconds>(call_deadline - Clock::now());
+    return max(left, chrono::milliseconds(0));
+  }
+  
+  // A wait of timeout, shortened to what the call has left
+  chrono::milliseconds clamp(chrono::milliseconds timeout) const {
+    return min(timeout, remaining());
+  }
+  
+  // Bracket a blocking wait for a nested request, so that a cancellation arriving meanwhile
+  // fails it at once. Returns timeout clamped to the budget left, checked after registering so
+  // that no cancellation is missed.
+  chrono::milliseconds begin_wait(const PendingRequest& pending, chrono::milliseconds timeout) {
+    {
+      lock_guard<mutex> lock(wait_mutex);
+      waiting_request = pending.request_id();
+      waiting_table = pending.pending_table();
+    }
+    return clamp(timeout);
+  }
+  
+  void end_wait() {
+    lock_guard<mutex> lock(wait_mutex);
+    waiting_request.clear();
+    waiting_table = nullptr;
+  }
+  
+private:
+  friend class SSEConnection;
+  string call_id;  // Buffers are reused from call to call
+  Clock::time_point call_deadline = Clock::time_point::max();
+  atomic<bool> cancel_flag{false};
+  mutex wait_mutex;
+  string waiting_request;  // Id of the nested request being waited for, failed on cancellation
+  PendingResponseTable* waiting_table = nullptr;  // Where that request is (another server's, if routed)
+};
+
+thread_local CallContext* t_call_context = nullptr;
+
+// Result of SSEConnection::call_mcp_tool_async()
+// The response is delivered through the pending-response table like any other request;
+// consume it once with get() (blocking), then() (callback) or co_await (C++20, see below).
+// Dropping an unconsumed future abandons the call. A call with a then() continuation keeps
+// itself alive until the response arrives, the connection drops or the continuation times out.
+class ToolCallFuture {
+public:
+  ToolCallFuture() = default;
+  
+  bool valid() const {
+    return state != nullptr;
+  }
+  
+  // True once the response (or a failure) has arrived; get() will not block
+  bool ready() const {
+    return !state || state->request.done();
+  }
+  
+  // Block for the JSON-RPC response; "" on POST failure, timeout or disconnect
+  // From a handler, the wait ends early when the reverse call runs out of time or is cancelled.
+  string get(chrono::milliseconds timeout = chrono::seconds(30)) {
+    if (!state || !state->request.valid()) return "";
+    CallContext* context = t_call_context;
+    if (context) timeout = context->begin_wait(state->request, timeout);
+    string response;
+    bool ok = state->request.wait(response, timeout);
+    if (context) context->end_wait();
+    return ok ? response : "";
+  }
+  
+  // Run fn(response) on the connection's completion thread ("" on failure, disconnect or timeout)
+  void then(function<void(string response)> fn, chrono::milliseconds timeout = chrono::seconds(30)) {
+    if (!state) {
+      fn("");
+      return;
+    }
+    shared_ptr<State> st = state;
+    st->request.when_done([st, fn]() mutable {
+      st->completions->post([st, fn]() mutable {
+        string response;
+        st->request.wait(response, chrono::milliseconds(0));
+        st->request.reset();  // Breaks the request -> slot -> callback -> state cycle
+        fn(move(response));
+      });
+    });
+    // A server that never answers must not keep the cycle alive; the timer holds no reference,
+    // and runs on the completion thread like the reset() above, so the two never race
+    weak_ptr<State> weak = st;
+    st->completions->post_at(chrono::steady_clock::now() + timeout, [weak] {
+      if (shared_ptr<State> expired = weak.lock()) expired->request.fail();
+    });
+  }
+  
+#ifdef REVERSE_MCP_COROUTINES
+  // co_await conn.call_mcp_tool_async(...) resumes on the completion thread with the response
+  bool await_ready() const {
+    return ready();
+  }
+  void await_suspend(coroutine_handle<> handle) {
+    then([st = state, handle](string response) {
+      st->result = move(response);
+      handle.resume();
+    });
+  }
+  string await_resume() {
+    if (!state) return "";
+    if (!state->result.empty()) return move(state->result);
+    return get(chrono::milliseconds(0));
+  }
+#endif
+  
+private:
+  friend class SSEConnection;
+  
+  struct State {
+    PendingRequest request;
+    CompletionQueue* completions = nullptr;
+    string result;  // Handed from then() to await_resume()
+  };
+  shared_ptr<State> state;
+  
+  ToolCallFuture(PendingRequest&& request, CompletionQueue* completions) : state(make_shared<State>()) {
+    state->request = move(request);
+    state->completions = completions;
+  }
+};
+
+// Wait for several independent calls issued with call_mcp_tool_async()
+// Results come back in the order of `calls`; a failed or timed-out call yields "".
+// The calls are already in flight, so the total wait is the slowest call, not the sum.
+vector<string> when_all(vector<ToolCallFuture>& calls, chrono::milliseconds timeout = chrono::seconds(30)) {
+  auto deadline = chrono::steady_clock::now() + timeout;
+  vector<string> results;
+  results.reserve(calls.size());
+  for (auto& call : calls) {
+    auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+    results.push_back(call.get(max(remaining, chrono::milliseconds(0))));
+  }
+  return results;
+}
+
+// Callback form: done(results) runs on the completion thread after the last call finishes
+void when_all(vector<ToolCallFuture> calls, function<void(vector<string> results)> done) {
+  struct Join {
+    vector<string> results;
+    atomic<size_t> remaining;
+    function<void(vector<string>)> done;
+  };
+  auto join = make_shared<Join>();
+  join->results.resize(calls.size());
+  join->remaining = calls.size();
+  join->done = move(done);
+  if (calls.empty()) {
+    join->done(move(join->results));
+    return;
+  }
+  for (size_t i = 0; i < calls.size(); i++) {
+    calls[i].then([join, i](string response) {
+      join->results[i] = move(response);
+      if (join->remaining.fetch_sub(1) == 1) join->done(move(join->results));
+    });
+  }
+}
+
+#ifdef REVERSE_MCP_COROUTINES
+// co_await when_all_async(move(calls)) -> vector<string>, resumed on the completion thread
+class WhenAllAwaitable {
+public:
+  explicit WhenAllAwaitable(vector<ToolCallFuture> calls) : calls(move(calls)) {}
+  bool await_ready() const {
+    return calls.empty();
+  }
+  void await_suspend(coroutine_handle<> handle) {
+    when_all(move(calls), [this, handle](vector<string> r) {
+      results = move(r);
+      handle.resume();
+    });
+  }
+  vector<string> await_resume() {
+    return move(results);
+  }
+  
+private:
+  vector<ToolCallFuture> calls;
+  vector<string> results;
+};
+
+inline WhenAllAwaitable when_all_async(vector<ToolCallFuture> calls) {
+  return WhenAllAwaitable(move(calls));
+}
+
+// Fire-and-forget coroutine type for handlers that co_await tool calls
+// The coroutine outlives the dispatcher's call, so take arguments by value (copy call_id etc.):
+//   DetachedTask reply_later(SSEConnection& conn, string call_id) {
+//     string r = co_await conn.call_mcp_tool_async("sqlite", args);
+//     conn.send_tool_reply(call_id, ...);
+//   }
+struct DetachedTask {
+  struct promise_type {
+    DetachedTask get_return_object() { return {}; }
+    suspend_never initial_suspend() noexcept { return {}; }
+    suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { terminate(); }
+  };
+};
+#endif
+
+// Coalesces outgoing JSON-RPC messages into batch POSTs (--batch-window-us)
+// Works like Nagle with a hard cap: while no POST is outstanding, a message is sent at once,
+// so a lone reply is never held back. While one is outstanding, messages that arrive are
+// collected for at most `window` (or until max_batch) and sent together as a JSON-RPC batch
+// array. Callers block until the POST carrying their message completes and get its result,
+// so the body they pass only has to stay valid for the duration of the call.
+class MessageBatcher {
+public:
+  using Sender = function<bool(string_view body)>;
+  
+  MessageBatcher(Sender sender, chrono::microseconds window, size_t max_batch)
+    : sender(move(sender)), window(window), max_batch(max(max_batch, (size_t)1)) {}
+  
+  // Send one message, possibly together with others; true if the server accepted the POST
+  bool submit(string_view message) {
+    Entry entry{message};
+    unique_lock<mutex> lock(batch_mutex);
+    open.push_back(&entry);
+    if (leader_waiting) {
+      // Someone is already collecting this batch; ride along
+      if (open.size() >= max_batch) batch_cv.notify_all();
+      batch_cv.wait(lock, [&] { return entry.done; });
+      return entry.ok;
+    }
+    
+    // Leader: hold the batch open only while another POST is still outstanding
+    leader_waiting = true;
+    auto deadline = chrono::steady_clock::now() + window;
+    batch_cv.wait_until(lock, deadline, [&] { return in_flight == 0 || open.size() >= max_batch; });
+    vector<Entry*> batch;
+    batch.swap(open);
+    leader_waiting = false;
+    in_flight++;
+    lock.unlock();
+    
+    bool ok;
+    if (batch.size() == 1) {
+      ok = sender(message);
+    } else {
+      string& body = batch_body;  // Reused per thread, so steady-state batching does not allocate
+      body.clear();
+      body += '[';
+      for (size_t i = 0; i < batch.size(); i++) {
+        if (i) body += ',';
+        body.append(batch[i]->message.data(), batch[i]->message.size());
+      }
+      body += ']';
+      ok = sender(body);
+    }
+    metrics().observe_count(Metrics::BATCH_SIZE, batch.size());
+    
+    lock.lock();
+    in_flight--;
+    for (Entry* e : batch) {
+      e->ok = ok;
+      e->done = true;
+    }
+    batch_cv.notify_all();
+    return entry.ok;
+  }
+  
+private:
+  struct Entry {
+    string_view message;
+    bool done = false;
+    bool ok = false;
+  };
+  
+  Sender sender;
+  chrono::microseconds window;
+  size_t max_batch;
+  mutex batch_mutex;
+  condition_variable batch_cv;
+  vector<Entry*> open;
+  bool leader_waiting = false;
+  size_t in_flight = 0;
+  static thread_local string batch_body;
+};
+
+thread_local string MessageBatcher::batch_body;
+
+// Bounded LRU/TTL cache of call_mcp_tool() results for idempotent calls
+// Only calls on the allow-list are cached: a tool, optionally narrowed to the calls whose
+// argument at a dotted path (e.g. "input.sql") is one of a set of values. Entries are keyed
+// on the tool name plus the canonical form of the arguments, so key order and whitespace do
+// not matter. Identical calls that arrive while one is already in flight wait for it and
+// share its response instead of each making a round trip. Error responses are not stored.
+// Responses are shared verbatim, so a hit or a coalesced call sees the JSON-RPC "id" of the
+// request that fetched it; callers read "result" or "error", never the id.
+class ToolResultCache {
+public:
+  ToolResultCache(size_t capacity, chrono::milliseconds ttl) : capacity(capacity ? capacity : 1), ttl(ttl) {}
+  
+  // Cache tool_name's calls; with a path, only those whose string argument there is a listed value
+  void allow(const string& tool_name, const string& path = string(), vector<string> values = {}) {
+    lock_guard<mutex> lock(cache_mutex);
+    Rule& rule = rules[tool_name];
+    rule.path = path;
+    rule.values.insert(values.begin(), values.end());
+  }
+  
+  // Fills key and returns true if this call may be served from the cache
+  bool cache_key(string_view tool_name, string_view arguments_json, string& key) {
+    {
+      lock_guard<mutex> lock(cache_mutex);
+      auto it = rules.find(tool_name);
+      if (it == rules.end()) return false;
+      const Rule& rule = it->second;
+      if (!rule.path.empty()) {
+        string scratch;
+        JsonValue value = JsonReader::get(arguments_json, rule.path);
+        if (!value.is_string() || !rule.values.count(string(value.as_string(scratch)))) return false;
+      }
+    }
+    JsonValue arguments;
+    const char* p = arguments_json.data();
+    if (!JsonReader::parse_value(p, p + arguments_json.size(), arguments)) return false;
+    key.assign(tool_name.data(), tool_name.size());
+    key.push_back('\0');
+    return append_canonical_json(arguments, key);
+  }
+  
+  // Cached response for key, or fetch() one - shared with concurrent callers of the same key
+  // A caller waiting for another's fetch gives up with "" after timeout, or sooner when its
+  // reverse call runs out of time or is cancelled, like a call_mcp_tool() of its own would.
+  template <typename Fetch>
+  string get_or_fetch(const string& key, chrono::milliseconds timeout, Fetch&& fetch) {
+    shared_ptr<Flight> flight;
+    {
+      unique_lock<mutex> lock(cache_mutex);
+      auto it = entries.find(key);
+      if (it != entries.end()) {
+        if (chrono::steady_clock::now() < it->second->expires) {
+          lru.splice(lru.begin(), lru, it->second);
+          metrics().add(Metrics::CACHE_HITS);
+          return it->second->response;
+        }
+        lru.erase(it->second);
+        entries.erase(it);
+      }
+      auto pending = flights.find(key);
+      if (pending != flights.end()) {
+        flight = pending->second;
+        metrics().add(Metrics::CACHE_COALESCED);
+        return wait_for_flight(lock, *flight, timeout);
+      }
+      flight = make_shared<Flight>();
+      flights.emplace(key, flight);
+      metrics().add(Metrics::CACHE_MISSES);
+    }
+    
+    // Completes the flight on every path, so a fetch() that throws cannot strand its waiters
+    struct Landing {
+      ToolResultCache& cache;
+      const string& key;
+      Flight& flight;
+      string response;
+      ~Landing() {
+        {
+          lock_guard<mutex> lock(cache.cache_mutex);
+          flight.response = response;
+          flight.done = true;
+          cache.flights.erase(key);
+          if (is_success(response)) cache.store(key, response);
+        }
+        cache.flight_cv.notify_all();
+      }
+    } landing{*this, key, *flight, string()};
+    landing.response = fetch();
+    return landing.response;
+  }
+  
+  void clear() {
+    lock_guard<mutex> lock(cache_mutex);
+    entries.clear();
+    lru.clear();
+  }
+  
+private:
+  struct Rule {
+    string path;
+    set<string> values;
+  };
+  
+  struct Entry {
+    string key;
+    string response;
+    chrono::steady_clock::time_point expires;
+  };
+  
+  struct Flight {
+    bool done = false;
+    string response;
+  };
+  
+  size_t capacity;
+  chrono::milliseconds ttl;
+  mutex cache_mutex;
+  condition_variable flight_cv;
+  map<string, Rule, less<>> rules;
+  list<Entry> lru;  // Most recently used first
+  unordered_map<string, list<Entry>::iterator> entries;
+  unordered_map<string, shared_ptr<Flight>> flights;
+  
+  // In slices when there is a CallContext, whose cancellation does not signal flight_cv
+  string wait_for_flight(unique_lock<mutex>& lock, Flight& flight, chrono::milliseconds timeout) {
+    const CallContext* context = t_call_context;
+    if (context) timeout = context->clamp(timeout);
+    auto deadline = chrono::steady_clock::now() + timeout;
+    while (!flight.done) {
+      if (context && context->cancelled()) return "";
+      auto slice = context ? min(deadline, chrono::steady_clock::now() + chrono::milliseconds(50)) : deadline;
+      flight_cv.wait_until(lock, slice, [&flight] { return flight.done; });
+      if (!flight.done && chrono::steady_clock::now() >= deadline) return "";
+    }
+    return flight.response;
+  }
+  
+  static bool is_success(const string& response) {
+    JsonValue result = JsonReader::get(response, "result");
+    return result.is_object() && JsonReader::get(result.raw, "isError").raw != "true";
+  }
+  
+  void store(const string& key, const string& response) {
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+      lru.erase(it->second);
+      entries.erase(it);
+    }
+    lru.push_front(Entry{key, response, chrono::steady_clock::now() + ttl});
+    entries.emplace(key, lru.begin());
+    while (lru.size() > capacity) {
+      entries.erase(lru.back().key);
+      lru.pop_back();
+    }
+  }
+};
+
+// Append-only capture of the traffic of a session, for --replay (--record FILE)
+// JSON Lines: a header when recording starts, then one line per SSE event received ("in":
+// event type, "id", "data") and per JSON-RPC message sent ("out": the body), each stamped with
+// "t", microseconds since the header. Streamed replies are recorded by size only. Lines are
+// formatted on the calling thread and written by a background thread, so recording costs a
+// copy and a short lock per message, never file I/O on the hot path.
+class TraceRecorder {
+public:
+  ~TraceRecorder() {
+    close();
+  }
+  
+  // Appends to path (several recordings may share a file); false if it cannot be opened
+  bool open(const string& path) {
+    file.open(path, ios::binary | ios::app);
+    if (!file.is_open()) return false;
+    start = chrono::steady_clock::now();
+    long long now_ms = (long long)chrono::duration_cast<chrono::milliseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    string header;
+    JsonWriter(header).raw("{\"trace\":\"reverse_mcp_cpp\",\"version\":1,\"started_ms\":").number(now_ms).raw("}\n");
+    append(header);
+    return true;
+  }
+  
+  void sse_event(string_view type, string_view id, string_view data) {
+    string& line = begin_line();
+    JsonWriter w(line);
+    w.raw(",\"in\":").str(type);
+    if (!id.empty()) w.raw(",\"id\":").str(id);
+    w.raw(",\"data\":").str(data).raw("}\n");
+    append(line);
+  }
+  
+  void outbound(string_view body) {
+    string& line = begin_line();
+    JsonWriter(line).raw(",\"out\":").str(body).raw("}\n");
+    append(line);
+  }
+  
+  void outbound_streamed(size_t bytes) {
+    string& line = begin_line();
+    JsonWriter(line).raw(",\"out_streamed\":").number((long long)bytes).raw("}\n");
+    append(line);
+  }
+  
+  // Write everything recorded so far and stop (later records are dropped)
+  void close() {
+    {
+      lock_guard<mutex> lock(trace_mutex);
+      stopped = true;
+    }
+    trace_cv.notify_one();
+    if (writer.joinable()) writer.join();
+    if (file.is_open()) file.close();
+  }
+  
+private:
+  ofstream file;
+  chrono::steady_clock::time_point start;
+  mutex trace_mutex;
+  condition_variable trace_cv;
+  string pending;  // Swapped with the writer's buffer, so both keep their capacity
+  thread writer;
+  bool stopped = false;
+  
+  // The thread's line buffer, holding "{\"t\":N"
+  string& begin_line() {
+    thread_local string line;
+    line.clear();
+    long long us = (long long)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    JsonWriter(line).raw("{\"t\":").number(us);
+    return line;
+  }
+  
+  void append(string_view line) {
+    {
+      lock_guard<mutex> lock(trace_mutex);
+      if (stopped || !file.is_open()) return;
+      if (!writer.joinable()) writer = thread(&TraceRecorder::writer_loop, this);
+      pending.append(line.data(), line.size());
+    }
+    trace_cv.notify_one();
+  }
+  
+  void writer_loop() {
+    string batch;
+    unique_lock<mutex> lock(trace_mutex);
+    for (;;) {
+      trace_cv.wait(lock, [this] { return !pending.empty() || stopped; });
+      batch.swap(pending);
+      bool done = stopped;
+      lock.unlock();
+      file.write(batch.data(), (streamsize)batch.size());
+      file.flush();
+      batch.clear();
+      lock.lock();
+      if (done && pending.empty()) return;
+    }
+  }
+};
+
+// Priority classes for reverse calls, each with its own queue
+// RESERVED is for cheap health/stats calls: every worker checks it first and the dispatcher
+// keeps dedicated workers that serve nothing else, so it stays responsive even when all the
+// others are busy. The other lanes are served by strict priority or by weight (see
+// LaneScheduling), which keeps a backlog of BATCH exports from delaying INTERACTIVE calls.
+enum class Lane : uint8_t { RESERVED, INTERACTIVE, NORMAL, BATCH };
+static constexpr size_t kLaneCount = 4;
+
+// STRICT always serves the highest non-empty lane; WEIGHTED visits INTERACTIVE, NORMAL and
+// BATCH in proportion to their weights, so lower lanes keep moving under sustained load
+enum class LaneScheduling { STRICT, WEIGHTED };
+
+// A reverse call waiting for a worker; received is when the SSE reader got it, which is where
+// the call's deadline is counted from
+struct QueuedReverseCall {
+  string message;
+  chrono::steady_clock::time_point received;
+  Lane lane = Lane::NORMAL;
+};
+
+// What the SSE reader does with a reverse call it cannot admit (queue full or at max_in_flight)
+// BLOCK stops reading the stream until a worker frees up, which also holds back responses to
+// our own requests - a handler waiting on call_mcp_tool() then stalls until its timeout.
+// REJECT answers the new call at once with an isError reply; SHED_OLDEST does that to the
+// oldest waiting call of the same or a lower lane and admits the new one instead.
+enum class OverloadPolicy { BLOCK, REJECT, SHED_OLDEST };
+
+// SSE Connection class
+class SSEConnection {
+public:
+  string server_url;
+  string auth_header;
+  string session_id;
+  string message_endpoint;
+  string resume_event_id;  // Sent as Last-Event-ID so the server can replay events we missed
+  string local_socket;     // Unix socket the server also listens on; used instead of TCP+TLS when set
+  HttpConnectionPool http_pool;
+  
+  // http2: negotiate HTTP/2 so the SSE stream and all POSTs share one connection
+  explicit SSEConnection(size_t http_pool_size = 4, size_t reverse_queue_capacity = 1024, bool http2 = false)
+    : http_pool(http_pool_size) {
+    for (auto& lane : lanes) lane.reset(new MPMCQueue<QueuedReverseCall>(reverse_queue_capacity));
+    set_lane_scheduling(LaneScheduling::WEIGHTED, 8, 4, 1);
+    if (http2) http_pool.enable_http2();
+  }
+  
+  // Coalesce outgoing messages into JSON-RPC batch POSTs (see MessageBatcher); call before
+  // connect(). window = 0 leaves batching off.
+  void enable_batching(chrono::microseconds window, size_t max_batch) {
+    if (window.count() <= 0) return;
+    batcher.reset(new MessageBatcher([this](string_view body) {
+      return !http_pool.post(*endpoint, body).empty();
+    }, window, max_batch));
+  }
+  
+  ~SSEConnection() {
+    disconnect();
+    error_replies.shutdown();  // Its POSTs use http_pool
+    http_pool.shutdown();    // Asynchronous POST callbacks touch pending_responses
+    pending_responses.fail_all();  // Breaks then() cycles of requests sent after the stream stopped
+    completions.shutdown();  // Finish callbacks while the pending table is still alive
+  }
+  
+  // Opt in to caching idempotent call_mcp_tool() results (see ToolResultCache); nothing is
+  // cached until allow_result_caching() names a tool. Call before connect().
+  void enable_result_cache(size_t capacity, chrono::milliseconds ttl) {
+    if (capacity == 0 || ttl.count() <= 0) return;
+    result_cache.reset(new ToolResultCache(capacity, ttl));
+  }
+  
+  // e.g. allow_result_caching("sqlite", "input.sql", {".databases", ".tables"})
+  void allow_result_caching(const string& tool_name, const string& path = string(), vector<string> values = {}) {
+    if (result_cache) result_cache->allow(tool_name, path, move(values));
+  }
+  
+  // Bound the calls admitted but not yet finished (queued, running or waiting for a per-tool
+  // slot) and choose what happens past the bound; call before connect(). max_in_flight = 0
+  // leaves only the queue capacity as the limit.
+  void set_admission(OverloadPolicy policy, size_t max_in_flight) {
+    overload_policy = policy;
+    this->max_in_flight = max_in_flight;
+  }
+  
+  // The dispatcher brackets each handler with begin_call()/end_call() so notifications/cancelled
+  // can reach it; false if the server cancelled the call while it was still queued
+  bool begin_call(CallContext& context, string_view call_id, chrono::steady_clock::time_point deadline) {
+    context.call_id.assign(call_id.data(), call_id.size());
+    context.call_deadline = deadline;
+    context.cancel_flag.store(false, memory_order_relaxed);
+    lock_guard<mutex> lock(cancel_mutex);
+    auto cancelled = find(cancelled_ids.begin(), cancelled_ids.end(), call_id);
+    if (cancelled != cancelled_ids.end()) {
+      cancelled_ids.erase(cancelled);
+      return false;
+    }
+    running_calls.push_back(&context);
+    return true;
+  }
+  
+  void end_call(CallContext& context) {
+    lock_guard<mutex> lock(cancel_mutex);
+    auto it = find(running_calls.begin(), running_calls.end(), &context);
+    if (it != running_calls.end()) running_calls.erase(it);
+  }
+  
+  // The dispatcher calls this once per admitted call that it finished or dropped
+  void reverse_call_finished() {
+    in_flight.fetch_sub(1, memory_order_acq_rel);
+    if (max_in_flight) reverse_not_full.notify_one();
+  }
+  
+  // Answer an admitted reverse call that will never run (its dispatcher is stopping) with an
+  // isError reply, and release its admission slot
+  void decline_reverse_call(string_view message) {
+    JsonValue id = JsonReader::get(message, "reverse.call_id");
+    if (id.is_string()) {
+      string scratch;
+      string_view call_id = id.as_string(scratch);
+      LOG(LOG_WARN) << "[WARN] Shutting down: declined call_id " << call_id;
+      send_error_reply(call_id, "Tool provider shutting down: this call was not run. Retry later.");
+    }
+    reverse_call_finished();
+  }
+  
+  // Answer a reverse call with an isError result without blocking the calling thread
+  // Without an asynchronous transport the POST goes to the error_replies thread; past
+  // kMaxQueuedErrorReplies waiting there, the reply is dropped and the server times the call out.
+  void send_error_reply(string_view call_id, string_view text) {
+    if (!endpoint) return;
+    string body;
+    JsonWriter w(body);
+    w.raw("{\"jsonrpc\":\"2.0\",\"id\":").str(call_id)
+     .raw(",\"method\":\"tools/reply\",\"params\":{\"result\":{\"content\":[{\"type\":\"text\",\"text\":")
+     .str(text)
+     .raw("}],\"isError\":true}}}");
+    if (http_pool.async_capable()) {
+      http_pool.post_async(endpoint, body, [](bool) {});
+      return;
+    }
+    if (error_replies_queued.fetch_add(1, memory_order_relaxed) >= kMaxQueuedErrorReplies) {
+      error_replies_queued.fetch_sub(1, memory_order_relaxed);
+      return;
+    }
+    error_replies.post([this, target = endpoint, body = move(body)] {
+      http_pool.post(*target, body);
+      error_replies_queued.fetch_sub(1, memory_order_relaxed);
+    });
+  }
+  
+  // Drive the SSE stream and all POSTs from one event-loop thread; call before connect().
+  // Requests and replies no longer block their thread while waiting for the 202.
+  void enable_event_loop() {
+    http_pool.enable_event_loop();
+  }
+  
+  // Open the SSE stream on a background reader thread and wait for the server to
+  // announce the session-specific message endpoint ("event: endpoint")
+  bool connect(chrono::milliseconds timeout = chrono::seconds(10)) {
+    if (server_url.find("/sse") == string::npos) {
+      cerr << "ERROR: Server URL does not look like an SSE endpoint: " << server_url << endl;
+      return false;
+    }
+    
+#if defined(_WIN32) || LIBCURL_VERSION_NUM < 0x072800
+    if (!local_socket.empty()) {
+      // WinHTTP has no named-pipe or AF_UNIX transport (nor does curl before 7.40)
+      LOG(LOG_INFO) << "[INFO] Cannot connect through local socket " << local_socket << " - using " << server_url;
+      local_socket.clear();
+    }
+#endif
+    stop_requested = false;
+    reader_alive = true;
+    note_activity();
+    reader_thread = thread(&SSEConnection::reader_thread_function, this);
+    
+    unique_lock<mutex> lock(state_mutex);
+    state_cv.wait_for(lock, timeout, [this] { return endpoint_ready || !reader_alive; });
+    if (!endpoint_ready) {
+      cerr << "ERROR: Could not extract message endpoint from SSE stream" << endl;
+      lock.unlock();
+      disconnect();
+      return false;
+    }
+    if (!endpoint) {
+      cerr << "ERROR: Server advertised an unusable message endpoint: " << message_endpoint << endl;
+      lock.unlock();
+      disconnect();
+      return false;
+    }
+    return true;
+  }
+  
+  // Stop the reader thread and close the stream
+  void disconnect() {
+    stop_requested = true;
+#ifdef _WIN32
+    {
+      lock_guard<mutex> lock(state_mutex);
+      if (sse_request) WinHttpCloseHandle(sse_request);  // Unblocks WinHttpReadData
+      sse_request = NULL;
+    }
+#else
+    if (http_pool.multiplexer()) http_pool.multiplexer()->wakeup();
+#endif
+    if (reader_thread.joinable()) reader_thread.join();
+  }
+  
+  // True while the SSE stream is open
+  bool is_alive() const {
+    return reader_alive;
+  }
+  
+  // HTTP status of the SSE GET (0 if the server could not be reached)
+  int http_status() const {
+    return sse_http_status;
+  }
+  
+  // Hand a finished reverse call's buffer back to the SSE reader, which parses the next
+  // event into it instead of allocating a new string
+  void recycle_buffer(string&& buffer) {
+    if (buffer.capacity() > kMaxRecycledBuffer) return;
+    spare_buffers.try_push(buffer);
+  }
+  
+  // Id of the last SSE event received; read it after the stream closed to resume from there
+  string last_event_id() {
+    lock_guard<mutex> lock(state_mutex);
+    return reader_alive ? string() : parser.last_event_id;
+  }
+  
+  // Time since the SSE stream last delivered any bytes (events, responses or keep-alives)
+  chrono::steady_clock::duration idle_for() const {
+    auto last = chrono::steady_clock::duration(last_activity.load(memory_order_relaxed));
+    return chrono::steady_clock::now().time_since_epoch() - last;
+  }
+  
+  // Run hook on the reader thread when the stream closes; call before connect()
+  void set_closed_hook(function<void()> hook) {
+    closed_hook = move(hook);
+  }
+  
+  // Pick the server that call_mcp_tool() sends to (e.g. ServerPool::pick); null keeps calls
+  // on this connection. Call before connect().
+  void set_outbound_router(function<shared_ptr<SSEConnection>()> route) {
+    outbound_router = move(route);
+  }
+  
+  // Record this connection's traffic (see TraceRecorder); call before connect()
+  void set_trace(TraceRecorder* recorder) {
+    trace = recorder;
+  }
+  
+  // Our requests still waiting for a response, and their smoothed round-trip time
+  size_t requests_in_flight() const {
+    return pending_responses.in_flight();
+  }
+  
+  chrono::microseconds response_latency() const {
+    return pending_responses.response_latency();
+  }
+  
+  // Compressed transfers; call before connect(). Anything but OFF accepts a compressed SSE
+  // stream. Request bodies of at least min_bytes are compressed (adaptively, see
+  // AdaptiveCompression) with the encoding chosen from mode and the server's Accept-Encoding.
+  void enable_compression(CompressionMode mode, size_t min_bytes) {
+    compression_mode = mode;
+    http_pool.set_compression_min_bytes(min_bytes);
+    if (mode == CompressionMode::GZIP && !body_encoding_available(BodyEncoding::GZIP)) {
+      LOG(LOG_WARN) << "[WARN] --compress gzip needs a build with -DREVERSE_MCP_ZLIB; bodies are sent uncompressed";
+    } else if (mode == CompressionMode::ZSTD && !body_encoding_available(BodyEncoding::ZSTD)) {
+      LOG(LOG_WARN) << "[WARN] --compress zstd needs a build with -DREVERSE_MCP_ZSTD; bodies are sent uncompressed";
+    }
+  }
+  
+  // Sort incoming reverse calls into lanes; classify(reverse) gets the raw "reverse" object
+  // and runs on the reader thread, so it must be quick. Call before connect(). Without a
+  // classifier every call goes to Lane::NORMAL.
+  void set_lane_classifier(function<Lane(string_view reverse_json)> classify) {
+    lane_classifier = move(classify);
+  }
+  
+  // Call before connect()
+  void set_lane_scheduling(LaneScheduling scheduling, unsigned interactive_weight,
+                           unsigned normal_weight, unsigned batch_weight) {
+    lane_scheduling = scheduling;
+    // Smooth weighted round robin, so the lanes interleave instead of coming in runs
+    unsigned weights[3] = { max(1u, interactive_weight), max(1u, normal_weight), max(1u, batch_weight) };
+    unsigned total = weights[0] + weights[1] + weights[2];
+    int current[3] = {0, 0, 0};
+    lane_schedule.clear();
+    for (unsigned n = 0; n < total; n++) {
+      size_t best = 0;
+      for (size_t i = 0; i < 3; i++) {
+        current[i] += (int)weights[i];
+        if (current[i] > current[best]) best = i;
+      }
+      current[best] -= (int)total;
+      lane_schedule.push_back((Lane)(best + (size_t)Lane::INTERACTIVE));
+    }
+  }
+  
+  // A worker's position in the lane schedule; reserved_only workers serve Lane::RESERVED alone
+  struct LaneCursor {
+    bool reserved_only = false;
+    size_t position = 0;
+  };
+  
+  // Wake one worker that waits for non-reserved calls, e.g. to take over a tool's backlog
+  void wake_reverse_worker() {
+    reverse_not_empty.notify_one();
+  }
+  
+  // Block until a reverse call arrives, the stream dies, or the timeout expires
+  bool wait_for_reverse_call(QueuedReverseCall& message, LaneCursor& cursor, chrono::milliseconds timeout) {
+    EventCount& not_empty = cursor.reserved_only ? reserved_not_empty : reverse_not_empty;
+    if (!pop_reverse_call(message, cursor)) {
+      uint32_t key = not_empty.prepare_wait();
+      if (pop_reverse_call(message, cursor)) {
+        not_empty.cancel_wait();
+        return true;
+      }
+      if (!reader_alive) {
+        not_empty.cancel_wait();
+        return false;
+      }
+      not_empty.wait(key, timeout);
+      if (!pop_reverse_call(message, cursor)) return false;
+    }
+    return true;
+  }
+  
+  // Number of reverse calls waiting for a worker, over all lanes
+  size_t reverse_queue_depth() const {
+    size_t depth = 0;
+    for (const auto& lane : lanes) depth += lane->size_approx();
+    return depth;
+  }
+  
+private:
+  thread reader_thread;
+  atomic<bool> stop_requested{false};
+  atomic<bool> reader_alive{false};
+  atomic<int> sse_http_status{0};
+  atomic<chrono::steady_clock::rep> last_activity{0};
+  function<void()> closed_hook;
+  function<shared_ptr<SSEConnection>()> outbound_router;
+  TraceRecorder* trace = nullptr;
+  CompressionMode compression_mode = CompressionMode::OFF;
+  string server_accept_encoding;  // Accept-Encoding of the SSE response (reader thread only)
+  mutex state_mutex;
+  condition_variable state_cv;
+  bool endpoint_ready = false;
+  SSEParser parser;
+  static constexpr size_t kMaxRecycledBuffer = 64 * 1024;
+  MPMCQueue<string> spare_buffers{64};
+  PendingResponseTable pending_responses;
+  CompletionQueue completions;  // Declared after pending_responses: drained before it is destroyed
+  CompletionQueue error_replies;  // POSTs isError replies for send_error_reply()
+  atomic<size_t> error_replies_queued{0};
+  static constexpr size_t kMaxQueuedErrorReplies = 1024;
+  size_t overload_rejected = 0, overload_shed = 0;  // Since the last summary (reader thread only)
+  chrono::steady_clock::time_point overload_reported;
+  static constexpr chrono::seconds kOverloadReportInterval{1};
+  unique_ptr<MPMCQueue<QueuedReverseCall>> lanes[kLaneCount];
+  function<Lane(string_view)> lane_classifier;
+  LaneScheduling lane_scheduling = LaneScheduling::WEIGHTED;
+  vector<Lane> lane_schedule;
+  EventCount reverse_not_empty;
+  EventCount reserved_not_empty;  // Only reserved-lane workers wait here
+  EventCount reverse_not_full;
+  OverloadPolicy overload_policy = OverloadPolicy::BLOCK;
+  size_t max_in_flight = 0;
+  atomic<size_t> in_flight{0};  // Admitted reverse calls not yet finished
+  QueuedReverseCall incoming;   // Reader-side staging slot for push_reverse_call()
+  mutex cancel_mutex;
+  vector<CallContext*> running_calls;
+  deque<string> cancelled_ids;  // Cancellations for calls not running yet (oldest dropped first)
+  static constexpr size_t kMaxCancelledIds = 256;
+  
+  // Runs on the reader thread for notifications/cancelled
+  void cancel_reverse_call(string_view call_id) {
+    metrics().add(Metrics::CALLS_CANCELLED);
+    LOG(LOG_INFO) << "[CANCEL] Server cancelled call_id " << call_id;
+    lock_guard<mutex> lock(cancel_mutex);
+    for (CallContext* context : running_calls) {
+      if (context->call_id != call_id) continue;
+      context->cancel_flag.store(true, memory_order_release);
+      lock_guard<mutex> wait_lock(context->wait_mutex);
+      if (context->waiting_table) context->waiting_table->fail(context->waiting_request);
+      return;
+    }
+    // Still queued (or already finished): checked when a worker picks it up
+    cancelled_ids.emplace_back(call_id);
+    if (cancelled_ids.size() > kMaxCancelledIds) cancelled_ids.pop_front();
+  }
+  
+  void note_activity() {
+    last_activity.store(chrono::steady_clock::now().time_since_epoch().count(), memory_order_relaxed);
+  }
+  
+  MPMCQueue<QueuedReverseCall>& lane_queue(Lane lane) {
+    return *lanes[(size_t)lane];
+  }
+  
+  bool pop_reverse_call(QueuedReverseCall& message, LaneCursor& cursor) {
+    bool found = lane_queue(Lane::RESERVED).try_pop(message);
+    if (!found && !cursor.reserved_only) {
+      if (lane_scheduling == LaneScheduling::WEIGHTED) {
+        Lane preferred = lane_schedule[cursor.position++ % lane_schedule.size()];
+        found = lane_queue(preferred).try_pop(message);
+      }
+      // Work-conserving: an empty preferred lane falls through to the others by priority
+      for (size_t l = (size_t)Lane::INTERACTIVE; !found && l < kLaneCount; l++) {
+        found = lanes[l]->try_pop(message);
+      }
+    }
+    if (found) reverse_not_full.notify_one();
+    return found;
+  }
+  
+  // Queue the call if it is within both limits; the message is moved only on success
+  bool try_admit(QueuedReverseCall& message) {
+    if (max_in_flight && in_flight.load(memory_order_acquire) >= max_in_flight) return false;
+    in_flight.fetch_add(1, memory_order_acq_rel);  // Before the push: a worker may finish it at once
+    if (!lane_queue(message.lane).try_push(message)) {
+      in_flight.fetch_sub(1, memory_order_acq_rel);
+      return false;
+    }
+    if (message.lane == Lane::RESERVED) reserved_not_empty.notify_one();
+    reverse_not_empty.notify_one();
+    return true;
+  }
+  
+  // Runs on the reader thread; what happens when workers fall behind is up to overload_policy
+  void push_reverse_call(QueuedReverseCall& message) {
+    if (overload_policy != OverloadPolicy::BLOCK) {
+      if (try_admit(message)) return;
+      if (overload_policy == OverloadPolicy::SHED_OLDEST) {
+        // Shed only where it makes room, and never a call more urgent than this one: a full lane
+        // gives up its own oldest call; at max_in_flight, the oldest call of the lowest lane at or
+        // below this call's goes first
+        size_t own = (size_t)message.lane;
+        bool lane_full = lanes[own]->size_approx() >= lanes[own]->capacity();
+        size_t lowest = lane_full ? own + 1 : max_in_flight ? kLaneCount : own;
+        QueuedReverseCall oldest;
+        bool popped = false;
+        for (size_t l = lowest; !popped && l-- > own;) popped = lanes[l]->try_pop(oldest);
+        if (popped) {
+          in_flight.fetch_sub(1, memory_order_acq_rel);
+          send_overload_reply(oldest.message, Metrics::CALLS_SHED);
+          if (try_admit(message)) return;
+        } else if (lowest == own && try_admit(message)) {
+          return;  // Neither limit applies any more: a worker made room meanwhile
+        }
+      }
+      send_overload_reply(message.message, Metrics::CALLS_REJECTED);
+      return;
+    }
+#ifndef _WIN32
+    if (http_pool.multiplexer()) {
+      // The multiplexer thread also carries our tools/reply POSTs, so it must not block here:
+      // park the call and pause the stream (see sse_write_callback / drain_overflow)
+      if (!sse_overflow.empty() || !try_admit(message)) {
+        sse_overflow.push_back(move(message));
+      }
+      return;
+    }
+#endif
+    while (!try_admit(message)) {
+      uint32_t key = reverse_not_full.prepare_wait();
+      if (try_admit(message)) {
+        reverse_not_full.cancel_wait();
+        break;
+      }
+      if (stop_requested) {
+        reverse_not_full.cancel_wait();
+        return;
+      }
+      reverse_not_full.wait(key, chrono::milliseconds(100));
+    }
+  }
+  
+  // Fail a reverse call we will not run, so the server gets an answer now instead of a timeout
+  // Runs on the reader thread, which must keep reading while it sheds load: the reply is sent
+  // elsewhere (see send_error_reply), and each call is only counted - a summary is logged at
+  // most once per kOverloadReportInterval.
+  void send_overload_reply(string_view message, Metrics::Counter counter) {
+    metrics().add(counter);
+    (counter == Metrics::CALLS_SHED ? overload_shed : overload_rejected)++;
+    auto now = chrono::steady_clock::now();
+    if (now - overload_reported >= kOverloadReportInterval) {
+      LOG(LOG_WARN) << "[WARN] Overloaded (" << in_flight.load() << " calls in flight): rejected "
+                    << overload_rejected << ", shed " << overload_shed << " call(s) since the last report";
+      overload_rejected = overload_shed = 0;
+      overload_reported = now;
+    }
+    JsonValue id = JsonReader::get(message, "reverse.call_id");
+    if (!id.is_string()) return;
+    string scratch;
+    send_error_reply(id.as_string(scratch), counter == Metrics::CALLS_SHED
+      ? "Tool provider overloaded: this call waited too long and was dropped for newer calls. Retry later."
+      : "Tool provider overloaded: too many calls in flight. Retry later.");
+  }
+#ifdef _WIN32
+  HINTERNET sse_request = NULL;
+#endif
+  
+  // Route one complete SSE event; runs on the reader thread
+  // A server may answer a batch with a batch, so an array payload is routed element by element
+  void on_sse_event(SSEParser::Event& ev) {
+    metrics().add(Metrics::SSE_EVENTS);
+    if (trace) trace->sse_event(ev.type, ev.id, ev.data);
+    if (ev.type == "endpoint") {
+      lock_guard<mutex> lock(state_mutex);
+      if (!endpoint_ready) {
+        message_endpoint = ev.data;
+        size_t sid = message_endpoint.find("session_id=");
+        if (sid != string::npos) {
+          session_id = message_endpoint.substr(sid + 11, message_endpoint.find('&', sid) - (sid + 11));
+        }
+        BodyEncoding encoding = choose_body_encoding(compression_mode, server_accept_encoding);
+        if (encoding != BodyEncoding::IDENTITY) {
+          LOG(LOG_INFO) << "[OK] Large request bodies will be sent with Content-Encoding: " << body_encoding_name(encoding);
+        }
+        endpoint = MessageEndpoint::resolve(server_url, message_endpoint, auth_header, http_pool.http2_enabled(),
+                                            local_socket, encoding);
+        endpoint_ready = true;
+        state_cv.notify_all();
+      }
+      return;
+    }
+    
+    size_t first = ev.data.find_first_not_of(" \t\r\n");
+    if (first != string::npos && ev.data[first] == '[') {
+      JsonReader::for_each_element(ev.data, [this](const JsonValue& element) {
+        string message(element.raw);
+        route_message(message);
+      });
+      return;
+    }
+    route_message(ev.data);
+    if (ev.data.capacity() < 256) spare_buffers.try_pop(ev.data);  // It was moved out; reuse a spare
+  }
+  
+  void route_message(string& message) {
+    // One pass over the message finds all routing keys
+    JsonReader::Field fields[3] = { JsonReader::Field("reverse"), JsonReader::Field("id"), JsonReader::Field("method") };
+    JsonReader::extract(message, fields, 3);
+    
+    if (fields[0].value.is_object()) {
+      // Reverse tool call - hand it to the dispatcher; on success the buffer moves with it
+      metrics().add(Metrics::REVERSE_CALLS);
+      incoming.message.swap(message);
+      incoming.received = chrono::steady_clock::now();
+      incoming.lane = lane_classifier ? lane_classifier(fields[0].value.raw) : Lane::NORMAL;
+      push_reverse_call(incoming);
+      message.swap(incoming.message);
+      return;
+    }
+    
+    // Response to one of our own requests - wake whoever is waiting on that id
+    if (fields[1].value.found()) {
+      string scratch;
+      string request_id(fields[1].value.is_string() ? fields[1].value.as_string(scratch) : fields[1].value.raw);
+      pending_responses.complete(request_id, move(message));
+      return;
+    }
+    
+    if (fields[2].value.is_string() && fields[2].value.raw == "notifications/cancelled") {
+      JsonValue id = JsonReader::get(message, "params.requestId");
+      string scratch;
+      if (id.found()) cancel_reverse_call(id.is_string() ? id.as_string(scratch) : id.raw);
+    }
+  }
+  
+  void mark_reader_stopped() {
+    {
+      lock_guard<mutex> lock(state_mutex);
+      reader_alive = false;
+    }
+    state_cv.notify_all();
+    if (closed_hook) closed_hook();
+    pending_responses.fail_all();
+    reverse_not_empty.notify_all();
+    reserved_not_empty.notify_all();
+  }
+  
+#ifdef _WIN32
+  void reader_thread_function() {
+    wstring wide_url(server_url.begin(), server_url.end());
+    URL_COMPONENTS urlComp = { 0 };
+    urlComp.dwStructSize = sizeof(urlComp);
+    wchar_t host[256], path[1024];
+    urlComp.lpszHostName = host;
+    urlComp.dwHostNameLength = sizeof(host) / sizeof(host[0]);
+    urlComp.lpszUrlPath = path;
+    urlComp.dwUrlPathLength = sizeof(path) / sizeof(path[0]);
+    
+    HINTERNET hSession = NULL, hConnect = NULL, hRequest = NULL;
+    bool shared = http_pool.http2_enabled();
+    if (!WinHttpCrackUrl(wide_url.c_str(), 0, 0, &urlComp)) {
+      // Leave every handle NULL
+    } else if (shared) {
+      // HTTP/2: open the stream on the pool's session so it shares the POSTs' connection
+      hConnect = http_pool.shared_connect_handle(host, urlComp.nPort);
+    } else {
+      hSession = WinHttpOpen(L"MCP Client/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                             WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+      if (hSession) hConnect = WinHttpConnect(hSession, host, urlComp.nPort, 0);
+    }
+    if (hConnect) {
+      DWORD flags = (urlComp.nScheme == INTERNET_SCHEME_HTTPS) ? WINHTTP_FLAG_SECURE : 0;
+      hRequest = WinHttpOpenRequest(hConnect, L"GET", path, NULL, WINHTTP_NO_REFERER,
+                                    WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
+    }
+    
+    if (hRequest) {
+      DWORD security_flags = SECURITY_FLAG_IGNORE_UNKNOWN_CA |
+                             SECURITY_FLAG_IGNORE_CERT_DATE_INVALID |
+                             SECURITY_FLAG_IGNORE_CERT_CN_INVALID |
+                             SECURITY_FLAG_IGNORE_CERT_WRONG_USAGE;
+      WinHttpSetOption(hRequest, WINHTTP_OPTION_SECURITY_FLAGS, &security_flags, sizeof(security_flags));
+#ifdef WINHTTP_OPTION_DECOMPRESSION
+      if (compression_mode != CompressionMode::OFF) {
+        // Windows 8.1+: WinHTTP sends Accept-Encoding and inflates a gzip/deflate stream
+        DWORD decompression = WINHTTP_DECOMPRESSION_FLAG_ALL;
+        WinHttpSetOption(hRequest, WINHTTP_OPTION_DECOMPRESSION, &decompression, sizeof(decompression));
+      }
+#endif
+      {
+        lock_guard<mutex> lock(state_mutex);
+        sse_request = hRequest;
+      }
+      
+      string header_block = "Accept: text/event-stream\r\nCache-Control: no-cache\r\nAuthorization: " + auth_header;
+      if (!resume_event_id.empty()) header_block += "\r\nLast-Event-ID: " + resume_event_id;
+      wstring wide_headers(header_block.begin(), header_block.end());
+      DWORD status_code = 0;
+      DWORD size = sizeof(status_code);
+      if (WinHttpSendRequest(hRequest, wide_headers.c_str(), (DWORD)-1L, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) &&
+          WinHttpReceiveResponse(hRequest, NULL) &&
+          WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                              NULL, &status_code, &size, NULL) &&
+          (sse_http_status = (int)status_code) == 200) {
+        wchar_t accept[256];
+        DWORD accept_size = sizeof(accept);
+        if (WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CUSTOM, L"Accept-Encoding", accept, &accept_size,
+                                WINHTTP_NO_HEADER_INDEX)) {
+          wstring wide(accept, accept_size / sizeof(wchar_t));
+          server_accept_encoding.assign(wide.begin(), wide.end());
+        }
+        char buffer[16 * 1024];
+        while (!stop_requested) {
+          DWORD read = 0;
+          if (!WinHttpReadData(hRequest, buffer, sizeof(buffer), &read) || read == 0) break;
+          note_activity();
+          metrics().add(Metrics::BYTES_IN, read);
+          parser.feed(buffer, read, [this](SSEParser::Event& ev) { on_sse_event(ev); });
+        }
+      } else if (!stop_requested) {
+        cerr << "ERROR: SSE connection failed (HTTP status " << status_code << ")" << endl;
+      }
+      
+      lock_guard<mutex> lock(state_mutex);
+      if (sse_request) WinHttpCloseHandle(sse_request);
+      sse_request = NULL;
+    }
+    if (hConnect && !shared) WinHttpCloseHandle(hConnect);  // The pool owns a shared handle
+    if (hSession) WinHttpCloseHandle(hSession);
+    mark_reader_stopped();
+  }
+#else
+  CURL* sse_curl = NULL;
+  deque<QueuedReverseCall> sse_overflow;  // Reverse calls waiting for queue space (multiplexed mode only)
+  
+  static size_t sse_write_callback(char* data, size_t size, size_t nmemb, void* userp) {
+    SSEConnection* self = static_cast<SSEConnection*>(userp);
+    size_t total = size * nmemb;
+    if (self->stop_requested) return 0;
+    self->note_activity();
+    metrics().add(Metrics::BYTES_IN, total);
+    self->parser.feed(data, total, [self](SSEParser::Event& ev) { self->on_sse_event(ev); });
+    if (!self->sse_overflow.empty()) CurlMultiplexer::pause(self->sse_curl);
+    return total;
+  }
+  
+  // Remembers the response's Accept-Encoding: what the server takes in request bodies
+  static size_t sse_header_callback(char* data, size_t size, size_t nitems, void* userp) {
+    SSEConnection* self = static_cast<SSEConnection*>(userp);
+    size_t total = size * nitems;
+    string_view line(data, total);
+    static const char kName[] = "accept-encoding:";
+    if (line.compare(0, 5, "HTTP/") == 0) {
+      self->server_accept_encoding.clear();  // A new response (redirect or 100 Continue first)
+    } else if (line.size() > sizeof(kName) - 1 &&
+               equal(kName, kName + sizeof(kName) - 1, line.begin(), [](char a, char b) { return a == tolower(b); })) {
+      string_view value = line.substr(sizeof(kName) - 1);
+      size_t first = value.find_first_not_of(" \t");
+      size_t last = value.find_last_not_of(" \t\r\n");
+      if (first != string_view::npos) self->server_accept_encoding.assign(value.substr(first, last - first + 1));
+    }
+    return total;
+  }
+  
+  // Multiplexer resume hook: true once every parked reverse call made it into the queue
+  bool drain_overflow() {
+    while (!sse_overflow.empty()) {
+      if (stop_requested) return true;
+      if (!try_admit(sse_overflow.front())) return false;
+      sse_overflow.pop_front();
+    }
+    return true;
+  }
+  
+  // Lets curl_easy_perform return promptly once disconnect() is called
+  static int sse_progress_callback(void* userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    return static_cast<SSEConnection*>(userp)->stop_requested ? 1 : 0;
+  }
+  
+  void reader_thread_function() {
+    CURL* curl = curl_easy_init();
+    if (!curl) {
+      mark_reader_stopped();
+      return;
+    }
+    
+    struct curl_slist* headers = NULL;
+    headers = curl_slist_append(headers, "Accept: text/event-stream");
+    headers = curl_slist_append(headers, "Cache-Control: no-cache");
+    headers = curl_slist_append(headers, ("Authorization: " + auth_header).c_str());
+    if (!resume_event_id.empty()) {
+      headers = curl_slist_append(headers, ("Last-Event-ID: " + resume_event_id).c_str());
+    }
+    
+    string url = server_url;
+#if LIBCURL_VERSION_NUM >= 0x072800
+    if (!local_socket.empty()) {
+      url = MessageEndpoint::local_socket_url(server_url);
+      curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, local_socket.c_str());
+    }
+#endif
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    if (compression_mode != CompressionMode::OFF) {
+      curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");  // Every encoding this libcurl can decode
+      curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, sse_header_callback);
+      curl_easy_setopt(curl, CURLOPT_HEADERDATA, this);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, sse_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, sse_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    
+    CURLcode res;
+    if (CurlMultiplexer* mux = http_pool.multiplexer()) {
+      // Join the POSTs' connection as one more HTTP/2 stream
+      http_pool.configure_shared_handle(curl);
+      sse_curl = curl;
+      res = mux->perform(curl, [this] { return drain_overflow(); });
+      sse_curl = NULL;
+      sse_overflow.clear();
+    } else {
+      res = curl_easy_perform(curl);
+    }
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    sse_http_status = (int)response_code;
+    if (!stop_requested) {
+      LOG(LOG_WARN) << "[WARN] SSE stream ended: " << curl_easy_strerror(res)
+                    << " (HTTP status " << response_code << ")";
+    }
+    
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    mark_reader_stopped();
+  }
+#endif
+  
+public:
+  // POST a JSON-RPC request without waiting; call wait() on the result to get the
+  // response that the server delivers over the SSE stream.
+  // write_params(JsonWriter&) serializes the params value straight into the send buffer.
+  template <typename WriteParams>
+  PendingRequest start_request_with(string_view method, WriteParams&& write_params) {
+    if (!reader_alive) return PendingRequest();
+    PendingRequest pending(&pending_responses, RequestIdGenerator::next());
+    
+    string& body = thread_send_buffer();
+    JsonWriter w(body);
+    w.raw("{\"jsonrpc\":\"2.0\",\"id\":\"").raw(pending.request_id())  // Ids never need escaping
+     .raw("\",\"method\":").str(method)
+     .raw(",\"params\":");
+    write_params(w);
+    w.raw('}');
+    if (trace) trace->outbound(body);
+    
+    if (http_pool.event_loop_enabled() && !batcher) {
+      // Don't hold this thread for the 202: a rejected POST fails the pending slot instead
+      http_pool.post_async(endpoint, body, [this, id = pending.request_id()](bool accepted) {
+        if (!accepted) pending_responses.fail(id);
+      });
+    } else if (!post_message(body)) {
+      pending.reset();
+    }
+    return pending;
+  }
+  
+  PendingRequest start_request(const string& method, const string& params_json) {
+    return start_request_with(method, [&](JsonWriter& w) { w.raw(params_json); });
+  }
+  
+  // Block until the response for a started request arrives
+  // Returns the full response message, or "" on POST failure, timeout or disconnect
+  // From a handler, the wait ends early when the reverse call runs out of time or is cancelled.
+  string wait_response(PendingRequest& pending, string_view method, chrono::milliseconds timeout) {
+    string response;
+    if (!pending.valid()) return "";
+    CallContext* context = t_call_context;
+    if (context) timeout = context->begin_wait(pending, timeout);
+    bool ok = pending.wait(response, timeout);
+    if (context) context->end_wait();
+    if (!ok) {
+      if (context && context->cancelled()) {
+        LOG(LOG_DEBUG) << "[CANCEL] Abandoned " << method << " - the reverse call was cancelled";
+      } else {
+        cerr << "ERROR: Timeout waiting for response to " << method << endl;
+      }
+      return "";
+    }
+    return response;
+  }
+  
+  // Send a JSON-RPC request and block until its response arrives via SSE
+  string send_request(const string& method, const string& params_json,
+                      chrono::milliseconds timeout = chrono::seconds(10)) {
+    PendingRequest pending = start_request(method, params_json);
+    return wait_response(pending, method, timeout);
+  }
+  
+  // Send a reply built with StreamingReply; blocks until the body has been sent and accepted
+  // Bypasses the batcher: large payloads gain nothing from coalescing.
+  void send_tool_reply(StreamingReply& reply) {
+    if (t_call_context && t_call_context->cancelled()) return;  // Nobody is waiting for it any more
+    if (!http_pool.post_stream(*endpoint, reply).empty()) {
+      metrics().add(Metrics::REPLIES_SENT);
+      if (trace) trace->outbound_streamed(reply.bytes_sent());
+      LOG(LOG_DEBUG) << "[OK] Sent streamed tools/reply (" << reply.bytes_sent() << " bytes)";
+    } else if (reply.failed()) {
+      cerr << "ERROR: Streamed tools/reply aborted - a content source ended early" << endl;
+    }
+  }
+  
+  void send_tool_reply(string_view call_id, string_view result_json) {
+    if (t_call_context && t_call_context->cancelled() && t_call_context->call_id == call_id) {
+      LOG(LOG_DEBUG) << "[CANCEL] Dropped tools/reply for cancelled call_id " << call_id;
+      return;
+    }
+    string& body = thread_send_buffer();
+    JsonWriter w(body);
+    w.raw("{\"jsonrpc\":\"2.0\",\"id\":").str(call_id)
+     .raw(",\"method\":\"tools/reply\",\"params\":{\"result\":").raw(result_json)
+     .raw("}}");
+    if (trace) trace->outbound(body);
+    
+    if (http_pool.event_loop_enabled() && !batcher) {
+      // Fire and forget: the worker moves on to its next call while the 202 is outstanding
+      http_pool.post_async(endpoint, body, [id = string(call_id)](bool accepted) {
+        if (!accepted) return;
+        metrics().add(Metrics::REPLIES_SENT);
+        LOG(LOG_DEBUG) << "[OK] Sent tools/reply for call_id " << id;
+      });
+    } else if (post_message(body)) {
+      metrics().add(Metrics::REPLIES_SENT);
+      LOG(LOG_DEBUG) << "[OK] Sent tools/reply for call_id " << call_id;
+    }
+  }
+  
+  // Call another MCP tool on the server
+  // This demonstrates how to call other MCP tools from within your remote tool handler
+  // Returns the JSON-RPC response ({"result":{"content":[...]}} or {"error":...}), "" on failure
+  // Calls allowed by allow_result_caching() may be answered from the result cache, in which case
+  // the response's "id" is that of the request that fetched it.
+  string call_mcp_tool(const string& tool_name, const string& arguments_json,
+                       chrono::milliseconds timeout = chrono::seconds(30)) {
+    string key;
+    if (result_cache && result_cache->cache_key(tool_name, arguments_json, key)) {
+      return result_cache->get_or_fetch(key, timeout, [&] { return call_mcp_tool_uncached(tool_name, arguments_json, timeout); });
+    }
+    return call_mcp_tool_uncached(tool_name, arguments_json, timeout);
+  }
+  
+  // Same, bypassing the result cache
+  // With an outbound router set, the call goes to whichever server it picks.
+  string call_mcp_tool_uncached(const string& tool_name, const string& arguments_json,
+                                chrono::milliseconds timeout = chrono::seconds(30)) {
+    if (outbound_router) {
+      shared_ptr<SSEConnection> target = outbound_router();
+      if (target && target.get() != this) return target->call_mcp_tool_here(tool_name, arguments_json, timeout);
+    }
+    return call_mcp_tool_here(tool_name, arguments_json, timeout);
+  }
+  
+  // Same, always on this connection
+  string call_mcp_tool_here(const string& tool_name, const string& arguments_json,
+                            chrono::milliseconds timeout = chrono::seconds(30)) {
+    PendingRequest pending = start_request_with("tools/call", [&](JsonWriter& w) {
+      w.raw("{\"name\":").str(tool_name).raw(",\"arguments\":").raw(arguments_json).raw('}');
+    });
+    return wait_response(pending, "tools/call", timeout);
+  }
+  
+  // Start a tool call without waiting for it, so a handler can run several in parallel:
+  //   auto a = conn.call_mcp_tool_async("sqlite", q1), b = conn.call_mcp_tool_async("sqlite", q2);
+  //   string ra = a.get(), rb = b.get();   // or when_all(), then(), co_await
+  ToolCallFuture call_mcp_tool_async(const string& tool_name, const string& arguments_json) {
+    PendingRequest pending = start_request_with("tools/call", [&](JsonWriter& w) {
+      w.raw("{\"name\":").str(tool_name).raw(",\"arguments\":").raw(arguments_json).raw('}');
+    });
+    return ToolCallFuture(move(pending), &completions);
+  }
+  
+private:
+  // Set once by the endpoint event, before connect() returns; read without a lock afterwards.
+  // Declared before batcher, whose sender uses it until the batcher is destroyed.
+  shared_ptr<const MessageEndpoint> endpoint;
+  unique_ptr<MessageBatcher> batcher;
+  unique_ptr<ToolResultCache> result_cache;
+  
+  // POST one JSON-RPC message, through the batcher when enabled
+  bool post_message(string_view body) {
+    if (batcher) return batcher->submit(body);
+    return !http_pool.post(*endpoint, body).empty();
+  }
+};
+
+// A reverse tool call from the server, parsed once when a worker picks it up
+// Format: {"reverse":{"tool":"...","call_id":"...","input":{...}}}
+// The views point into raw, so a ReverseCall must not be copied or moved after parse().
+// arena is the worker's per-call memory: allocate the handler's temporaries from it (e.g.
+// pmr::string s(call.arena)) and they are all freed at once when the handler returns.
+// Long-running handlers should check cancelled() (or remaining()) between steps.
+struct ReverseCall {
+  string raw;
+  string_view tool;
+  string_view call_id;
+  string_view input;   // Raw JSON of the input object
+  string tool_scratch, call_id_scratch;
+  pmr::memory_resource* arena = pmr::get_default_resource();
+  chrono::steady_clock::time_point received;  // When the SSE reader got the call
+  const CallContext* context = nullptr;       // Set by the dispatcher while the handler runs
+  
+  bool cancelled() const {
+    return context && context->cancelled();
+  }
+  
+  // Time left before the call's deadline (max() without one)
+  chrono::milliseconds remaining() const {
+    return context ? context->remaining() : chrono::milliseconds::max();
+  }
+  
+  ReverseCall() = default;
+  ReverseCall(const ReverseCall&) = delete;
+  ReverseCall& operator=(const ReverseCall&) = delete;
+  
+  bool parse() {
+    JsonReader::Field fields[3] = {
+      JsonReader::Field("reverse.tool"),
+      JsonReader::Field("reverse.call_id"),
+      JsonReader::Field("reverse.input"),
+    };
+    if (!JsonReader::extract(raw, fields, 3)) return false;
+    tool = fields[0].value.as_string(tool_scratch);
+    call_id = fields[1].value.as_string(call_id_scratch);
+    input = fields[2].value.raw;
+    return !tool.empty() && !call_id.empty();
+  }
+  
+  // Tool arguments live at input.params.arguments (fall back to input itself)
+  JsonValue argument(string_view name) const {
+    JsonReader::Field fields[2] = { JsonReader::Field("params.arguments"), JsonReader::Field(name) };
+    JsonReader::extract(input, fields, 2);
+    if (fields[0].value.is_object()) return JsonReader::get(fields[0].value.raw, name);
+    return fields[1].value;
+  }
+  
+  // String argument with escapes decoded, allocated in the call's arena ("" if absent)
+  pmr::string argument_string(string_view name) const {
+    pmr::string out(arena);
+    JsonValue value = argument(name);
+    if (!value.is_string()) return out;
+    if (value.has_escapes) {
+      JsonReader::unescape(value.raw, out);
+    } else {
+      out.assign(value.raw.data(), value.raw.size());
+    }
+    return out;
+  }
+};
+
+// Runs reverse tool calls on a pool of worker threads
+// Each worker pulls the next call from the connection's lane queues, runs the handler and
+// posts its tools/reply independently, so one slow handler never holds up the calls behind it.
+// Tools whose handlers are not thread-safe (e.g. code running inside Blender or Fusion 360)
+// can be limited with set_tool_concurrency(); excess calls for that tool wait in a per-tool
+// backlog without occupying a worker, one queue per lane, so a tool's RESERVED and INTERACTIVE
+// calls still go ahead of its BATCH calls.
+class ReverseCallDispatcher {
+public:
+  using Handler = function<void(SSEConnection& conn, const ReverseCall& call)>;
+  
+  ReverseCallDispatcher(SSEConnection& conn, Handler handler, size_t worker_count = 4)
+    : conn(conn), handler(move(handler)), worker_count(worker_count ? worker_count : 1) {}
+  
+  ~ReverseCallDispatcher() {
+    stop();
+  }
+  
+  // Budget for each call, counted from when it arrived (0 = no deadline); call before start().
+  // Calls that are still queued when it runs out are dropped without running the handler.
+  void set_call_timeout(chrono::milliseconds timeout) {
+    call_timeout = timeout;
+  }
+  
+  // Limit how many calls to tool_name may run at once (0 = unlimited)
+  void set_tool_concurrency(const string& tool_name, size_t max_concurrent) {
+    lock_guard<mutex> lock(limits_mutex);
+    limits[tool_name].max_concurrent = max_concurrent;
+  }
+  
+  // Extra workers that only run Lane::RESERVED calls (default 1); call before start()
+  void set_reserved_workers(size_t count) {
+    reserved_workers = count;
+  }
+  
+  void start() {
+    stopping = false;
+    for (size_t i = 0; i < worker_count + reserved_workers; i++) {
+      workers.emplace_back(&ReverseCallDispatcher::worker_loop, this, i >= worker_count);
+    }
+  }
+  
+  // Workers finish their current call and exit; calls still in a tool's backlog are answered
+  // with an isError reply rather than left for the server to time out
+  void stop() {
+    stopping = true;
+    for (auto& t : workers) {
+      if (t.joinable()) t.join();
+    }
+    workers.clear();
+    vector<QueuedReverseCall> declined;
+    {
+      lock_guard<mutex> lock(limits_mutex);
+      for (auto& kv : limits) {
+        for (auto& backlog : kv.second.backlog) {
+          for (; !backlog.empty(); backlog.pop()) declined.push_back(move(backlog.front()));
+        }
+      }
+    }
+    for (QueuedReverseCall& call : declined) conn.decline_reverse_call(call.message);
+  }
+  
+private:
+  struct ToolLimit {
+    size_t max_concurrent = 0;
+    size_t running = 0;
+    queue<QueuedReverseCall> backlog[kLaneCount];  // Indexed by Lane
+  };
+  
+  SSEConnection& conn;
+  Handler handler;
+  size_t worker_count;
+  size_t reserved_workers = 1;
+  vector<thread> workers;
+  atomic<bool> stopping{false};
+  mutex limits_mutex;
+  map<string, ToolLimit, less<>> limits;  // Transparent: looked up by string_view
+  deque<string> handoffs;                 // Tools whose slot a reserved worker passed on
+  atomic<size_t> handoff_count{0};        // handoffs.size(), read without the lock
+  chrono::milliseconds call_timeout{0};
+  
+  // Each worker owns one arena; every call allocates from it and it is reset in one step after
+  // the handler (and so its tools/reply) is done. Together with the recycled message buffers
+  // and the per-thread send/log buffers, a call does not touch the global heap once warm.
+  void worker_loop(bool reserved_only) {
+    vector<char> arena_buffer(kArenaBytes);
+    pmr::monotonic_buffer_resource arena(arena_buffer.data(), arena_buffer.size());
+    ReverseCall call;  // Reused so its scratch strings keep their capacity
+    call.arena = &arena;
+    CallContext context;
+    call.context = &context;
+    QueuedReverseCall next;
+    SSEConnection::LaneCursor cursor;
+    cursor.reserved_only = reserved_only;
+    
+    while (!stopping) {
+      // A backlogged call handed over by a reserved worker comes with its tool slot
+      bool handed_over = !reserved_only && take_handoff(next);
+      if (!handed_over && !conn.wait_for_reverse_call(next, cursor, chrono::milliseconds(200))) {
+        if (!conn.is_alive()) break;
+        continue;
+      }
+      
+      t_alloc_dispatch = true;
+      call.raw.swap(next.message);
+      call.received = next.received;
+      if (!call.parse()) {
+        LOG(LOG_WARN) << "[WARN] Ignoring malformed reverse call";
+        conn.reverse_call_finished();
+        t_alloc_dispatch = false;
+        continue;
+      }
+      if (!handed_over && !try_acquire(call, next.lane)) {  // Parked in the tool's backlog
+        t_alloc_dispatch = false;
+        continue;
+      }
+      
+      // Keep the tool slot while draining calls that queued up behind the limit
+      for (;;) {
+        run(call, context);
+        arena.release();
+        conn.reverse_call_finished();
+        if (!next_from_backlog(call.tool, next, reserved_only)) break;
+        call.raw.swap(next.message);
+        call.received = next.received;
+        conn.recycle_buffer(move(next.message));
+        next.message.clear();
+        call.parse();
+      }
+      conn.recycle_buffer(move(call.raw));
+      call.raw.clear();
+      t_alloc_dispatch = false;
+    }
+  }
+  
+  static constexpr size_t kArenaBytes = 64 * 1024;  // Larger calls spill over to the heap
+  
+  // Run the handler unless the call expired while it waited or was cancelled before starting
+  void run(ReverseCall& call, CallContext& context) {
+    auto deadline = CallContext::Clock::time_point::max();
+    if (call_timeout.count() > 0) {
+      deadline = call.received + call_timeout;
+      if (deadline <= CallContext::Clock::now()) {
+        metrics().add(Metrics::CALLS_EXPIRED);
+        LOG(LOG_WARN) << "[WARN] Dropped call_id " << call.call_id << ": its deadline passed while it was queued";
+        return;
+      }
+    }
+    if (!conn.begin_call(context, call.call_id, deadline)) {
+      LOG(LOG_INFO) << "[CANCEL] Dropped queued call_id " << call.call_id;
+      return;
+    }
+    t_call_context = &context;
+    {
+      ScopedTimer timer(Metrics::HANDLER_TIME);
+      handler(conn, call);
+    }
+    t_call_context = nullptr;
+    conn.end_call(context);
+  }
+  
+  bool try_acquire(ReverseCall& call, Lane lane) {
+    lock_guard<mutex> lock(limits_mutex);
+    auto it = limits.find(call.tool);
+    if (it == limits.end() || it->second.max_concurrent == 0) return true;
+    ToolLimit& limit = it->second;
+    if (limit.running >= limit.max_concurrent) {
+      limit.backlog[(size_t)lane].push(QueuedReverseCall{move(call.raw), call.received, lane});
+      return false;
+    }
+    limit.running++;
+    return true;
+  }
+  
+  // Called after a call finishes: hands over the next backlogged call, highest lane first, or
+  // releases the slot. A reserved worker only takes RESERVED calls; if other lanes still have
+  // some, it passes the slot to a normal worker instead (see take_handoff).
+  bool next_from_backlog(string_view tool_name, QueuedReverseCall& message, bool reserved_only) {
+    lock_guard<mutex> lock(limits_mutex);
+    auto it = limits.find(tool_name);
+    if (it == limits.end() || it->second.max_concurrent == 0) return false;
+    ToolLimit& limit = it->second;
+    if (!stopping) {
+      if (pop_backlog(limit, reserved_only ? 1 : kLaneCount, message)) return true;
+      if (reserved_only && has_backlog(limit)) {
+        handoffs.emplace_back(tool_name);
+        handoff_count.fetch_add(1, memory_order_release);
+        conn.wake_reverse_worker();
+        return false;
+      }
+    }
+    limit.running--;
+    return false;
+  }
+  
+  // Take over a tool slot a reserved worker passed on, with the first call of its backlog
+  bool take_handoff(QueuedReverseCall& message) {
+    if (handoff_count.load(memory_order_acquire) == 0) return false;
+    lock_guard<mutex> lock(limits_mutex);
+    while (!handoffs.empty()) {
+      auto it = limits.find(handoffs.front());
+      handoffs.pop_front();
+      handoff_count.fetch_sub(1, memory_order_release);
+      if (pop_backlog(it->second, kLaneCount, message)) return true;
+      it->second.running--;
+    }
+    return false;
+  }
+  
+  static bool has_backlog(const ToolLimit& limit) {
+    for (const auto& backlog : limit.backlog) {
+      if (!backlog.empty()) return true;
+    }
+    return false;
+  }
+  
+  // Move the oldest call of the highest non-empty lane below lane_count out of the backlog
+  static bool pop_backlog(ToolLimit& limit, size_t lane_count, QueuedReverseCall& message) {
+    for (size_t l = 0; l < lane_count; l++) {
+      auto& backlog = limit.backlog[l];
+      if (backlog.empty()) continue;
+      message = move(backlog.front());
+      backlog.pop();
+      return true;
+    }
+    return false;
+  }
+};
+
+// The tools this process provides, each with its own handler and schema
+// Registration payloads are serialized once, when a tool is added, and re-sent verbatim on
+// every (re)connect. Reverse calls are routed through an open-addressing table of FNV-1a
+// hashes built at add() time, so dispatch is one hash of the incoming string_view plus
+// (almost always) one comparison - no allocation, no scan over tool names.
+// Add every tool before the dispatcher starts; the registry is read-only after that.
+class ToolRegistry {
+public:
+  using Handler = ReverseCallDispatcher::Handler;
+  
+  struct ToolSpec {
+    string name;
+    string description;
+    string readme;
+    string parameters_json = R"({"type":"object","properties":{}})";  // JSON Schema of the arguments
+    string callback_endpoint;
+    string api_key;                // Sent as TOOL_API_KEY
+    size_t max_concurrent = 0;     // Dispatcher concurrency limit for this tool (0 = unlimited)
+    Lane lane = Lane::NORMAL;      // Priority class of this tool's calls
+    map<string, Lane, less<>> operation_lanes;  // Per-call override, keyed on the "operation" argument
+  };
+  
+  struct Tool {
+    ToolSpec spec;
+    Handler handler;
+    uint64_t name_hash = 0;
+    string register_params;  // Pre-serialized tools/call params for "remote" register
+  };
+  
+  // Add a tool; false if the name is empty or already taken
+  bool add(ToolSpec spec, Handler handler) {
+    if (spec.name.empty() || find(spec.name)) return false;
+    Tool tool;
+    tool.name_hash = hash_name(spec.name);
+    JsonWriter w(tool.register_params);
+    w.raw("{\"name\":\"remote\",\"arguments\":{\"input\":{\"operation\":\"register\",\"tool_name\":").str(spec.name)
+     .raw(",\"readme\":").str(spec.readme)
+     .raw(",\"description\":").str(spec.description)
+     .raw(",\"parameters\":").raw(spec.parameters_json)
+     .raw(",\"callback_endpoint\":").str(spec.callback_endpoint)
+     .raw(",\"TOOL_API_KEY\":").str(spec.api_key)
+     .raw("}}}");
+    tool.spec = move(spec);
+    tool.handler = move(handler);
+    tools.push_back(move(tool));
+    rebuild_index();
+    return true;
+  }
+  
+  const Tool* find(string_view name) const {
+    if (index.empty()) return nullptr;
+    uint64_t h = hash_name(name);
+    size_t mask = index.size() - 1;
+    for (size_t i = (size_t)h & mask;; i = (i + 1) & mask) {
+      int32_t slot = index[i];
+      if (slot < 0) return nullptr;
+      const Tool& tool = tools[(size_t)slot];
+      if (tool.name_hash == h && tool.spec.name == name) return &tool;
+    }
+  }
+  
+  size_t size() const {
+    return tools.size();
+  }
+  
+  const vector<Tool>& all() const {
+    return tools;
+  }
+  
+  // Route a reverse call to its tool's handler (suitable as the dispatcher's Handler)
+  void dispatch(SSEConnection& conn, const ReverseCall& call) const {
+    LOG(LOG_DEBUG) << "\n[CALL] Reverse call received:\n"
+                   << "       Tool: " << call.tool << "\n"
+                   << "       Call ID: " << call.call_id;
+    const Tool* tool = find(call.tool);
+    if (!tool) {
+      LOG(LOG_WARN) << "[WARN] Unknown tool: " << call.tool;
+      string text("Unknown tool: ");
+      text.append(call.tool.data(), call.tool.size());
+      conn.send_error_reply(call.call_id, text);
+      return;
+    }
+    tool->handler(conn, call);
+  }
+  
+  // Lane of a reverse call (suitable as the connection's lane classifier)
+  Lane lane_for(string_view reverse_json) const {
+    JsonReader::Field fields[3] = { JsonReader::Field("tool"), JsonReader::Field("input.params.arguments.operation"),
+                                    JsonReader::Field("input.operation") };
+    JsonReader::extract(reverse_json, fields, 3);
+    string scratch;
+    const Tool* tool = find(fields[0].value.as_string(scratch));
+    if (!tool) return Lane::NORMAL;
+    if (!tool->spec.operation_lanes.empty()) {
+      const JsonValue& operation = fields[1].value.found() ? fields[1].value : fields[2].value;
+      auto it = tool->spec.operation_lanes.find(operation.as_string(scratch));
+      if (it != tool->spec.operation_lanes.end()) return it->second;
+    }
+    return tool->spec.lane;
+  }
+  
+  void apply_concurrency_limits(ReverseCallDispatcher& dispatcher) const {
+    for (const Tool& tool : tools) {
+      if (tool.spec.max_concurrent) dispatcher.set_tool_concurrency(tool.spec.name, tool.spec.max_concurrent);
+    }
+  }
+  
+  // Send every tool's pre-serialized registration; false if any is rejected
+  // All requests are in flight at once, so registering N tools costs about one round trip.
+  bool register_all(SSEConnection& conn) const {
+    vector<PendingRequest> pending;
+    pending.reserve(tools.size());
+    for (const Tool& tool : tools) pending.push_back(conn.start_request("tools/call", tool.register_params));
+    
+    bool all_ok = true;
+    for (size_t i = 0; i < tools.size(); i++) {
+      string result = conn.wait_response(pending[i], "tools/call", chrono::seconds(10));
+      if (result.empty() || result.find("Successfully registered tool") == string::npos) {
+        cerr << "ERROR: Registration failed for " << tools[i].spec.name << endl;
+        if (!result.empty()) cerr << "       Response: " << result << endl;
+        all_ok = false;
+        continue;
+      }
+      cerr << "[OK] Successfully registered tool: " << tools[i].spec.name << endl;
+    }
+    return all_ok;
+  }
+  
+private:
+  vector<Tool> tools;
+  vector<int32_t> index;  // Power-of-two open-addressing table of indices into tools (-1 = empty)
+  
+  static uint64_t hash_name(string_view name) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a 64
+    for (unsigned char c : name) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+  
+  // Kept at most half full so probe sequences stay short
+  void rebuild_index() {
+    size_t capacity = 8;
+    while (capacity < tools.size() * 2) capacity <<= 1;
+    index.assign(capacity, -1);
+    for (size_t t = 0; t < tools.size(); t++) {
+      size_t i = (size_t)tools[t].name_hash & (capacity - 1);
+      while (index[i] >= 0) i = (i + 1) & (capacity - 1);
+      index[i] = (int32_t)t;
+    }
+  }
+};
+
+// Case-insensitive multi-keyword matcher for routing free-text commands
+// All keywords are compiled into one Aho-Corasick automaton, stored as a dense DFA over byte
+// classes (bytes that occur in no keyword share class 0), so matching is a single pass over
+// the original text - one table lookup per byte, no lowercase copy and no allocation -
+// however many commands are registered.
+// Commands are ranked by the order they were added: when several match, the earliest-added
+// wins, like a chain of if/else-if keyword checks. Markers (e.g. " in ") are located in the
+// same pass so that handlers can take the text after them as an argument.
+class CommandRouter {
+public:
+  static const size_t kMaxMarkers = 8;
+  
+  struct Match {
+    int command = -1;         // Id from add_command(), -1 if no keyword matched
+    string_view text;         // The text that was scanned
+    size_t keyword_end = 0;   // Offset just past the first occurrence of a winning keyword
+    size_t marker_end[kMaxMarkers];  // Offset just past each marker's first occurrence (npos if absent)
+    
+    bool matched() const {
+      return command >= 0;
+    }
+    
+    // Text after the marker's first occurrence, whitespace trimmed; empty if it does not occur
+    string_view argument(int marker) const {
+      if (marker < 0 || (size_t)marker >= kMaxMarkers || marker_end[marker] == string_view::npos) return {};
+      string_view rest = text.substr(marker_end[marker]);
+      size_t start = rest.find_first_not_of(" \t\n\r");
+      if (start == string_view::npos) return {};
+      size_t end = rest.find_last_not_of(" \t\n\r");
+      return rest.substr(start, end - start + 1);
+    }
+  };
+  
+  CommandRouter() {
+    for (int c = 0; c < 256; c++) fold[c] = (unsigned char)((c >= 'A' && c <= 'Z') ? c + 32 : c);
+    compile();
+  }
+  
+  // A command triggered by any of its keywords; returns its id (also its rank)
+  int add_command(initializer_list<string_view> keywords) {
+    int command = command_count++;
+    for (string_view keyword : keywords) add_pattern(keyword, command, false);
+    compile();
+    return command;
+  }
+  
+  // A marker whose position is reported in Match::marker_end; returns its id, -1 if full
+  int add_marker(string_view marker) {
+    if (marker_count >= (int)kMaxMarkers) return -1;
+    int id = marker_count++;
+    add_pattern(marker, id, true);
+    compile();
+    return id;
+  }
+  
+  Match match(string_view text) const {
+    Match m;
+    m.text = text;
+    for (size_t i = 0; i < kMaxMarkers; i++) m.marker_end[i] = string_view::npos;
+    int32_t state = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+      state = delta[(size_t)state * class_count + byte_class[(unsigned char)text[i]]];
+      for (uint32_t o = output_begin[(size_t)state]; o < output_begin[(size_t)state + 1]; o++) {
+        const Pattern& p = patterns[outputs[o]];
+        if (p.marker) {
+          if (m.marker_end[p.id] == string_view::npos) m.marker_end[p.id] = i + 1;
+        } else if (m.command < 0 || p.id < m.command) {
+          m.command = p.id;
+          m.keyword_end = i + 1;
+        }
+      }
+    }
+    return m;
+  }
+  
+private:
+  struct Pattern {
+    string folded;
+    int id;
+    bool marker;
+  };
+  
+  unsigned char fold[256];
+  vector<Pattern> patterns;
+  int command_count = 0;
+  int marker_count = 0;
+  uint8_t byte_class[256];
+  size_t class_count = 1;
+  vector<int32_t> delta;          // state * class_count + class -> next state
+  vector<uint32_t> output_begin;  // Patterns ending at state s: outputs[output_begin[s] .. output_begin[s+1])
+  vector<uint16_t> outputs;
+  
+  void add_pattern(string_view keyword, int id, bool marker) {
+    if (keyword.empty()) return;
+    Pattern p{string(), id, marker};
+    for (unsigned char c : keyword) p.folded.push_back((char)fold[c]);
+    patterns.push_back(move(p));
+  }
+  
+  // Rebuilt after every add; routers are set up once, so only match() needs to be fast
+  void compile() {
+    memset(byte_class, 0, sizeof(byte_class));
+    class_count = 1;
+    for (const Pattern& p : patterns) {
+      for (unsigned char c : p.folded) {
+        if (!byte_class[c]) byte_class[c] = (uint8_t)class_count++;
+      }
+    }
+    for (int c = 0; c < 256; c++) byte_class[c] = byte_class[fold[c]];  // Upper case maps like lower
+    
+    // Trie, with -1 for missing edges
+    vector<int32_t> next(class_count, -1);
+    vector<vector<uint16_t>> out(1);
+    for (size_t pi = 0; pi < patterns.size(); pi++) {
+      int32_t s = 0;
+      for (unsigned char c : patterns[pi].folded) {
+        int32_t& edge = next[(size_t)s * class_count + byte_class[c]];
+        if (edge < 0) {
+          edge = (int32_t)out.size();
+          out.emplace_back();
+          next.resize(next.size() + class_count, -1);
+        }
+        s = next[(size_t)s * class_count + byte_class[c]];
+      }
+      out[(size_t)s].push_back((uint16_t)pi);
+    }
+    
+    // Breadth-first: fill missing edges from the failure state, inherit its outputs
+    size_t states = out.size();
+    vector<int32_t> failure(states, 0);
+    vector<int32_t> order;
+    order.reserve(states);
+    for (size_t c = 0; c < class_count; c++) {
+      int32_t& edge = next[c];
+      if (edge < 0) {
+        edge = 0;
+      } else {
+        order.push_back(edge);
+      }
+    }
+    for (size_t head = 0; head < order.size(); head++) {
+      int32_t s = order[head];
+      const vector<uint16_t>& inherited = out[(size_t)failure[(size_t)s]];
+      out[(size_t)s].insert(out[(size_t)s].end(), inherited.begin(), inherited.end());
+      for (size_t c = 0; c < class_count; c++) {
+        int32_t& edge = next[(size_t)s * class_count + c];
+        int32_t via_failure = next[(size_t)failure[(size_t)s] * class_count + c];
+        if (edge < 0) {
+          edge = via_failure;
+        } else {
+          failure[(size_t)edge] = via_failure;
+          order.push_back(edge);
+        }
+      }
+    }
+    
+    delta.swap(next);
+    output_begin.assign(1, 0);
+    outputs.clear();
+    for (size_t s = 0; s < states; s++) {
+      outputs.insert(outputs.end(), out[s].begin(), out[s].end());
+      output_begin.push_back((uint32_t)outputs.size());
+    }
+  }
+};
+
+// Handle echo request
+// This demonstrates TWO capabilities:
+// 1. Basic echo functionality - echoes back the message
+// 2. Calling OTHER MCP tools - demonstrates how to call sqlite, browser, etc.
+// Temporaries and the returned result are allocated from arena (the call's arena when called
+// from a handler), so the common echo path does not touch the global heap.
+pmr::string handleEchoRequest(string_view message, SSEConnection* conn = nullptr,
+                              pmr::memory_resource* arena = pmr::get_default_resource()) {
+  LOG(LOG_DEBUG) << "[ECHO] Received echo request: " << message;
+  
+  // Basic echo response
+  pmr::string response_text(arena);
+  response_text.append("Echo: ").append(message.data(), message.size());
+  
+  // DEMONSTRATION: If we have connection info, show how to call other tools
+  if (conn != nullptr) {
+    // Keyword detection: one case-insensitive pass over message, commands ranked by the order
+    // they are added (the router is built once, on first use)
+    enum { DEMO_PARALLEL, DEMO_DATABASES, DEMO_TABLES };
+    enum { MARKER_IN };
+    static const CommandRouter router = [] {
+      CommandRouter r;
+      r.add_command({"parallel"});
+      r.add_command({"databases", "list db"});
+      r.add_command({"tables"});
+      r.add_marker(" in ");
+      return r;
+    }();
+    CommandRouter::Match command = router.match(message);
+    
+    // Demo 0: Several independent tool calls in parallel (triggered by keyword "parallel")
+    // Both sqlite calls are in flight at once, so this costs one round trip instead of two
+    if (command.command == DEMO_PARALLEL) {
+      LOG(LOG_INFO) << "[DEMO] Calling sqlite twice in parallel...";
+      
+      vector<ToolCallFuture> calls;
+      calls.push_back(conn->call_mcp_tool_async("sqlite", R"({"input":{"sql":".databases","tool_unlock_token":"29e63eb5"}})"));
+      calls.push_back(conn->call_mcp_tool_async("sqlite", R"({"input":{"sql":".tables","tool_unlock_token":"29e63eb5"}})"));
+      vector<string> results = when_all(calls);
+      
+      response_text += "\n\n[DEMO] Called sqlite twice in parallel\n";
+      response_text.append("Databases: ").append(results[0].empty() ? string_view("(failed)") : string_view(results[0])).append("\n");
+      response_text.append("Tables: ").append(results[1].empty() ? string_view("(failed)") : string_view(results[1]));
+    }
+    // Demo 1: List databases (triggered by keyword "databases" or "db")
+    // Check this FIRST because it's more specific and helps users discover what databases exist
+    else if (command.command == DEMO_DATABASES) {
+      LOG(LOG_INFO) << "[DEMO] Calling sqlite tool to list databases...";
+      
+      // Call the sqlite tool to list databases
+      string sqlite_args = R"({"input":{"sql":".databases","tool_unlock_token":"29e63eb5"}})";
+      string sqlite_result = conn->call_mcp_tool("sqlite", sqlite_args);
+      
+      // Append the result to our response
+      if (!sqlite_result.empty()) {
+        response_text += "\n\n[DEMO] Called sqlite tool successfully!\n";
+        response_text.append("Result: ").append(sqlite_result);
+      } else {
+        response_text += "\n\n[DEMO] SQLite tool call failed or returned no result";
+      }
+    }
+    // Demo 2: List tables (triggered by keywords "tables" - check AFTER databases to avoid conflicts)
+    else if (command.command == DEMO_TABLES) {
+      LOG(LOG_INFO) << "[DEMO] Calling sqlite tool to list tables...";
+      
+      // Extract database name if specified (e.g., "list tables in test.db")
+      string_view database = command.argument(MARKER_IN);
+      if (database.empty()) database = ":memory:";
+      
+      // Call the sqlite tool to list tables
+      string sqlite_args;
+      JsonWriter(sqlite_args).raw("{\"input\":{\"sql\":\".tables\",\"database\":").str(database)
+                             .raw(",\"tool_unlock_token\":\"29e63eb5\"}}");
+      string sqlite_result = conn->call_mcp_tool("sqlite", sqlite_args);
+      
+      // Append the result to our response
+      if (!sqlite_result.empty()) {
+        response_text += "\n\n[DEMO] Called sqlite tool successfully!\n";
+        response_text.append("Database: ").append(database).append("\n");
+        response_text.append("Result: ").append(sqlite_result);
+      } else {
+        response_text += "\n\n[DEMO] SQLite tool call failed or returned no result";
+      }
+    }
+  }
+  
+  // Build JSON result
+  pmr::string result(arena);
+  result.reserve(response_text.size() + 64);
+  ArenaJsonWriter(result).raw("{\"content\":[{\"type\":\"text\",\"text\":").str(response_text)
+                         .raw("}],\"isError\":false}");
+  
+  return result;
+};
+
+// Config key under which the server advertises a local IPC endpoint next to its URL
+#ifdef _WIN32
+static const char* kLocalSocketKey = "namedPipe";
+#else
+static const char* kLocalSocketKey = "unixSocket";
+#endif
+
+// Steps 2-3 of discovery: read the manifest and run the native binary it names to get the
+// server URL and Authorization header (plus the local socket, if the server advertises one)
+bool discover_endpoint_via_native_binary(const string& manifest_path, string& server_url, string& auth_token,
+                                         string& local_socket) {
+  // Step 2: Read manifest
+  cerr << "Step 2: Reading manifest..." << endl;
+  string manifest_content = read_file(manifest_path);
+  if (manifest_content.empty()) {
+    cerr << "ERROR: Could not read manifest" << endl;
+    return false;
+  }
+  string binary_path = extract_json_string(manifest_content, "path");
+  if (binary_path.empty()) {
+    cerr << "ERROR: No path in manifest" << endl;
+    return false;
+  }
+  cerr << "[OK] Manifest loaded" << endl << endl;
+  
+  // Step 3: Discover endpoint
+  cerr << "Step 3: Discovering MCP server endpoint..." << endl;
+  string config = discover_mcp_server_endpoint(binary_path);
+  if (config.empty()) {
+    cerr << "ERROR: Could not get configuration from native binary" << endl;
+    cerr << "Is the Aura Friday MCP server running?" << endl;
+    return false;
+  }
+  
+  server_url = extract_json_string(config, "url");
+  auth_token = extract_json_string(config, "Authorization");
+  local_socket = extract_json_string(config, kLocalSocketKey);
+  
+  // Debug output to see what we extracted
+  LOG(LOG_DEBUG) << "[DEBUG] Config length: " << config.length() << " bytes";
+  LOG(LOG_DEBUG) << "[DEBUG] Extracted URL: '" << server_url << "'";
+  LOG(LOG_DEBUG) << "[DEBUG] Extracted auth token: '" << auth_token << "'";
+  LOG(LOG_DEBUG) << "[DEBUG] Extracted local socket: '" << local_socket << "'";
+  
+  if (server_url.empty()) {
+    cerr << "ERROR: Could not extract server URL from config" << endl;
+    cerr << "       Config preview: " << config.substr(0, 200) << "..." << endl;
+    return false;
+  }
+  
+  if (auth_token.empty()) {
+    cerr << "ERROR: Could not extract Authorization header from config" << endl;
+    cerr << "       Looked for 'Authorization' key in mcpServers.*.headers" << endl;
+    cerr << "       Config preview: " << config.substr(0, 500) << "..." << endl;
+    return false;
+  }
+  return true;
+}
+
+// Demo image source: a 24-bit BMP gradient rendered row by row as the reply is sent, standing
+// in for a viewport capture or render from a host application
+class GradientBitmap {
+public:
+  GradientBitmap(uint32_t width, uint32_t height) : width(width), height(height) {}
+  
+  size_t size() const {
+    return kHeaderSize + row_bytes() * height;
+  }
+  
+  size_t read(uint8_t* buf, size_t cap) {
+    size_t written = 0;
+    while (written < cap && pos < size()) {
+      if (pos < kHeaderSize) {
+        uint8_t header[kHeaderSize];
+        write_header(header);
+        size_t n = min(cap - written, kHeaderSize - pos);
+        memcpy(buf + written, header + pos, n);
+        pos += n;
+        written += n;
+        continue;
+      }
+      size_t offset = pos - kHeaderSize;
+      size_t y = offset / row_bytes(), x_byte = offset % row_bytes();
+      size_t n = min(cap - written, row_bytes() - x_byte);
+      for (size_t i = 0; i < n; i++) {
+        size_t b = x_byte + i, x = b / 3;
+        uint8_t value = 0;
+        if (x < width) {
+          switch (b % 3) {  // BMP stores BGR
+            case 0: value = (uint8_t)(255 * y / max<uint32_t>(height - 1, 1)); break;
+            case 1: value = 128; break;
+            case 2: value = (uint8_t)(255 * x / max<uint32_t>(width - 1, 1)); break;
+          }
+        }
+        buf[written + i] = value;
+      }
+      pos += n;
+      written += n;
+    }
+    return written;
+  }
+  
+private:
+  static constexpr size_t kHeaderSize = 54;
+  uint32_t width, height;
+  size_t pos = 0;
+  
+  size_t row_bytes() const {
+    return ((size_t)width * 3 + 3) & ~(size_t)3;  // Rows are padded to 4 bytes
+  }
+  
+  void write_header(uint8_t* h) const {
+    auto put32 = [h](size_t at, uint32_t v) {
+      for (int i = 0; i < 4; i++) h[at + i] = (uint8_t)(v >> (8 * i));
+    };
+    memset(h, 0, kHeaderSize);
+    h[0] = 'B';
+    h[1] = 'M';
+    put32(2, (uint32_t)size());
+    put32(10, (uint32_t)kHeaderSize);
+    put32(14, 40);
+    put32(18, width);
+    put32(22, height);
+    h[26] = 1;
+    h[28] = 24;
+    put32(34, (uint32_t)(row_bytes() * height));
+  }
+};
+
+// Reverse call handler for demo_tool_cpp
+void handle_demo_tool(SSEConnection& conn, const ReverseCall& call) {
+  // operation "stats" reports this provider's own counters instead of echoing
+  pmr::string operation = call.argument_string("operation");
+  if (operation == "stats") {
+    string result;
+    JsonWriter(result).raw("{\"content\":[{\"type\":\"text\",\"text\":").str(metrics().prometheus_text())
+                      .raw("}],\"isError\":false}");
+    conn.send_tool_reply(call.call_id, result);
+    return;
+  }
+  // operation "image" streams a generated image: base64 is produced while the POST is sent
+  if (operation == "image") {
+    GradientBitmap bitmap(512, 512);
+    StreamingReply reply(call.call_id);
+    reply.text("Generated a 512x512 gradient (image/bmp), streamed without building the JSON in memory")
+         .image(bitmap.size(), [&bitmap](uint8_t* buf, size_t cap) { return bitmap.read(buf, cap); }, "image/bmp");
+    conn.send_tool_reply(reply);
+    return;
+  }
+  pmr::string message = call.argument("message").is_string() ? call.argument_string("message")
+                                                              : pmr::string("(no message provided)", call.arena);
+  pmr::string result = handleEchoRequest(message, &conn, call.arena);
+  conn.send_tool_reply(call.call_id, result);
+}
+
+// The tools this demo provides; add your own here
+// Each ToolSpec becomes one "remote" registration; its handler receives the reverse calls.
+void add_demo_tools(ToolRegistry& tools) {
+  ToolRegistry::ToolSpec demo;
+  demo.name = "demo_tool_cpp";
+  demo.readme = "Demo tool that echoes messages back and can call other MCP tools.\n"
+                "- Use this to test the remote tool system and verify bidirectional communication.\n"
+                "- Demonstrates how remote tools can call OTHER tools on the server (like sqlite, browser, etc.)";
+  demo.description = R"(Demo tool (C++ implementation) for testing remote tool registration and end-to-end MCP communication. This tool demonstrates TWO key capabilities: (1) Basic echo functionality - echoes back any message sent to it, and (2) Tool-to-tool communication - shows how remote tools can call OTHER MCP tools on the server. This verifies that: (a) tool registration works correctly, (b) reverse calls from server to client function properly, (c) the client can successfully reply to tool calls, (d) the full bidirectional JSON-RPC communication channel is operational, and (e) remote tools can orchestrate other tools. This tool is implemented in reverse_mcp.cpp and serves as a reference template for integrating MCP tool support into other applications like Fusion 360, Blender, Ghidra, and similar products. Usage workflow: (1) Start by discovering databases: {"message": "list databases"} calls sqlite to show all available databases. (2) Then list tables in a specific database: {"message": "list tables in test.db"} calls sqlite and returns table names. (3) Basic echo: {"message": "test"} returns 'Echo: test'. The tool automatically detects keywords in the message to trigger different demonstrations.)";
+  demo.parameters_json = R"JSON({
+    "type":"object",
+    "properties":{
+      "message":{"type":"string","description":"The message to echo back"},
+      "operation":{"type":"string","enum":["echo","stats","image"],"description":"'stats' returns this provider's counters and latency histograms (Prometheus text) instead of echoing; 'image' returns a generated test image"}
+    },
+    "required":[]
+  })JSON";
+  demo.callback_endpoint = "cpp-client://demo-tool-callback";
+  demo.api_key = "cpp_demo_tool_auth_key_12345";
+  // Echo calls are interactive; stats gets the reserved lane, generated images can wait
+  demo.lane = Lane::INTERACTIVE;
+  demo.operation_lanes = { {"stats", Lane::RESERVED}, {"image", Lane::BATCH} };
+  tools.add(move(demo), handle_demo_tool);
+}
+
+// How outbound tool calls are spread over the servers when connected to several
+enum class RoutingPolicy {
+  LEAST_LOADED,   // Fewest of our requests awaiting a response
+  LOWEST_LATENCY  // Shortest expected wait: smoothed response time x (requests awaiting + 1)
+};
+
+// One MCP server to serve our tools to: found through a native messaging manifest (the first
+// one installed when manifest_path is empty), or given directly by URL and Authorization header
+struct ServerTarget {
+  string name;  // Label in logs and metrics
+  string manifest_path;
+  string url;
+  string auth_header;
+};
+
+// Runtime options parsed from the command line
+struct ProviderOptions {
+  bool background = false;
+  size_t http_pool_size = 4;   // Concurrent keep-alive POST connections per server
+  size_t worker_threads = 4;   // Threads running reverse tool call handlers
+  size_t reserved_workers = 1; // Extra threads that only run reserved-lane (health/stats) calls
+  LaneScheduling lane_scheduling = LaneScheduling::WEIGHTED;
+  unsigned lane_weights[3] = {8, 4, 1};  // Interactive, normal, batch shares under WEIGHTED
+  size_t queue_capacity = 1024; // Reverse calls buffered per lane between the SSE reader and workers
+  size_t max_in_flight = 0;    // Reverse calls queued, running or backlogged at once (0 = no limit)
+  OverloadPolicy overload_policy = OverloadPolicy::BLOCK;  // What to do with calls past the limits
+  long long call_timeout_ms = 120000;  // Deadline of each reverse call from its arrival (0 = none)
+  long long heartbeat_interval_ms = 15000;  // Ping after the SSE stream is quiet this long (0 = never)
+  long long heartbeat_timeout_ms = 10000;   // Then reconnect if nothing arrives within this
+  size_t result_cache_entries = 0;  // call_mcp_tool() results kept for repeated discovery queries (0 = off)
+  long long result_cache_ttl = 30;  // Seconds a cached result stays valid
+  bool http2 = false;          // Multiplex the SSE stream and all POSTs over one HTTP/2 connection
+  bool event_loop = false;     // Non-blocking transport: one event-loop thread for all HTTP I/O
+  long long batch_window_us = 0; // Coalesce outgoing messages for up to this long (0 = off)
+  size_t batch_max = 32;       // Messages per batch POST
+  long long discovery_cache_ttl = 24 * 60 * 60;  // Seconds a cached endpoint is trusted (0 = off)
+  string local_socket;         // Reach the server through this Unix socket instead of the advertised one
+  CompressionMode compression = CompressionMode::AUTO;  // Request bodies, and accepting a compressed SSE stream
+  size_t compress_min_bytes = 16384;  // Smaller request bodies are never compressed
+  bool no_local_socket = false;  // Always use the server URL (TCP), even if a local socket is advertised
+  vector<ServerTarget> servers;  // --manifest/--server, one connection each (empty = the installed server)
+  RoutingPolicy routing = RoutingPolicy::LEAST_LOADED;  // Which server takes call_mcp_tool() calls
+  bool bench = false;          // --bench: run the round-trip benchmark instead of serving
+  bool bench_mock = false;     // Benchmark against the in-process mock server
+  size_t bench_calls = 2000;
+  size_t bench_concurrency = 8;
+  string record_path;          // Append the SSE events received and messages sent to this trace file
+  string replay_path;          // Run a recorded trace against the mock server instead of serving
+  double replay_speed = 1.0;   // Trace time is divided by this (0 = back to back)
+  int metrics_port = 0;        // Serve Prometheus metrics on 127.0.0.1:N (0 = off)
+  LogLevel log_level = LOG_INFO;
+};
+
+// Apply the transport, admission, lane and cache options to a connection before connect()
+// Shared by serving, --bench and --replay so that they all measure the same configuration.
+// tools must outlive conn: its reader thread classifies calls with it.
+void configure_connection(SSEConnection& conn, const ProviderOptions& options, const ToolRegistry& tools) {
+  conn.enable_batching(chrono::microseconds(options.batch_window_us), options.batch_max);
+  conn.set_admission(options.overload_policy, options.max_in_flight);
+  conn.set_lane_scheduling(options.lane_scheduling, options.lane_weights[0], options.lane_weights[1],
+                           options.lane_weights[2]);
+  conn.set_lane_classifier([&tools](string_view reverse) { return tools.lane_for(reverse); });
+  conn.enable_result_cache(options.result_cache_entries, chrono::seconds(options.result_cache_ttl));
+  // The demo's sqlite discovery queries are read-only, so repeats can be served from the cache
+  conn.allow_result_caching("sqlite", "input.sql", {".databases", ".tables"});
+  if (options.event_loop) conn.enable_event_loop();
+  conn.enable_compression(options.compression, options.compress_min_bytes);
+}
+
+// Delay before the next reconnect attempt
+// The first attempt after a dropped stream waits only a few milliseconds, so a server bounce
+// costs well under 100 ms. Further failures use "decorrelated jitter" (each delay is random
+// between the base and 3x the previous one, capped), so a fleet of clients that lost the same
+// server spreads out instead of reconnecting in lockstep.
+class ReconnectBackoff {
+public:
+  ReconnectBackoff(chrono::milliseconds base, chrono::milliseconds cap)
+    : base(base), cap(cap), previous(base), rng(random_device{}()) {}
+  
+  // The connection was healthy and just dropped: the next attempt goes out almost immediately
+  void connection_lost() {
+    attempt = 1;
+    fast = true;
+    previous = base;
+  }
+  
+  // An attempt failed: the next one waits (longer)
+  void failed() {
+    attempt++;
+  }
+  
+  // Connected and registered
+  void reset() {
+    attempt = 0;
+    fast = false;
+    previous = base;
+  }
+  
+  // Number of the upcoming retry (0 = first connect, no delay)
+  int attempts() const {
+    return attempt;
+  }
+  
+  chrono::milliseconds next_delay() {
+    if (fast) {
+      fast = false;
+      return chrono::milliseconds(uniform_int_distribution<long long>(0, kFastRetryJitterMs)(rng));
+    }
+    long long upper = max<long long>(base.count(), min<long long>(cap.count(), previous.count() * 3));
+    previous = chrono::milliseconds(uniform_int_distribution<long long>(base.count(), upper)(rng));
+    return previous;
+  }
+  
+private:
+  static constexpr long long kFastRetryJitterMs = 20;
+  chrono::milliseconds base;
+  chrono::milliseconds cap;
+  chrono::milliseconds previous;
+  mt19937_64 rng;
+  int attempt = 0;
+  bool fast = false;
+};
+
+// Sleep, waking early on Ctrl+C (signalled through wakeup); false if we should shut down
+bool sleep_unless_stopped(chrono::milliseconds delay, WakeupEvent& wakeup = g_wakeup) {
+  auto deadline = chrono::steady_clock::now() + delay;
+  while (g_running) {
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline) return true;
+    wakeup.wait(chrono::duration_cast<chrono::milliseconds>(deadline - now) + chrono::milliseconds(1));
+  }
+  return false;
+}
+
+// Watches a registered connection from main_worker's thread until it has to be replaced
+// Any bytes on the SSE stream (events, responses, keep-alive comments) count as a heartbeat.
+// After interval without one, a JSON-RPC ping is sent - its response is a heartbeat too - and
+// when nothing has arrived by interval + timeout the server is presumed dead. The thread sleeps
+// on wakeup (g_wakeup unless given) between checks, so Ctrl+C and a closed stream are noticed at once.
+class LivenessSupervisor {
+public:
+  enum Outcome {
+    SHUTDOWN,      // Ctrl+C
+    DISCONNECTED,  // The SSE stream closed
+    UNRESPONSIVE   // Heartbeat missed; the caller should disconnect and reconnect
+  };
+  
+  // interval 0 disables pings and the heartbeat timeout
+  LivenessSupervisor(SSEConnection& conn, chrono::milliseconds interval, chrono::milliseconds timeout,
+                     WakeupEvent& wakeup = g_wakeup)
+    : conn(conn), interval(interval), timeout(timeout), wakeup(wakeup) {}
+  
+  Outcome run() {
+    for (;;) {
+      if (!g_running) return SHUTDOWN;
+      if (!conn.is_alive()) return DISCONNECTED;
+      
+      chrono::milliseconds next_check = chrono::hours(1);
+      if (interval.count() > 0) {
+        auto idle = chrono::duration_cast<chrono::milliseconds>(conn.idle_for());
+        if (idle >= interval + timeout) {
+          metrics().add(Metrics::HEARTBEAT_TIMEOUTS);
+          LOG(LOG_WARN) << "\n[WARN] Nothing from the server for " << idle.count() / 1000 << "s - reconnecting...";
+          return UNRESPONSIVE;
+        }
+        if (ping.valid() && ping.done()) ping.reset();  // Answered (and counted as a heartbeat) or failed
+        if (idle >= interval) {
+          if (!ping.valid()) {
+            LOG(LOG_DEBUG) << "[HEARTBEAT] SSE stream quiet for " << idle.count() << " ms, sending ping";
+            metrics().add(Metrics::HEARTBEAT_PINGS);
+            ping = conn.start_request("ping", "{}");
+          }
+          next_check = interval + timeout - idle;
+        } else {
+          next_check = interval - idle;
+        }
+      }
+      wakeup.wait(next_check + chrono::milliseconds(1));
+    }
+  }
+  
+private:
+  SSEConnection& conn;
+  chrono::milliseconds interval;
+  chrono::milliseconds timeout;
+  WakeupEvent& wakeup;
+  PendingRequest ping;
+};
+
+// The servers this provider is connected to, and which of them takes each outbound call
+// Every ServerSession attaches its connection once registered and detaches it when the
+// connection goes. pick() returns the healthy connection that scores best under the routing
+// policy, starting the scan at a rotating position so that equal scores alternate. Connections
+// are handed out as shared_ptr, so one that is replaced mid-call stays valid until it returns.
+class ServerPool {
+public:
+  explicit ServerPool(RoutingPolicy policy) : policy(policy) {}
+  
+  // Returns the index to pass to the other calls
+  size_t add_server(const string& name) {
+    lock_guard<mutex> lock(m);
+    servers.emplace_back(new Server());
+    servers.back()->name = name;
+    return servers.size() - 1;
+  }
+  
+  void attach(size_t server, shared_ptr<SSEConnection> conn) {
+    lock_guard<mutex> lock(m);
+    servers[server]->conn = move(conn);
+    servers[server]->connects++;
+  }
+  
+  void detach(size_t server) {
+    shared_ptr<SSEConnection> released;  // Destroyed outside the lock
+    lock_guard<mutex> lock(m);
+    released.swap(servers[server]->conn);
+  }
+  
+  void note_reverse_call(size_t server) {
+    servers[server]->reverse_calls.fetch_add(1, memory_order_relaxed);
+  }
+  
+  // The connection for the next outbound call; null while no server is connected
+  shared_ptr<SSEConnection> pick() {
+    lock_guard<mutex> lock(m);
+    Server* best = nullptr;
+    double best_score = 0;
+    size_t start = rotation++;
+    for (size_t k = 0; k < servers.size(); k++) {
+      Server& server = *servers[(start + k) % servers.size()];
+      if (!server.conn || !server.conn->is_alive()) continue;
+      double s = score(*server.conn);
+      if (!best || s < best_score) {
+        best = &server;
+        best_score = s;
+      }
+    }
+    if (!best) return nullptr;
+    best->routed.fetch_add(1, memory_order_relaxed);
+    return best->conn;
+  }
+  
+  // Reverse calls waiting for a worker, over all connections
+  size_t reverse_queue_depth() {
+    lock_guard<mutex> lock(m);
+    size_t depth = 0;
+    for (auto& server : servers) {
+      if (server->conn) depth += server->conn->reverse_queue_depth();
+    }
+    return depth;
+  }
+  
+  // Per-server series for Metrics::prometheus_text()
+  void write_prometheus(ostream& out) {
+    lock_guard<mutex> lock(m);
+    static const char* series[6][3] = {
+      {"reverse_mcp_server_up", "gauge", "Whether the server's connection is registered and alive"},
+      {"reverse_mcp_server_requests_in_flight", "gauge", "Our requests to the server awaiting a response"},
+      {"reverse_mcp_server_response_seconds", "gauge", "Smoothed response time of the server"},
+      {"reverse_mcp_server_calls_routed_total", "counter", "Outbound tool calls routed to the server"},
+      {"reverse_mcp_server_reverse_calls_total", "counter", "Reverse calls received from the server"},
+      {"reverse_mcp_server_connects_total", "counter", "Times a connection to the server was registered"},
+    };
+    for (int i = 0; i < 6; i++) {
+      out << "# HELP " << series[i][0] << " " << series[i][2] << "\n"
+          << "# TYPE " << series[i][0] << " " << series[i][1] << "\n";
+      for (auto& server : servers) {
+        SSEConnection* conn = server->conn && server->conn->is_alive() ? server->conn.get() : nullptr;
+        out << series[i][0] << "{server=\"" << label_value(server->name) << "\"} ";
+        switch (i) {
+          case 0: out << (conn ? 1 : 0); break;
+          case 1: out << (conn ? conn->requests_in_flight() : 0); break;
+          case 2: out << (conn ? (double)conn->response_latency().count() / 1e6 : 0.0); break;
+          case 3: out << server->routed.load(memory_order_relaxed); break;
+          case 4: out << server->reverse_calls.load(memory_order_relaxed); break;
+          default: out << server->connects; break;
+        }
+        out << "\n";
+      }
+    }
+  }
+  
+private:
+  struct Server {
+    string name;
+    shared_ptr<SSEConnection> conn;  // Null while reconnecting
+    atomic<uint64_t> routed{0};
+    atomic<uint64_t> reverse_calls{0};
+    uint64_t connects = 0;
+  };
+  
+  RoutingPolicy policy;
+  mutex m;
+  vector<unique_ptr<Server>> servers;
+  size_t rotation = 0;
+  
+  double score(const SSEConnection& conn) const {
+    double waiting = (double)conn.requests_in_flight();
+    if (policy == RoutingPolicy::LEAST_LOADED) return waiting;
+    // Not measured yet counts as fastest, so a new connection gets traffic and a measurement
+    long long us = max<long long>(1, conn.response_latency().count());
+    return (double)us * (waiting + 1);
+  }
+  
+  static string label_value(const string& value) {
+    string escaped;
+    for (char c : value) {
+      if (c == '\\' || c == '"') escaped += '\\';
+      if (c == '\n') escaped += "\\n";
+      else escaped += c;
+    }
+    return escaped;
+  }
+};
+
+// Keeps one server's connection up: discovery, connect, register, serve, reconnect
+// main_worker runs one session per server, each on its own thread when there are several.
+// Backoff, the endpoint and Last-Event-ID resumption are all per session, so one server going
+// away never delays the others. Log lines carry tag ("[name] ") when there are several.
+class ServerSession {
+public:
+  ServerSession(const ProviderOptions& options, const ServerTarget& target, const ToolRegistry& tools,
+                ServerPool& pool, size_t pool_index, WakeupEvent& wakeup)
+    : options(options), target(target), tools(tools), pool(pool), pool_index(pool_index), wakeup(wakeup),
+      backoff(chrono::milliseconds(500), chrono::seconds(60)) {}
+  
+  string tag;                    // Prefix for log lines
+  string cache_variant;          // Discovery cache file of this session (see discovery_cache_path)
+  string local_socket_override;  // --local-socket, when serving a single server
+  bool route_outbound = false;   // Send call_mcp_tool() through the pool
+  TraceRecorder* trace = nullptr;  // --record
+  
+  // Returns once g_running is false (Ctrl+C)
+  void run() {
+    // Connection state for reconnection logic
+    // Whatever is still valid from the last good connection is reused, so a reconnect after a
+    // server bounce goes straight to opening the stream (with Last-Event-ID) and registering.
+    bool direct = !target.url.empty();
+    string manifest_path = target.manifest_path;
+    string server_url, auth_token;  // From the last successful connect
+    string local_socket;            // Advertised next to server_url (empty = none)
+    bool local_socket_failed = false;  // Could not connect through it: TCP until the next discovery
+    string last_event_id;
+    bool registered_before = false;
+    
+    // Outer reconnection loop - keeps trying until Ctrl+C
+    while (g_running) {
+      try {
+        // Decorrelated-jitter backoff; the first retry after a dropped stream is near-immediate
+        if (backoff.attempts() > 0) {
+          chrono::milliseconds delay = backoff.next_delay();
+          cerr << endl << tag << "[RECONNECT] Waiting " << delay.count() << " ms before retry (attempt #" << backoff.attempts() << ")..." << endl;
+          
+          // Check for Ctrl+C during sleep
+          if (!sleep_unless_stopped(delay, wakeup)) return;
+          
+          cerr << tag << "[RECONNECT] Attempting to reconnect..." << endl << endl;
+          metrics().add(Metrics::RECONNECTS);
+        }
+        
+        bool reused = !server_url.empty();
+        bool from_cache = false;
+        if (direct) {
+          // Steps 1-3 do not apply: the endpoint was given on the command line
+          if (!reused) cerr << tag << "Steps 1-3: Using configured server endpoint" << endl;
+          server_url = target.url;
+          auth_token = target.auth_header;
+        } else {
+          // Step 1: Find manifest
+          if (manifest_path.empty()) {
+            cerr << tag << "Step 1: Finding native messaging manifest..." << endl;
+            manifest_path = find_native_messaging_manifest();
+            if (manifest_path.empty()) {
+              cerr << tag << "ERROR: Could not find manifest" << endl;
+              backoff.failed();
+              continue;
+            }
+            cerr << tag << "[OK] Found manifest: " << manifest_path << endl << endl;
+          }
+          
+          // Steps 2-3: Reuse the endpoint we were just connected to, else the cached one if
+          // still valid - spawning the native binary is slow
+          if (reused) {
+            cerr << tag << "Steps 1-3: Reusing previous server endpoint" << endl;
+          } else if ((from_cache = load_cached_endpoint(manifest_path, options.discovery_cache_ttl, server_url,
+                                                        auth_token, local_socket, cache_variant))) {
+            cerr << tag << "Steps 2-3: Using cached server endpoint (skipping native binary)" << endl;
+          } else if (!discover_endpoint_via_native_binary(manifest_path, server_url, auth_token, local_socket)) {
+            server_url.clear();
+            backoff.failed();
+            continue;
+          }
+          if (!reused) local_socket_failed = false;
+        }
+        
+        cerr << tag << "[OK] Found server at: " << server_url << endl << endl;
+        
+        // Step 4: Connect to SSE
+        cerr << tag << "Step 4: Connecting to SSE endpoint..." << endl;
+        auto conn = make_shared<SSEConnection>(options.http_pool_size, options.queue_capacity, options.http2);
+        configure_connection(*conn, options, tools);
+        conn->set_closed_hook([this] { wakeup.notify(); });
+        if (route_outbound) conn->set_outbound_router([this] { return pool.pick(); });
+        conn->set_trace(trace);
+        conn->server_url = server_url;
+        conn->auth_header = auth_token;
+        conn->resume_event_id = last_event_id;
+        if (!options.no_local_socket && !local_socket_failed) {
+          conn->local_socket = local_socket_override.empty() ? local_socket : local_socket_override;
+        }
+        if (!conn->local_socket.empty()) cerr << tag << "[INFO] Using local socket: " << conn->local_socket << endl;
+        
+        if (!conn->connect()) {
+          cerr << tag << "ERROR: Could not connect to SSE" << endl;
+          int status = conn->http_status();
+          if (!conn->local_socket.empty() && status == 0) {
+            // Socket gone or not served: HTTPS still works, so retry at once without it
+            cerr << tag << "[INFO] Local socket unreachable - falling back to " << server_url << endl;
+            local_socket_failed = true;
+            continue;
+          }
+          if (!direct && (reused || from_cache) && (status == 401 || status == 403)) {
+            // Server restarted and rotated its token - rediscover now
+            cerr << tag << "[INFO] Cached endpoint rejected - rediscovering via native binary" << endl;
+            invalidate_cached_endpoint(cache_variant);
+            server_url.clear();
+            last_event_id.clear();  // A new server instance has a new event sequence
+            continue;
+          }
+          if (from_cache && status == 0) {
+            // Stale cache (server restarted on a new port) - rediscover now
+            cerr << tag << "[INFO] Cached endpoint unreachable - rediscovering via native binary" << endl;
+            invalidate_cached_endpoint(cache_variant);
+            server_url.clear();
+            last_event_id.clear();
+            continue;
+          }
+          // A bouncing server usually comes back on the same port; after one more miss, go
+          // through the cache/discovery path again
+          if (!direct && (!reused || backoff.attempts() > 1)) server_url.clear();
+          backoff.failed();
+          continue;
+        }
+        cerr << tag << "[OK] Connected! Session ID: " << conn->session_id << endl << endl;
+        if (!direct && !from_cache) {
+          save_cached_endpoint(manifest_path, server_url, auth_token, local_socket, cache_variant);
+        }
+        
+        // Step 5: Check for remote tool (informational only, so skipped when reconnecting)
+        if (!registered_before) {
+          cerr << tag << "Step 5: Checking for remote tool..." << endl;
+          LOG(LOG_DEBUG) << tag << "[DEBUG] Sending tools/list request...";
+          string tools_result = conn->send_request("tools/list", "{}");
+          LOG(LOG_DEBUG) << tag << "[DEBUG] tools/list result: '" << tools_result << "'";
+          
+          if (tools_result.empty()) {
+            cerr << tag << "ERROR: Could not get tools list (HTTP POST failed or no response on SSE stream)" << endl;
+            cerr << tag << "       Continuing anyway to attempt registration..." << endl;
+            // Don't fail here - continue to registration
+          } else if (tools_result.find("\"remote\"") == string::npos) {
+            LOG(LOG_WARN) << tag << "[WARN] Server tools/list does not mention the 'remote' tool - registration may fail" << '\n';
+          } else {
+            cerr << tag << "[OK] Remote tool found" << endl << endl;
+          }
+        }
+        
+        // Step 6: Register our tools
+        cerr << tag << "Step 6: Registering " << tools.size() << " tool(s)..." << endl;
+        if (!tools.register_all(*conn)) {
+          backoff.failed();
+          continue;
+        }
+        
+        // Reset backoff after successful connection and registration
+        if (backoff.attempts() > 0) {
+          cerr << tag << "[RECONNECT] Ready again after " << backoff.attempts() << " attempt(s)" << endl;
+        }
+        backoff.reset();
+        registered_before = true;
+        
+        cerr << endl << string(60, '=') << endl;
+        cerr << tag << "[OK] demo_tool_cpp registered successfully!" << endl;
+        cerr << "Listening for reverse tool calls... (Press Ctrl+C to stop)" << endl;
+        cerr << string(60, '=') << endl << endl;
+        
+        // Step 7: Hand reverse calls to the worker pool; this thread only watches the connection
+        // Set ToolSpec::max_concurrent = 1 if your handler is not thread-safe
+        ReverseCallDispatcher dispatcher(*conn, [this](SSEConnection& c, const ReverseCall& call) {
+          pool.note_reverse_call(pool_index);
+          tools.dispatch(c, call);
+        }, options.worker_threads);
+        tools.apply_concurrency_limits(dispatcher);
+        dispatcher.set_call_timeout(chrono::milliseconds(options.call_timeout_ms));
+        dispatcher.set_reserved_workers(options.reserved_workers);
+        dispatcher.start();
+        pool.attach(pool_index, conn);
+        
+        LivenessSupervisor supervisor(*conn, chrono::milliseconds(options.heartbeat_interval_ms),
+                                      chrono::milliseconds(options.heartbeat_timeout_ms), wakeup);
+        LivenessSupervisor::Outcome outcome = supervisor.run();
+        if (outcome == LivenessSupervisor::UNRESPONSIVE) {
+          conn->disconnect();
+          backoff.connection_lost();
+        } else if (outcome == LivenessSupervisor::DISCONNECTED) {
+          LOG(LOG_WARN) << '\n' << tag << "[WARN] SSE connection lost - reconnecting...";
+          backoff.connection_lost();
+        }
+        pool.detach(pool_index);
+        dispatcher.stop();
+        string resume_from = conn->last_event_id();
+        if (!resume_from.empty()) last_event_id = resume_from;
+        
+        // If we get here with g_running still set, the connection dropped - the loop retries
+      
+      } catch (const exception& e) {
+        cerr << endl << tag << "[ERROR] Unexpected error in main loop: " << e.what() << endl;
+        backoff.failed();
+        // Loop continues to retry
+      }
+    }
+  }
+  
+private:
+  const ProviderOptions& options;
+  const ServerTarget& target;
+  const ToolRegistry& tools;
+  ServerPool& pool;
+  size_t pool_index;
+  WakeupEvent& wakeup;
+  ReconnectBackoff backoff;
+};
+
+// Main worker function
+// Serves the tools to every configured server (by default the one installed locally) until
+// Ctrl+C. A single server is served from this thread, exactly as before multi-server support;
+// with several, every session gets a thread and its own wakeup event, and this thread relays
+// Ctrl+C to them.
+int main_worker(const ProviderOptions& options, TraceRecorder* trace = nullptr) {
+  cerr << "=== Aura Friday Remote Tool Provider Demo ===" << endl;
+  cerr << "PID: " << getpid() << endl;
+  cerr << "Registering demo_tool_cpp with MCP server" << endl << endl;
+  
+  // Serialized once here; every reconnect re-sends the same registration payloads
+  ToolRegistry tools;
+  add_demo_tools(tools);
+  
+  vector<ServerTarget> targets = options.servers;
+  if (targets.empty()) targets.push_back(ServerTarget{"local", "", "", ""});
+  bool several = targets.size() > 1;
+  
+  ServerPool pool(options.routing);
+  vector<unique_ptr<WakeupEvent>> wakeups;
+  vector<unique_ptr<ServerSession>> sessions;
+  for (size_t i = 0; i < targets.size(); i++) {
+    WakeupEvent* wakeup = &g_wakeup;
+    if (several) {
+      wakeups.emplace_back(new WakeupEvent());
+      wakeup = wakeups.back().get();
+    }
+    sessions.emplace_back(new ServerSession(options, targets[i], tools, pool, pool.add_server(targets[i].name), *wakeup));
+    ServerSession& session = *sessions.back();
+    session.trace = trace;
+    if (several) {
+      string manifest = targets[i].manifest_path.empty() ? string("default") : targets[i].manifest_path;
+      uint64_t h = 1469598103934665603ULL;  // FNV-1a 64 of the manifest path
+      for (unsigned char c : manifest) {
+        h ^= c;
+        h *= 1099511628211ULL;
+      }
+      char variant[17];
+      snprintf(variant, sizeof(variant), "%016llx", (unsigned long long)h);
+      session.tag = "[" + targets[i].name + "] ";
+      session.cache_variant = i == 0 ? string() : string(variant);
+      session.route_outbound = true;
+    } else {
+      session.local_socket_override = options.local_socket;
+    }
+  }
+  if (several && !options.local_socket.empty()) {
+    LOG(LOG_WARN) << "[WARN] --local-socket is ignored when serving several servers";
+  }
+  
+  metrics().set_queue_depth_source([&pool] { return pool.reverse_queue_depth(); });
+  metrics().set_server_source([&pool](ostream& out) { pool.write_prometheus(out); });
+  
+  if (!several) {
+    sessions[0]->run();
+  } else {
+    cerr << "Serving " << sessions.size() << " servers, routing outbound calls to the "
+         << (options.routing == RoutingPolicy::LEAST_LOADED ? "least-loaded" : "lowest-latency")
+         << " one" << endl << endl;
+    vector<thread> threads;
+    for (auto& session : sessions) threads.emplace_back([&session] { session->run(); });
+    while (g_running) g_wakeup.wait(chrono::hours(1));
+    for (auto& wakeup : wakeups) wakeup->notify();
+    for (auto& t : threads) t.join();
+  }
+  
+  metrics().set_server_source(nullptr);
+  metrics().set_queue_depth_source(nullptr);
+  cerr << endl << endl << string(60, '=') << endl;
+  cerr << "Shutting down..." << endl;
+  cerr << string(60, '=') << endl;
+  return 0;
+}
+
+// Minimal loopback socket helpers shared by the mock server and the metrics endpoint
+#ifdef _WIN32
+typedef SOCKET socket_t;
+static const socket_t kInvalidSocket = INVALID_SOCKET;
+static void close_socket(socket_t s) { closesocket(s); }
+static void shutdown_socket(socket_t s) { shutdown(s, SD_BOTH); }
+static const int kSendFlags = 0;
+#else
+typedef int socket_t;
+static const socket_t kInvalidSocket = -1;
+static void close_socket(socket_t s) { close(s); }
+static void shutdown_socket(socket_t s) { shutdown(s, SHUT_RDWR); }
+static const int kSendFlags = MSG_NOSIGNAL;
+#endif
+
+static bool send_all(socket_t s, const string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    int n = (int)send(s, data.data() + sent, (int)(data.size() - sent), kSendFlags);
+    if (n <= 0) return false;
+    sent += (size_t)n;
+  }
+  return true;
+}
+
+// Bound every recv()/send() on s, so a silent peer cannot hold the calling thread
+static void set_socket_timeouts(socket_t s, chrono::milliseconds timeout) {
+#ifdef _WIN32
+  DWORD ms = (DWORD)timeout.count();
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&ms, sizeof(ms));
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&ms, sizeof(ms));
+#else
+  timeval tv;
+  tv.tv_sec = (time_t)(timeout.count() / 1000);
+  tv.tv_usec = (suseconds_t)((timeout.count() % 1000) * 1000);
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#endif
+}
+
+// Listen on 127.0.0.1:port (0 = ephemeral); bound_port receives the actual port
+static socket_t listen_loopback(int port, int& bound_port) {
+  socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s == kInvalidSocket) return kInvalidSocket;
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+  
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons((unsigned short)port);
+  socklen_t len = sizeof(addr);
+  if (::bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(s, 64) != 0 ||
+      getsockname(s, (sockaddr*)&addr, &len) != 0) {
+    close_socket(s);
+    return kInvalidSocket;
+  }
+  bound_port = ntohs(addr.sin_port);
+  return s;
+}
+
+#ifndef _WIN32
+// Listen on a Unix socket at path (replacing a stale one left behind by an earlier run)
+static socket_t listen_unix(const string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  if (path.size() >= sizeof(addr.sun_path)) return kInvalidSocket;
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.data(), path.size());
+  socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (s == kInvalidSocket) return kInvalidSocket;
+  unlink(path.c_str());
+  if (::bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0) {
+    close_socket(s);
+    return kInvalidSocket;
+  }
+  return s;
+}
+#endif
+
+// In-process loopback MCP server for --bench-mock
+// Speaks just enough of the MCP-Link protocol over plain HTTP on 127.0.0.1 for the complete
+// client path to run without a real server: GET /sse (endpoint event + event stream),
+// POST /messages/ (202 Accepted), tools/list, "remote" registration, tools/call on a
+// registered tool (-> reverse call -> tools/reply -> response), and canned results for
+// any other tool. Not a general HTTP server; one SSE stream at a time.
+class MockMcpServer {
+public:
+  explicit MockMcpServer(string auth_header = "Bearer mock-token") : auth(move(auth_header)) {}
+  
+  ~MockMcpServer() {
+    stop();
+  }
+  
+  // Listen on an ephemeral loopback port, or on a Unix socket at socket_path
+  bool start(const string& socket_path = string()) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+    listen_socket = listen_loopback(0, port);
+#else
+    unix_path = socket_path;
+    listen_socket = unix_path.empty() ? listen_loopback(0, port) : listen_unix(unix_path);
+#endif
+    if (listen_socket == kInvalidSocket) return false;
+    stopping = false;
+    accept_thread = thread(&MockMcpServer::accept_loop, this);
+    return true;
+  }
+  
+  void stop() {
+    if (stopping.exchange(true)) return;
+    if (listen_socket != kInvalidSocket) {
+      shutdown_socket(listen_socket);
+      close_socket(listen_socket);
+    }
+    {
+      lock_guard<mutex> lock(server_mutex);
+      for (auto s : client_sockets) shutdown_socket(s);
+    }
+    sse_cv.notify_all();
+    if (accept_thread.joinable()) accept_thread.join();
+    for (auto& t : client_threads) {
+      if (t.joinable()) t.join();
+    }
+    client_threads.clear();
+#ifdef _WIN32
+    WSACleanup();
+#else
+    if (!unix_path.empty()) unlink(unix_path.c_str());
+#endif
+  }
+  
+  // Over a Unix socket the host only fills in the Host header
+  string sse_url() const {
+    return port ? "http://127.0.0.1:" + to_string(port) + "/sse" : "http://localhost/sse";
+  }
+  
+  const string& auth_header() const {
+    return auth;
+  }
+  
+  // Queue one SSE data payload for the connected client
+  void send_event(string data) {
+    {
+      lock_guard<mutex> lock(sse_mutex);
+      sse_queue.push_back(move(data));
+    }
+    sse_cv.notify_one();
+  }
+  
+  // Deliver a reverse call exactly as the real server would when an AI calls a remote tool
+  void send_reverse_call(string_view tool, string_view call_id, string_view input_json) {
+    string event;
+    JsonWriter(event).raw("{\"reverse\":{\"tool\":").str(tool)
+                     .raw(",\"call_id\":").str(call_id)
+                     .raw(",\"input\":").raw(input_json).raw("}}");
+    send_event(move(event));
+  }
+  
+  size_t replies_received() const {
+    return replies;
+  }
+  
+  // Called with the id of every tools/reply, including replies to reverse calls injected with
+  // send_reverse_call() (as --replay does); set before start()
+  void set_reply_observer(function<void(string_view call_id)> observer) {
+    reply_observer = move(observer);
+  }
+  
+private:
+  string auth;
+  socket_t listen_socket = kInvalidSocket;
+  int port = 0;
+  string unix_path;
+  atomic<bool> stopping{true};
+  thread accept_thread;
+  mutex server_mutex;
+  vector<thread> client_threads;
+  vector<socket_t> client_sockets;
+  
+  mutex sse_mutex;
+  condition_variable sse_cv;
+  deque<string> sse_queue;
+  
+  mutex state_mutex;
+  set<string> registered_tools;
+  map<string, string> reply_routes;  // call_id -> id of the tools/call that caused it
+  uint64_t next_call = 0;
+  atomic<size_t> replies{0};
+  function<void(string_view call_id)> reply_observer;
+  
+  void accept_loop() {
+    // Server-side allocations are not the client's; keep --bench allocation counts honest
+    t_alloc_uncounted = true;
+    while (!stopping) {
+      socket_t s = accept(listen_socket, nullptr, nullptr);
+      if (s == kInvalidSocket) {
+        if (stopping) break;
+        continue;
+      }
+      int one = 1;
+      if (port) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+      lock_guard<mutex> lock(server_mutex);
+      client_sockets.push_back(s);
+      client_threads.emplace_back(&MockMcpServer::serve_connection, this, s);
+    }
+  }
+  
+  static string header_value(const string& headers, const char* lower_name) {
+    string lower = headers;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    size_t pos = lower.find(string("\r\n") + lower_name + ":");
+    if (pos == string::npos) return "";
+    pos += strlen(lower_name) + 3;
+    size_t end = headers.find("\r\n", pos);
+    string value = headers.substr(pos, end - pos);
+    size_t first = value.find_first_not_of(' ');
+    return first == string::npos ? "" : value.substr(first);
+  }
+  
+  void serve_connection(socket_t s) {
+    t_alloc_uncounted = true;
+    string in;
+    char chunk[16 * 1024];
+    while (!stopping) {
+      size_t header_end;
+      while ((header_end = in.find("\r\n\r\n")) == string::npos) {
+        int n = (int)recv(s, chunk, sizeof(chunk), 0);
+        if (n <= 0) return finish_connection(s);
+        in.append(chunk, (size_t)n);
+      }
+      string headers = in.substr(0, header_end + 2);
+      size_t content_length = (size_t)atoll(header_value(headers, "content-length").c_str());
+      while (in.size() < header_end + 4 + content_length) {
+        int n = (int)recv(s, chunk, sizeof(chunk), 0);
+        if (n <= 0) return finish_connection(s);
+        in.append(chunk, (size_t)n);
+      }
+      string body = in.substr(header_end + 4, content_length);
+      in.erase(0, header_end + 4 + content_length);
+      
+      bool is_get = headers.compare(0, 4, "GET ") == 0;
+      bool is_post = headers.compare(0, 5, "POST ") == 0;
+      if (header_value(headers, "authorization") != auth) {
+        send_all(s, "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n");
+      } else if (is_get && headers.find(" /sse") != string::npos) {
+        serve_sse(s);
+        return finish_connection(s);
+      } else if (is_post) {
+        if (!send_all(s, "HTTP/1.1 202 Accepted\r\nContent-Length: 8\r\n\r\nAccepted")) break;
+        handle_post_body(body);
+      } else {
+        send_all(s, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+      }
+    }
+    finish_connection(s);
+  }
+  
+  void finish_connection(socket_t s) {
+    {
+      lock_guard<mutex> lock(server_mutex);
+      client_sockets.erase(remove(client_sockets.begin(), client_sockets.end(), s), client_sockets.end());
+    }
+    close_socket(s);
+  }
+  
+  void serve_sse(socket_t s) {
+    if (!send_all(s, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                     "Connection: close\r\n\r\n"
+                     "event: endpoint\r\ndata: /messages/?session_id=mock-session\r\n\r\n")) return;
+    uint64_t event_id = 0;
+    string out;
+    while (!stopping) {
+      deque<string> batch;
+      {
+        unique_lock<mutex> lock(sse_mutex);
+        sse_cv.wait_for(lock, chrono::seconds(5), [this] { return !sse_queue.empty() || stopping; });
+        batch.swap(sse_queue);
+      }
+      out.clear();
+      if (batch.empty()) out = ": ping\n\n";
+      for (auto& data : batch) {
+        out += "id: " + to_string(++event_id) + "\ndata: " + data + "\n\n";
+      }
+      if (!send_all(s, out)) return;
+    }
+  }
+  
+  // A POST body is one JSON-RPC message or a batch array of them
+  void handle_post_body(const string& body) {
+    size_t first = body.find_first_not_of(" \t\r\n");
+    if (first != string::npos && body[first] == '[') {
+      JsonReader::for_each_element(body, [this](const JsonValue& msg) { handle_message(msg.raw); });
+    } else {
+      handle_message(body);
+    }
+  }
+  
+  void handle_message(string_view msg) {
+    JsonReader::Field f[6] = {
+      JsonReader::Field("id"), JsonReader::Field("method"), JsonReader::Field("params.name"),
+      JsonReader::Field("params.arguments.input.tool_name"), JsonReader::Field("params.result"),
+      JsonReader::Field("params.arguments"),
+    };
+    JsonReader::extract(msg, f, 6);
+    string method = f[1].value.to_string();
+    string_view id = f[0].value.raw;
+    if (!f[0].value.found()) return;  // Notification - nothing to answer
+    string quoted_id = f[0].value.is_string() ? "\"" + string(id) + "\"" : string(id);
+    
+    string event;
+    JsonWriter w(event);
+    if (method == "tools/list") {
+      w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(quoted_id)
+       .raw(",\"result\":{\"tools\":[{\"name\":\"remote\"},{\"name\":\"sqlite\"}]}}");
+    } else if (method == "ping") {
+      w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(quoted_id).raw(",\"result\":{}}");
+    } else if (method == "tools/reply") {
+      if (reply_observer) reply_observer(f[0].value.to_string());
+      string original_id;
+      {
+        lock_guard<mutex> lock(state_mutex);
+        auto it = reply_routes.find(f[0].value.to_string());
+        if (it == reply_routes.end()) return;
+        original_id = move(it->second);
+        reply_routes.erase(it);
+      }
+      replies++;
+      w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(original_id).raw(",\"result\":").raw(f[4].value.raw).raw('}');
+    } else if (method == "tools/call") {
+      string name = f[2].value.to_string();
+      if (name == "remote") {
+        string tool = f[3].value.to_string();
+        {
+          lock_guard<mutex> lock(state_mutex);
+          registered_tools.insert(tool);
+        }
+        w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(quoted_id)
+         .raw(",\"result\":{\"content\":[{\"type\":\"text\",\"text\":")
+         .str("Successfully registered tool: " + tool).raw("}],\"isError\":false}}");
+      } else {
+        bool is_remote;
+        string call_id;
+        {
+          lock_guard<mutex> lock(state_mutex);
+          is_remote = registered_tools.count(name) > 0;
+          if (is_remote) {
+            call_id = "mock-call-" + to_string(++next_call);
+            reply_routes[call_id] = quoted_id;
+          }
+        }
+        if (is_remote) {
+          // The reverse input carries the original tools/call request, as the real server does
+          send_reverse_call(name, call_id, msg);
+          return;
+        }
+        w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(quoted_id)
+         .raw(",\"result\":{\"content\":[{\"type\":\"text\",\"text\":")
+         .str("mock result from " + name).raw("}],\"isError\":false}}");
+      }
+    } else {
+      w.raw("{\"jsonrpc\":\"2.0\",\"id\":").raw(quoted_id)
+       .raw(",\"error\":{\"code\":-32601,\"message\":\"Method not found\"}}");
+    }
+    send_event(move(event));
+  }
+};
+
+// Optional Prometheus endpoint (--metrics-port N)
+// Serves Metrics::prometheus_text() to any GET on 127.0.0.1:N, one short request per
+// connection. Bound to loopback only: the counters are local diagnostics, not an API.
+class MetricsServer {
+public:
+  ~MetricsServer() {
+    stop();
+  }
+  
+  bool start(int port) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return false;
+#endif
+    int bound_port = 0;
+    listen_socket = listen_loopback(port, bound_port);
+    if (listen_socket == kInvalidSocket) return false;
+    stopping = false;
+    server_thread = thread(&MetricsServer::serve_loop, this);
+    return true;
+  }
+  
+  void stop() {
+    if (stopping.exchange(true)) return;
+    shutdown_socket(listen_socket);
+    close_socket(listen_socket);
+    {
+      lock_guard<mutex> lock(client_mutex);
+      if (client != kInvalidSocket) shutdown_socket(client);  // Ends a recv()/send() in progress
+    }
+    if (server_thread.joinable()) server_thread.join();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+  }
+  
+private:
+  // One scrape at a time, so a client that connects and goes quiet is cut off after this long
+  static constexpr chrono::milliseconds kClientTimeout{2000};
+  socket_t listen_socket = kInvalidSocket;
+  atomic<bool> stopping{true};
+  thread server_thread;
+  mutex client_mutex;
+  socket_t client = kInvalidSocket;  // Being served; stop() shuts it down
+  
+  void serve_loop() {
+    while (!stopping) {
+      socket_t s = accept(listen_socket, nullptr, nullptr);
+      if (s == kInvalidSocket) continue;
+      {
+        lock_guard<mutex> lock(client_mutex);
+        if (stopping) {
+          close_socket(s);
+          break;
+        }
+        client = s;
+      }
+      set_socket_timeouts(s, kClientTimeout);
+      // Read the request head; the path is ignored
+      string request;
+      char chunk[2048];
+      while (request.find("\r\n\r\n") == string::npos && request.size() < 16 * 1024) {
+        int n = (int)recv(s, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        request.append(chunk, (size_t)n);
+      }
+      if (request.compare(0, 4, "GET ") == 0) {
+        string body = metrics().prometheus_text();
+        send_all(s, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+      } else if (!request.empty()) {
+        send_all(s, "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+      }
+      {
+        lock_guard<mutex> lock(client_mutex);
+        client = kInvalidSocket;
+      }
+      shutdown_socket(s);
+      close_socket(s);
+    }
+  }
+};
+
+// Percentile of an already sorted sample set
+static double percentile(const vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0.0;
+  size_t idx = (size_t)(p * (double)(sorted.size() - 1) + 0.5);
+  return sorted[min(idx, sorted.size() - 1)];
+}
+
+static void write_latency_json(JsonWriter& w, vector<double>& samples_us) {
+  sort(samples_us.begin(), samples_us.end());
+  w.raw("{\"p50\":").decimal(percentile(samples_us, 0.50))
+   .raw(",\"p99\":").decimal(percentile(samples_us, 0.99))
+   .raw(",\"p999\":").decimal(percentile(samples_us, 0.999))
+   .raw(",\"max\":").decimal(samples_us.empty() ? 0.0 : samples_us.back())
+   .raw('}');
+}
+
+static uint64_t allocation_count() {
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+  return g_alloc_count.load(memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+// Allocations made by dispatcher workers while handling calls (parse, handler, tools/reply)
+static uint64_t dispatch_allocation_count() {
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+  return g_dispatch_alloc_count.load(memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
+
+// --bench: measure the full register -> reverse call -> tools/reply round trip
+// Each benchmark call is a tools/call on our own demo_tool_cpp, so it crosses every layer:
+// request serialization, pooled POST, server routing, SSE parse, dispatch, handler,
+// tools/reply POST and response correlation. Results are printed as one JSON object on
+// stdout (logs stay on stderr) so runs can be compared across releases.
+int run_bench(const ProviderOptions& options, TraceRecorder* trace = nullptr) {
+  const size_t calls = max((size_t)1, options.bench_calls);
+  const size_t concurrency = max((size_t)1, min(options.bench_concurrency, calls));
+  
+  // Micro-benchmark: json_escape / JsonWriter on a representative reply payload
+  string payload;
+  for (int i = 0; i < 64; i++) {
+    payload += "Row " + to_string(i) + ": name=\"widget\"\tpath=C:\\models\\part.f3d\nresult ok; ";
+  }
+  const size_t escape_iterations = 20000;
+  string escaped;
+  escaped.reserve(payload.size() * 2);
+  uint64_t escape_allocs_before = allocation_count();
+  auto escape_start = chrono::steady_clock::now();
+  for (size_t i = 0; i < escape_iterations; i++) {
+    escaped.clear();
+    JsonWriter(escaped).str(payload);
+  }
+  double escape_ns = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - escape_start).count();
+  uint64_t escape_allocs = allocation_count() - escape_allocs_before;
+  
+  // Server: in-process mock, or the real one found through native messaging discovery
+  unique_ptr<MockMcpServer> mock;
+  string server_url, auth_token, local_socket;
+  if (options.bench_mock) {
+    mock.reset(new MockMcpServer());
+    if (!mock->start(options.local_socket)) {  // --local-socket serves the mock on that socket only
+      cerr << "ERROR: Could not start mock server" << endl;
+      return 1;
+    }
+    server_url = mock->sse_url();
+    auth_token = mock->auth_header();
+  } else {
+    string manifest_path = find_native_messaging_manifest();
+    if (manifest_path.empty()) {
+      cerr << "ERROR: Could not find manifest (use --bench-mock to benchmark without a server)" << endl;
+      return 1;
+    }
+    if (!load_cached_endpoint(manifest_path, options.discovery_cache_ttl, server_url, auth_token, local_socket) &&
+        !discover_endpoint_via_native_binary(manifest_path, server_url, auth_token, local_socket)) {
+      return 1;
+    }
+  }
+  
+  ToolRegistry tools;  // Before conn: its reader thread classifies calls with it
+  add_demo_tools(tools);
+  SSEConnection conn(options.http_pool_size, options.queue_capacity, options.http2);
+  configure_connection(conn, options, tools);
+  conn.set_trace(trace);
+  conn.server_url = server_url;
+  conn.auth_header = auth_token;
+  if (!options.no_local_socket) conn.local_socket = options.local_socket.empty() ? local_socket : options.local_socket;
+  if (!conn.connect() || !tools.register_all(conn)) {
+    cerr << "ERROR: Could not connect and register for benchmark" << endl;
+    return 1;
+  }
+  ReverseCallDispatcher dispatcher(conn, [&tools](SSEConnection& c, const ReverseCall& call) {
+    tools.dispatch(c, call);
+  }, options.worker_threads);
+  tools.apply_concurrency_limits(dispatcher);
+  dispatcher.set_reserved_workers(options.reserved_workers);
+  dispatcher.start();
+  
+  const string arguments = R"({"message":"bench"})";
+  auto one_call = [&](vector<double>* roundtrip_us, vector<double>* post_us) {
+    auto t0 = chrono::steady_clock::now();
+    PendingRequest pending = conn.start_request_with("tools/call", [&](JsonWriter& w) {
+      w.raw("{\"name\":\"demo_tool_cpp\",\"arguments\":").raw(arguments).raw('}');
+    });
+    auto t1 = chrono::steady_clock::now();
+    string response = conn.wait_response(pending, "tools/call", chrono::seconds(30));
+    auto t2 = chrono::steady_clock::now();
+    if (roundtrip_us) roundtrip_us->push_back((double)chrono::duration_cast<chrono::nanoseconds>(t2 - t0).count() / 1000.0);
+    if (post_us) post_us->push_back((double)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count() / 1000.0);
+    // Rejected and shed calls are answered too, with isError: they count as errors
+    JsonValue result = JsonReader::get(response, "result");
+    return result.is_object() && JsonReader::get(result.raw, "isError").raw != "true";
+  };
+  
+  // Warm up connections, thread-local buffers and the server
+  for (size_t i = 0; i < min((size_t)50, calls); i++) one_call(nullptr, nullptr);
+  
+  vector<vector<double>> roundtrip(concurrency), posts(concurrency);
+  atomic<size_t> next_call{0};
+  atomic<size_t> errors{0};
+  uint64_t allocs_before = allocation_count();
+  uint64_t dispatch_allocs_before = dispatch_allocation_count();
+  uint64_t rejected_before = metrics().counter(Metrics::CALLS_REJECTED);
+  uint64_t shed_before = metrics().counter(Metrics::CALLS_SHED);
+  auto start = chrono::steady_clock::now();
+  
+  vector<thread> callers;
+  for (size_t t = 0; t < concurrency; t++) {
+    roundtrip[t].reserve(calls / concurrency + 1);
+    posts[t].reserve(calls / concurrency + 1);
+    callers.emplace_back([&, t] {
+      while (next_call.fetch_add(1) < calls) {
+        if (!one_call(&roundtrip[t], &posts[t])) errors++;
+      }
+    });
+  }
+  for (auto& c : callers) c.join();
+  
+  double seconds = (double)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+  uint64_t allocs = allocation_count() - allocs_before;
+  uint64_t dispatch_allocs = dispatch_allocation_count() - dispatch_allocs_before;
+  dispatcher.stop();
+  
+  vector<double> all_roundtrip, all_posts;
+  for (size_t t = 0; t < concurrency; t++) {
+    all_roundtrip.insert(all_roundtrip.end(), roundtrip[t].begin(), roundtrip[t].end());
+    all_posts.insert(all_posts.end(), posts[t].begin(), posts[t].end());
+  }
+  
+  string report;
+  JsonWriter w(report);
+  w.raw("{\"benchmark\":\"reverse_mcp_cpp\",\"server\":").str(options.bench_mock ? "mock" : "live")
+   .raw(",\"calls\":").number((long long)calls)
+   .raw(",\"concurrency\":").number((long long)concurrency)
+   .raw(",\"workers\":").number((long long)options.worker_threads)
+   .raw(",\"errors\":").number((long long)errors.load())
+   .raw(",\"rejected\":").number((long long)(metrics().counter(Metrics::CALLS_REJECTED) - rejected_before))
+   .raw(",\"shed\":").number((long long)(metrics().counter(Metrics::CALLS_SHED) - shed_before))
+   .raw(",\"duration_s\":").decimal(seconds, 6)
+   .raw(",\"calls_per_sec\":").decimal(seconds > 0 ? (double)calls / seconds : 0.0, 1)
+   .raw(",\"roundtrip_us\":");
+  write_latency_json(w, all_roundtrip);
+  w.raw(",\"http_post_us\":");
+  write_latency_json(w, all_posts);
+  w.raw(",\"allocs_per_call\":");
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+  w.decimal((double)allocs / (double)calls, 2);
+  w.raw(",\"dispatch_allocs_per_call\":").decimal((double)dispatch_allocs / (double)calls, 2);
+#else
+  (void)allocs;
+  (void)dispatch_allocs;
+  w.raw("null");  // Build with -DREVERSE_MCP_COUNT_ALLOCS to count allocations
+  w.raw(",\"dispatch_allocs_per_call\":null");
+#endif
+  w.raw(",\"json_escape\":{\"bytes\":").number((long long)payload.size())
+   .raw(",\"ns_per_op\":").decimal(escape_ns / (double)escape_iterations, 1)
+   .raw(",\"mb_per_s\":").decimal(escape_ns > 0 ? (double)payload.size() * (double)escape_iterations / (escape_ns / 1e9) / 1e6 : 0.0, 1)
+   .raw(",\"allocs_per_op\":");
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+  w.decimal((double)escape_allocs / (double)escape_iterations, 2);
+#else
+  (void)escape_allocs;
+  w.raw("null");
+#endif
+  w.raw("}}");
+  cout << report << endl;
+  return errors.load() == 0 ? 0 : 2;
+}
+
+// --replay FILE: run the reverse-call traffic of a --record trace against the mock server
+// The reverse calls and cancellations the recorded server sent are re-sent by the in-process
+// mock at their recorded offsets divided by --replay-speed (or back to back), under fresh call
+// ids, and go through the normal reader, lanes, dispatcher and handlers; tool calls the
+// handlers make are answered by the mock. The rest of the trace (the endpoint, responses to the
+// recorded session's own requests, calls for tools we do not provide) only made sense in that
+// session and is skipped. Like --bench, one JSON object is printed on stdout.
+int run_replay(const ProviderOptions& options, TraceRecorder* trace = nullptr) {
+  struct ReplayEvent {
+    long long t_us = 0;  // Offset in the trace
+    bool cancel = false;
+    string tool, call_id, input;  // Reverse call; for a cancellation, call_id is the one cancelled
+  };
+  
+  ifstream in(options.replay_path);
+  if (!in.is_open()) {
+    cerr << "ERROR: Could not open trace " << options.replay_path << endl;
+    return 1;
+  }
+  ToolRegistry tools;  // Before conn: its reader thread classifies calls with it
+  add_demo_tools(tools);
+  
+  // Recordings appended to one file play one after the other
+  vector<ReplayEvent> events;
+  size_t skipped = 0;
+  long long segment_base = 0, last_t = 0;
+  map<string, string> replay_ids;  // Recorded call_id -> the id it is replayed under
+  auto add_message = [&](string_view msg, long long t) {
+    JsonReader::Field f[5] = {
+      JsonReader::Field("reverse.tool"), JsonReader::Field("reverse.call_id"), JsonReader::Field("reverse.input"),
+      JsonReader::Field("method"), JsonReader::Field("params.requestId"),
+    };
+    JsonReader::extract(msg, f, 5);
+    ReplayEvent ev;
+    ev.t_us = t;
+    if (f[0].value.found()) {
+      ev.tool = f[0].value.to_string();
+      if (!tools.find(ev.tool)) {
+        skipped++;
+        return;
+      }
+      ev.call_id = "replay-" + to_string(events.size() + 1);
+      ev.input = f[2].value.found() ? string(f[2].value.raw) : string("{}");
+      replay_ids[f[1].value.to_string()] = ev.call_id;
+    } else if (f[3].value.to_string() == "notifications/cancelled") {
+      // Keyed like SSEConnection::route_message, so replay cancels only what a live run would
+      auto it = replay_ids.find(f[4].value.to_string());
+      if (it == replay_ids.end()) {
+        skipped++;
+        return;
+      }
+      ev.cancel = true;
+      ev.call_id = it->second;
+    } else {
+      skipped++;
+      return;
+    }
+    events.push_back(move(ev));
+  };
+  
+  string line;
+  while (getline(in, line)) {
+    JsonReader::Field fields[4] = {
+      JsonReader::Field("t"), JsonReader::Field("in"), JsonReader::Field("data"), JsonReader::Field("trace"),
+    };
+    if (!JsonReader::extract(line, fields, 4)) continue;
+    if (fields[3].value.found()) {
+      segment_base = last_t;
+      continue;
+    }
+    if (!fields[1].value.found() || fields[1].value.to_string() != "message") continue;
+    long long t = segment_base + atoll(string(fields[0].value.raw).c_str());
+    last_t = max(last_t, t);
+    string data = fields[2].value.to_string();
+    size_t first = data.find_first_not_of(" \t\r\n");
+    if (first != string::npos && data[first] == '[') {
+      JsonReader::for_each_element(data, [&](const JsonValue& element) { add_message(element.raw, t); });
+    } else {
+      add_message(data, t);
+    }
+  }
+  size_t calls = 0;
+  for (const ReplayEvent& ev : events) calls += ev.cancel ? 0 : 1;
+  if (calls == 0) {
+    cerr << "ERROR: No reverse calls for our tools in " << options.replay_path << endl;
+    return 1;
+  }
+  
+  // Replies are matched to the time their call was sent
+  mutex replay_mutex;
+  condition_variable replay_cv;
+  unordered_map<string, chrono::steady_clock::time_point> outstanding;
+  vector<double> roundtrip_us;
+  roundtrip_us.reserve(calls);
+  
+  MockMcpServer mock;
+  mock.set_reply_observer([&](string_view call_id) {
+    auto now = chrono::steady_clock::now();
+    lock_guard<mutex> lock(replay_mutex);
+    auto it = outstanding.find(string(call_id));
+    if (it == outstanding.end()) return;
+    roundtrip_us.push_back((double)chrono::duration_cast<chrono::nanoseconds>(now - it->second).count() / 1000.0);
+    outstanding.erase(it);
+    replay_cv.notify_all();
+  });
+  if (!mock.start(options.local_socket)) {
+    cerr << "ERROR: Could not start mock server" << endl;
+    return 1;
+  }
+  
+  SSEConnection conn(options.http_pool_size, options.queue_capacity, options.http2);
+  configure_connection(conn, options, tools);
+  conn.set_trace(trace);
+  conn.server_url = mock.sse_url();
+  conn.auth_header = mock.auth_header();
+  if (!options.local_socket.empty() && !options.no_local_socket) conn.local_socket = options.local_socket;
+  if (!conn.connect() || !tools.register_all(conn)) {
+    cerr << "ERROR: Could not connect and register for replay" << endl;
+    return 1;
+  }
+  ReverseCallDispatcher dispatcher(conn, [&tools](SSEConnection& c, const ReverseCall& call) {
+    tools.dispatch(c, call);
+  }, options.worker_threads);
+  tools.apply_concurrency_limits(dispatcher);
+  dispatcher.set_call_timeout(chrono::milliseconds(options.call_timeout_ms));
+  dispatcher.set_reserved_workers(options.reserved_workers);
+  dispatcher.start();
+  
+  cerr << "[REPLAY] " << calls << " reverse call(s) from " << options.replay_path << " at "
+       << (options.replay_speed > 0 ? to_string(options.replay_speed) + "x" : string("max speed")) << endl;
+  uint64_t allocs_before = allocation_count();
+  uint64_t dispatch_allocs_before = dispatch_allocation_count();
+  auto start = chrono::steady_clock::now();
+  long long t0 = events.front().t_us;
+  size_t cancellations = 0;
+  for (const ReplayEvent& ev : events) {
+    if (options.replay_speed > 0) {
+      this_thread::sleep_until(start + chrono::microseconds((long long)((double)(ev.t_us - t0) / options.replay_speed)));
+    }
+    if (ev.cancel) {
+      {
+        lock_guard<mutex> lock(replay_mutex);
+        if (!outstanding.erase(ev.call_id)) continue;  // Answered already: too late to cancel
+      }
+      string notification;
+      JsonWriter(notification).raw("{\"jsonrpc\":\"2.0\",\"method\":\"notifications/cancelled\",\"params\":{\"requestId\":")
+                              .str(ev.call_id).raw(",\"reason\":\"replayed\"}}");
+      mock.send_event(move(notification));
+      cancellations++;
+      continue;
+    }
+    {
+      lock_guard<mutex> lock(replay_mutex);
+      outstanding[ev.call_id] = chrono::steady_clock::now();
+    }
+    mock.send_reverse_call(ev.tool, ev.call_id, ev.input);
+  }
+  
+  // Calls past their deadline are dropped by the dispatcher, so waiting longer is pointless
+  auto drain = chrono::milliseconds(options.call_timeout_ms > 0 ? options.call_timeout_ms : 120000) + chrono::seconds(1);
+  size_t unanswered;
+  {
+    unique_lock<mutex> lock(replay_mutex);
+    replay_cv.wait_for(lock, drain, [&] { return outstanding.empty(); });
+    unanswered = outstanding.size();
+  }
+  double seconds = (double)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+  uint64_t allocs = allocation_count() - allocs_before;
+  uint64_t dispatch_allocs = dispatch_allocation_count() - dispatch_allocs_before;
+  dispatcher.stop();
+  
+  vector<double> samples;
+  {
+    lock_guard<mutex> lock(replay_mutex);
+    samples = roundtrip_us;
+  }
+  string report;
+  JsonWriter w(report);
+  w.raw("{\"replay\":").str(options.replay_path)
+   .raw(",\"speed\":");
+  if (options.replay_speed > 0) w.decimal(options.replay_speed, 2);
+  else w.raw("\"max\"");
+  w.raw(",\"reverse_calls\":").number((long long)calls)
+   .raw(",\"cancellations\":").number((long long)cancellations)
+   .raw(",\"skipped_events\":").number((long long)skipped)
+   .raw(",\"replies\":").number((long long)samples.size())
+   .raw(",\"unanswered\":").number((long long)unanswered)
+   .raw(",\"workers\":").number((long long)options.worker_threads)
+   .raw(",\"trace_duration_s\":").decimal((double)(events.back().t_us - t0) / 1e6, 6)
+   .raw(",\"duration_s\":").decimal(seconds, 6)
+   .raw(",\"calls_per_sec\":").decimal(seconds > 0 ? (double)calls / seconds : 0.0, 1)
+   .raw(",\"roundtrip_us\":");
+  write_latency_json(w, samples);
+  w.raw(",\"allocs_per_call\":");
+#ifdef REVERSE_MCP_COUNT_ALLOCS
+  w.decimal((double)allocs / (double)calls, 2);
+  w.raw(",\"dispatch_allocs_per_call\":").decimal((double)dispatch_allocs / (double)calls, 2);
+#else
+  (void)allocs;
+  (void)dispatch_allocs;
+  w.raw("null,\"dispatch_allocs_per_call\":null");  // Build with -DREVERSE_MCP_COUNT_ALLOCS
+#endif
+  w.raw('}');
+  cout << report << endl;
+  return unanswered == 0 ? 0 : 2;
+}
+
+int main(int argc, char* argv[]) {
+  ProviderOptions options;
+  bool help = false;
+  
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--background") options.background = true;
+    if (arg == "--help") help = true;
+    if (arg == "--http-pool-size" && i + 1 < argc) options.http_pool_size = (size_t)max(1, atoi(argv[++i]));
+    if (arg == "--workers" && i + 1 < argc) options.worker_threads = (size_t)max(1, atoi(argv[++i]));
+    if (arg == "--queue-capacity" && i + 1 < argc) options.queue_capacity = (size_t)max(2, atoi(argv[++i]));
+    if (arg == "--reserved-workers" && i + 1 < argc) options.reserved_workers = (size_t)max(0, atoi(argv[++i]));
+    if (arg == "--lane-scheduling" && i + 1 < argc) {
+      string scheduling = argv[++i];
+      if (scheduling == "strict") options.lane_scheduling = LaneScheduling::STRICT;
+      else if (scheduling == "weighted") options.lane_scheduling = LaneScheduling::WEIGHTED;
+      else LOG(LOG_WARN) << "[WARN] Unknown --lane-scheduling mode '" << scheduling << "' (use strict or weighted)";
+    }
+    if (arg == "--lane-weights" && i + 1 < argc) {
+      unsigned w[3];
+      if (sscanf(argv[++i], "%u,%u,%u", &w[0], &w[1], &w[2]) == 3) {
+        for (int l = 0; l < 3; l++) options.lane_weights[l] = max(1u, w[l]);
+      }
+    }
+    if (arg == "--max-in-flight" && i + 1 < argc) options.max_in_flight = (size_t)max(0, atoi(argv[++i]));
+    if (arg == "--overload-policy" && i + 1 < argc) {
+      string policy = argv[++i];
+      if (policy == "block") options.overload_policy = OverloadPolicy::BLOCK;
+      else if (policy == "reject") options.overload_policy = OverloadPolicy::REJECT;
+      else if (policy == "shed-oldest") options.overload_policy = OverloadPolicy::SHED_OLDEST;
+      else LOG(LOG_WARN) << "[WARN] Unknown --overload-policy '" << policy << "' (use block, reject or shed-oldest)";
+    }
+    if (arg == "--call-timeout" && i + 1 < argc) options.call_timeout_ms = (long long)(atof(argv[++i]) * 1000);
+    if (arg == "--local-socket" && i + 1 < argc) options.local_socket = argv[++i];
+    if (arg == "--compress" && i + 1 < argc) {
+      string mode = argv[++i];
+      if (mode == "auto") options.compression = CompressionMode::AUTO;
+      else if (mode == "gzip") options.compression = CompressionMode::GZIP;
+      else if (mode == "zstd") options.compression = CompressionMode::ZSTD;
+      else if (mode == "off") options.compression = CompressionMode::OFF;
+      else LOG(LOG_WARN) << "[WARN] Unknown --compress mode '" << mode << "' (use auto, gzip, zstd or off)";
+    }
+    if (arg == "--compress-min-bytes" && i + 1 < argc) options.compress_min_bytes = (size_t)atoll(argv[++i]);
+    if (arg == "--no-local-socket") options.no_local_socket = true;
+    if (arg == "--manifest" && i + 1 < argc) {
+      string path = argv[++i];
+      options.servers.push_back(ServerTarget{path, path, "", ""});
+    }
+    if (arg == "--server" && i + 1 < argc) {
+      string url = argv[++i];
+      size_t host = url.find("://");
+      host = host == string::npos ? 0 : host + 3;
+      string name = url.substr(host, url.find('/', host) - host);
+      // Servers on one host (different paths) must not share a label in logs and metrics
+      size_t same = (size_t)count_if(options.servers.begin(), options.servers.end(), [&name](const ServerTarget& t) {
+        return t.name == name || t.name.compare(0, name.size() + 1, name + "#") == 0;
+      });
+      if (same) name += "#" + to_string(same + 1);
+      options.servers.push_back(ServerTarget{name, "", url, ""});
+    }
+    if (arg == "--server-auth" && i + 1 < argc) {
+      string header = argv[++i];
+      if (!options.servers.empty() && !options.servers.back().url.empty()) options.servers.back().auth_header = header;
+      else LOG(LOG_WARN) << "[WARN] --server-auth must follow the --server it belongs to";
+    }
+    if (arg == "--route" && i + 1 < argc) {
+      string route = argv[++i];
+      if (route == "least-loaded") options.routing = RoutingPolicy::LEAST_LOADED;
+      else if (route == "lowest-latency") options.routing = RoutingPolicy::LOWEST_LATENCY;
+      else LOG(LOG_WARN) << "[WARN] Unknown --route policy '" << route << "' (use least-loaded or lowest-latency)";
+    }
+    if (arg == "--heartbeat-interval" && i + 1 < argc) options.heartbeat_interval_ms = (long long)(atof(argv[++i]) * 1000);
+    if (arg == "--heartbeat-timeout" && i + 1 < argc) options.heartbeat_timeout_ms = (long long)(atof(argv[++i]) * 1000);
+    if (arg == "--result-cache" && i + 1 < argc) options.result_cache_entries = (size_t)max(0, atoi(argv[++i]));
+    if (arg == "--result-cache-ttl" && i + 1 < argc) options.result_cache_ttl = atoll(argv[++i]);
+    if (arg == "--http2") options.http2 = true;
+    if (arg == "--event-loop") options.event_loop = true;
+    if (arg == "--batch-window-us" && i + 1 < argc) options.batch_window_us = atoll(argv[++i]);
+    if (arg == "--batch-max" && i + 1 < argc) options.batch_max = (size_t)max(1, atoi(argv[++i]));
+    if (arg == "--discovery-cache-ttl" && i + 1 < argc) options.discovery_cache_ttl = atoll(argv[++i]);
+    if (arg == "--bench") options.bench = true;
+    if (arg == "--bench-mock") options.bench = options.bench_mock = true;
+    if (arg == "--bench-calls" && i + 1 < argc) options.bench_calls = (size_t)max(1, atoi(argv[++i]));
+    if (arg == "--bench-concurrency" && i + 1 < argc) options.bench_concurrency = (size_t)max(1, atoi(argv[++i]));
+    if (arg == "--record" && i + 1 < argc) options.record_path = argv[++i];
+    if (arg == "--replay" && i + 1 < argc) options.replay_path = argv[++i];
+    if (arg == "--replay-speed" && i + 1 < argc) {
+      string speed = argv[++i];
+      options.replay_speed = speed == "max" ? 0.0 : max(0.0, atof(speed.c_str()));
+    }
+    if (arg == "--metrics-port" && i + 1 < argc) options.metrics_port = atoi(argv[++i]);
+    if (arg == "--verbose") options.log_level = LOG_DEBUG;
+    if (arg == "--log-level" && i + 1 < argc) {
+      string level = argv[++i];
+      if (level == "error") options.log_level = LOG_ERROR;
+      else if (level == "warn") options.log_level = LOG_WARN;
+      else if (level == "info") options.log_level = LOG_INFO;
+      else if (level == "debug") options.log_level = LOG_DEBUG;
+    }
+  }
+  
+  if (help) {
+    cout << "Usage: reverse_mcp_cpp [--background] [--bench|--bench-mock|--replay FILE] [options]" << endl;
+    cout << endl << "Aura Friday Remote Tool Provider - Registers demo_tool_cpp with MCP server" << endl;
+    cout << endl << "Options:" << endl;
+    cout << "  --background          Run as a background worker" << endl;
+    cout << "  --http-pool-size N    Keep-alive HTTP connections used for POSTs (default 4)" << endl;
+    cout << "  --workers N           Threads handling reverse tool calls concurrently (default 4)" << endl;
+    cout << "  --queue-capacity N    Reverse calls buffered per priority lane ahead of the workers (default 1024)" << endl;
+    cout << "  --reserved-workers N  Extra threads kept for health/stats calls (default 1)" << endl;
+    cout << "  --lane-scheduling M   strict or weighted (default) priority between interactive, normal and batch calls" << endl;
+    cout << "  --lane-weights I,N,B  Shares for weighted scheduling (default 8,4,1)" << endl;
+    cout << "  --max-in-flight N     Reverse calls queued or running at once (default 0 = queue capacity only)" << endl;
+    cout << "  --overload-policy P   Past those limits: block (default, pause the stream), reject, or shed-oldest" << endl;
+    cout << "  --call-timeout S      Drop or cut short reverse calls after S seconds (default 120, 0 = none)" << endl;
+    cout << "  --heartbeat-interval S  Ping the server after S quiet seconds on the SSE stream (default 15, 0 = off)" << endl;
+    cout << "  --heartbeat-timeout S   Reconnect if nothing arrives S seconds after that (default 10)" << endl;
+    cout << "  --result-cache N      Cache up to N results of idempotent tool calls (default 0 = off)" << endl;
+    cout << "  --result-cache-ttl S  Seconds a cached tool result stays valid (default 30)" << endl;
+    cout << "  --http2               Multiplex the SSE stream and POSTs over one HTTP/2 connection" << endl;
+    cout << "  --event-loop          Drive the SSE stream and all POSTs from one non-blocking I/O thread" << endl;
+    cout << "  --batch-window-us N   Batch outgoing replies/requests for up to N microseconds (default 0 = off)" << endl;
+    cout << "  --batch-max N         Messages per batch POST (default 32)" << endl;
+    cout << "  --discovery-cache-ttl S  Seconds to reuse the cached server endpoint (default 86400, 0 = off)" << endl;
+    cout << "  --local-socket PATH   Talk to the server over this Unix socket (plain HTTP) instead of TCP+TLS" << endl;
+    cout << "  --no-local-socket     Ignore a local socket advertised by the server; always use its URL" << endl;
+    cout << "  --manifest PATH       Serve the server installed with this native messaging manifest (repeatable)" << endl;
+    cout << "  --server URL          Serve the MCP server at this SSE URL (repeatable)" << endl;
+    cout << "  --server-auth HEADER  Authorization header for the preceding --server (e.g. \"Bearer ...\")" << endl;
+    cout << "  --route P             With several servers, send tool calls to the least-loaded (default) or lowest-latency" << endl;
+    cout << "  --compress M          Request body compression: auto (default, as the server accepts), zstd, gzip, off" << endl;
+    cout << "  --compress-min-bytes N  Never compress bodies under N bytes (default 16384; raised adaptively)" << endl;
+    cout << "  --bench               Benchmark echo round trips against the MCP server, print JSON" << endl;
+    cout << "  --bench-mock          Same, against an in-process mock server (no install needed)" << endl;
+    cout << "  --bench-calls N       Calls to measure (default 2000)" << endl;
+    cout << "  --bench-concurrency N Concurrent callers (default 8)" << endl;
+    cout << "  --record FILE         Append received SSE events and sent messages, timestamped, to FILE (JSON Lines)" << endl;
+    cout << "  --replay FILE         Re-send the reverse calls recorded in FILE from the mock server, print JSON" << endl;
+    cout << "  --replay-speed X      Replay at X times the recorded pace, or max (default 1)" << endl;
+    cout << "  --metrics-port N      Serve Prometheus metrics on http://127.0.0.1:N/metrics" << endl;
+    cout << "  --log-level L         error, warn, info (default) or debug" << endl;
+    cout << "  --verbose             Same as --log-level debug" << endl;
+    return 0;
+  }
+  
+  AsyncLog::set_level(options.log_level);
+  
+  MetricsServer metrics_server;
+  if (options.metrics_port > 0) {
+    if (metrics_server.start(options.metrics_port)) {
+      cerr << "[OK] Metrics at http://127.0.0.1:" << options.metrics_port << "/metrics" << endl;
+    } else {
+      LOG(LOG_WARN) << "[WARN] Could not listen on metrics port " << options.metrics_port;
+    }
+  }
+  
+  TraceRecorder recorder;
+  TraceRecorder* trace = nullptr;
+  if (!options.record_path.empty()) {
+    if (recorder.open(options.record_path)) {
+      trace = &recorder;
+      cerr << "[OK] Recording traffic to " << options.record_path << endl;
+    } else {
+      LOG(LOG_WARN) << "[WARN] Could not open trace file " << options.record_path << " - not recording";
+    }
+  }
+  
+  if (options.bench || !options.replay_path.empty()) {
+    int rc = options.bench ? run_bench(options, trace) : run_replay(options, trace);
+    recorder.close();
+    AsyncLog::instance().flush_and_stop();
+    return rc;
   }
   
   // Setup signal handler
   signal(SIGINT, signal_handler);
   
-  if (background) {
+  if (options.background) {
     cerr << "Starting in background mode (PID: " << getpid() << ")..." << endl;
     cerr << "[OK] Background worker started (PID: " << getpid() << ")" << endl;
     cerr << "  Use 'kill " << getpid() << "' to stop" << endl;
   }
   
-  return main_worker(background);
+  int rc = main_worker(options, trace);
+  recorder.close();
+  AsyncLog::instance().flush_and_stop();
+  return rc;
 }
 